@@ -41,6 +41,7 @@ static void free_thread_options_to_cpu(struct thread_options *o)
 	free(o->lat_log_file);
 	free(o->iops_log_file);
 	free(o->hist_log_file);
+	free(o->pct_log_file);
 	free(o->replay_redirect);
 	free(o->exec_prerun);
 	free(o->exec_postrun);
@@ -78,6 +79,7 @@ void convert_thread_options_to_cpu(struct thread_options *o,
 	string_to_cpu(&o->lat_log_file, top->lat_log_file);
 	string_to_cpu(&o->iops_log_file, top->iops_log_file);
 	string_to_cpu(&o->hist_log_file, top->hist_log_file);
+	string_to_cpu(&o->pct_log_file, top->pct_log_file);
 	string_to_cpu(&o->replay_redirect, top->replay_redirect);
 	string_to_cpu(&o->exec_prerun, top->exec_prerun);
 	string_to_cpu(&o->exec_postrun, top->exec_postrun);
@@ -191,6 +193,7 @@ void convert_thread_options_to_cpu(struct thread_options *o,
 	o->log_offset = le32_to_cpu(top->log_offset);
 	o->log_gz = le32_to_cpu(top->log_gz);
 	o->log_gz_store = le32_to_cpu(top->log_gz_store);
+	o->log_gz_codec = le32_to_cpu(top->log_gz_codec);
 	o->log_unix_epoch = le32_to_cpu(top->log_unix_epoch);
 	o->norandommap = le32_to_cpu(top->norandommap);
 	o->softrandommap = le32_to_cpu(top->softrandommap);
@@ -273,6 +276,8 @@ void convert_thread_options_to_cpu(struct thread_options *o,
 	o->lat_percentiles = le32_to_cpu(top->lat_percentiles);
 	o->slat_percentiles = le32_to_cpu(top->slat_percentiles);
 	o->percentile_precision = le32_to_cpu(top->percentile_precision);
+	o->lat_hist_precision = le32_to_cpu(top->lat_hist_precision);
+	o->lat_hist_max = le64_to_cpu(top->lat_hist_max);
 	o->sig_figs = le32_to_cpu(top->sig_figs);
 	o->continue_on_error = le32_to_cpu(top->continue_on_error);
 	o->cgroup_weight = le32_to_cpu(top->cgroup_weight);
@@ -301,6 +306,8 @@ void convert_thread_options_to_cpu(struct thread_options *o,
 	o->write_lat_log = le32_to_cpu(top->write_lat_log);
 	o->write_iops_log = le32_to_cpu(top->write_iops_log);
 	o->write_hist_log = le32_to_cpu(top->write_hist_log);
+	o->write_pct_log = le32_to_cpu(top->write_pct_log);
+	o->log_format = le32_to_cpu(top->log_format);
 
 	o->trim_backlog = le64_to_cpu(top->trim_backlog);
 	o->rate_process = le32_to_cpu(top->rate_process);
@@ -345,6 +352,7 @@ void convert_thread_options_to_net(struct thread_options_pack *top,
 	string_to_net(top->lat_log_file, o->lat_log_file);
 	string_to_net(top->iops_log_file, o->iops_log_file);
 	string_to_net(top->hist_log_file, o->hist_log_file);
+	string_to_net(top->pct_log_file, o->pct_log_file);
 	string_to_net(top->replay_redirect, o->replay_redirect);
 	string_to_net(top->exec_prerun, o->exec_prerun);
 	string_to_net(top->exec_postrun, o->exec_postrun);
@@ -409,6 +417,7 @@ void convert_thread_options_to_net(struct thread_options_pack *top,
 	top->log_offset = cpu_to_le32(o->log_offset);
 	top->log_gz = cpu_to_le32(o->log_gz);
 	top->log_gz_store = cpu_to_le32(o->log_gz_store);
+	top->log_gz_codec = cpu_to_le32(o->log_gz_codec);
 	top->log_unix_epoch = cpu_to_le32(o->log_unix_epoch);
 	top->norandommap = cpu_to_le32(o->norandommap);
 	top->softrandommap = cpu_to_le32(o->softrandommap);
@@ -472,6 +481,8 @@ void convert_thread_options_to_net(struct thread_options_pack *top,
 	top->lat_percentiles = cpu_to_le32(o->lat_percentiles);
 	top->slat_percentiles = cpu_to_le32(o->slat_percentiles);
 	top->percentile_precision = cpu_to_le32(o->percentile_precision);
+	top->lat_hist_precision = cpu_to_le32(o->lat_hist_precision);
+	top->lat_hist_max = __cpu_to_le64(o->lat_hist_max);
 	top->sig_figs = cpu_to_le32(o->sig_figs);
 	top->continue_on_error = cpu_to_le32(o->continue_on_error);
 	top->cgroup_weight = cpu_to_le32(o->cgroup_weight);
@@ -500,6 +511,8 @@ void convert_thread_options_to_net(struct thread_options_pack *top,
 	top->write_lat_log = cpu_to_le32(o->write_lat_log);
 	top->write_iops_log = cpu_to_le32(o->write_iops_log);
 	top->write_hist_log = cpu_to_le32(o->write_hist_log);
+	top->write_pct_log = cpu_to_le32(o->write_pct_log);
+	top->log_format = cpu_to_le32(o->log_format);
 
 	for (i = 0; i < DDIR_RWDIR_CNT; i++) {
 		top->bs[i] = __cpu_to_le64(o->bs[i]);
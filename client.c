@@ -944,7 +944,7 @@ static void convert_io_stat(struct io_stat *dst, struct io_stat *src)
 
 static void convert_ts(struct thread_stat *dst, struct thread_stat *src)
 {
-	int i, j, k;
+	int i;
 
 	dst->error		= le32_to_cpu(src->error);
 	dst->thread_number	= le32_to_cpu(src->thread_number);
@@ -970,6 +970,8 @@ static void convert_ts(struct thread_stat *dst, struct thread_stat *src)
 	dst->clat_percentiles	= le32_to_cpu(src->clat_percentiles);
 	dst->lat_percentiles	= le32_to_cpu(src->lat_percentiles);
 	dst->slat_percentiles	= le32_to_cpu(src->slat_percentiles);
+	dst->plat_bits		= le32_to_cpu(src->plat_bits);
+	dst->plat_groups	= le32_to_cpu(src->plat_groups);
 	dst->percentile_precision = le64_to_cpu(src->percentile_precision);
 
 	for (i = 0; i < FIO_IO_U_LIST_MAX_LEN; i++) {
@@ -992,13 +994,12 @@ static void convert_ts(struct thread_stat *dst, struct thread_stat *src)
 	for (i = 0; i < FIO_IO_U_LAT_M_NR; i++)
 		dst->io_u_lat_m[i]	= le64_to_cpu(src->io_u_lat_m[i]);
 
-	for (i = 0; i < FIO_LAT_CNT; i++)
-		for (j = 0; j < DDIR_RWDIR_CNT; j++)
-			for (k = 0; k < FIO_IO_U_PLAT_NR; k++)
-				dst->io_u_plat[i][j][k] = le64_to_cpu(src->io_u_plat[i][j][k]);
-
-	for (j = 0; j < FIO_IO_U_PLAT_NR; j++)
-		dst->io_u_sync_plat[j] = le64_to_cpu(src->io_u_sync_plat[j]);
+	/*
+	 * Set up by fio_server_unpack_ts()
+	 */
+	dst->plat = src->plat;
+	for (i = 0; i < FIO_PLAT_ROWS * plat_nr(dst); i++)
+		dst->plat[i] = le64_to_cpu(src->plat[i]);
 
 	for (i = 0; i < DDIR_RWDIR_SYNC_CNT; i++)
 		dst->total_io_u[i]	= le64_to_cpu(src->total_io_u[i]);
@@ -1035,12 +1036,10 @@ static void convert_ts(struct thread_stat *dst, struct thread_stat *src)
 	for (i = 0; i < dst->nr_block_infos; i++)
 		dst->block_infos[i] = le32_to_cpu(src->block_infos[i]);
 	for (i = 0; i < DDIR_RWDIR_CNT; i++) {
-		for (j = 0; j < FIO_IO_U_PLAT_NR; j++) {
-			dst->io_u_plat_high_prio[i][j] = le64_to_cpu(src->io_u_plat_high_prio[i][j]);
-			dst->io_u_plat_low_prio[i][j] = le64_to_cpu(src->io_u_plat_low_prio[i][j]);
-		}
 		convert_io_stat(&dst->clat_high_prio_stat[i], &src->clat_high_prio_stat[i]);
 		convert_io_stat(&dst->clat_low_prio_stat[i], &src->clat_low_prio_stat[i]);
+		convert_io_stat(&dst->cachehit_lat_stat[i], &src->cachehit_lat_stat[i]);
+		convert_io_stat(&dst->cachemiss_lat_stat[i], &src->cachemiss_lat_stat[i]);
 	}
 
 	dst->ss_dur		= le64_to_cpu(src->ss_dur);
@@ -1060,6 +1059,7 @@ static void convert_ts(struct thread_stat *dst, struct thread_stat *src)
 
 	dst->cachehit		= le64_to_cpu(src->cachehit);
 	dst->cachemiss		= le64_to_cpu(src->cachemiss);
+	dst->nr_timeouts	= le64_to_cpu(src->nr_timeouts);
 }
 
 static void convert_gs(struct group_run_stats *dst, struct group_run_stats *src)
@@ -1482,6 +1482,11 @@ static int fio_client_handle_iolog(struct fio_client *client,
 		if (pdu->log_type == IO_LOG_TYPE_HIST) {
 			client_flush_hist_samples(f, pdu->log_hist_coarseness, pdu->samples,
 					   pdu->nr_samples * sizeof(struct io_sample));
+		} else if (pdu->log_format == LOG_FORMAT_BINARY) {
+			flush_samples_binary(f, pdu->samples,
+					pdu->nr_samples * sizeof(struct io_sample),
+					pdu->log_type, pdu->log_gz != 0,
+					pdu->log_gz_codec);
 		} else {
 			flush_samples(f, pdu->samples,
 					pdu->nr_samples * sizeof(struct io_sample));
@@ -1689,6 +1694,9 @@ static struct cmd_iolog_pdu *convert_iolog(struct fio_net_cmd *cmd,
 	ret->compressed		= le32_to_cpu(ret->compressed);
 	ret->log_offset		= le32_to_cpu(ret->log_offset);
 	ret->log_hist_coarseness = le32_to_cpu(ret->log_hist_coarseness);
+	ret->log_format		= le32_to_cpu(ret->log_format);
+	ret->log_gz		= le32_to_cpu(ret->log_gz);
+	ret->log_gz_codec	= le32_to_cpu(ret->log_gz_codec);
 
 	if (*store_direct)
 		return ret;
@@ -1800,7 +1808,16 @@ int fio_handle_client(struct fio_client *client)
 		break;
 		}
 	case FIO_NET_CMD_TS: {
-		struct cmd_ts_pdu *p = (struct cmd_ts_pdu *) cmd->payload;
+		struct fio_net_cmd *full = fio_server_unpack_ts(cmd);
+		struct cmd_ts_pdu *p;
+
+		if (!full) {
+			log_err("fio: bad TS pdu from %s\n", client->hostname);
+			break;
+		}
+		free(cmd);
+		cmd = full;
+		p = (struct cmd_ts_pdu *) cmd->payload;
 
 		dprint(FD_NET, "client: ts->ss_state = %u\n", (unsigned int) le32_to_cpu(p->ts.ss_state));
 		if (le32_to_cpu(p->ts.ss_state) & FIO_SS_DATA) {
@@ -4,8 +4,7 @@
  * An example back-end for GAS
  */
 
-#include <assert.h>
-#include <malloc.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #include "../fio.h"
@@ -13,49 +12,65 @@
 
 #include "gas.h"
 
+#ifdef ARCH_HAVE_IOURING
+#include "../os/linux/io_uring.h"
+#endif
+
+struct gas_direct_io_options {
+	struct gas_options gas;
+	unsigned int uring;
+};
+
 static struct fio_option gas_direct_io_options[] = {
+	GAS_OPTIONS(struct gas_direct_io_options)
+	{
+		.name	= "gas_uring",
+		.lname	= "GAS io_uring mode",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct gas_direct_io_options, uring),
+		.def	= "0",
+		.help	= "Submit requests to an io_uring instead of worker threads",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_GAS,
+	},
 	{
 		.name        = NULL,
 	},
 };
 
-// Alignment
-#define BLKSIZE 16*1024
-
-// Single IO size
-#define BUFSIZE 256*1024
-
-static __thread char *buf = NULL;
-
-static void direct_read(const char *fname, unsigned long long offset, unsigned long long size)
+/**
+ * Reads or writes all of the io_u, on the fd shared by all workers.
+ * Hitting the end of the file leaves the rest in io_u->resid.
+ */
+static int direct_rw(struct io_u *io_u)
 {
+	int fd = io_u->file->fd;
+	char *buf = io_u->xfer_buf;
+	unsigned long long offset = io_u->offset;
+	unsigned long long left = io_u->xfer_buflen;
 	ssize_t res;
-	int fd = open(fname, O_RDONLY | O_DIRECT);
-	assert(fd > 0);
-
-	if (!buf) {
-		buf = memalign(BLKSIZE, BUFSIZE);
-	}
-
-	// Round down
-	offset = offset & ~(BLKSIZE);
 
-	res = lseek(fd, offset, SEEK_SET);
-	assert(res == offset);
+	while (left > 0) {
+		if (io_u->ddir == DDIR_READ)
+			res = pread(fd, buf, left, offset);
+		else
+			res = pwrite(fd, buf, left, offset);
 
-	while (size > 0) {
-		ssize_t toRead = (size > BUFSIZE) ? BUFSIZE : size;
-		res = read(fd, buf, toRead);
-		if (res != toRead) {
-			printf("ERROR: %zd vs %zd, at %llx\n", res, toRead, offset);
-			perror("");
-			assert(res == toRead);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
 		}
+		if (!res)
+			break;
 
-		size -= toRead;
+		buf += res;
+		offset += res;
+		left -= res;
 	}
 
-	close(fd);
+	io_u->resid = left;
+	return 0;
 }
 
 static void perform_work(void *arg)
@@ -63,26 +78,97 @@ static void perform_work(void *arg)
 	struct gas_io *gas_io = (struct gas_io *) arg;
 
 	struct io_u *io_u = gas_io->io_u;
-
-	direct_read(io_u->file->file_name, io_u->offset, io_u->xfer_buflen);
+	int fd = io_u->file->fd;
+
+	switch (io_u->ddir) {
+	case DDIR_READ:
+	case DDIR_WRITE:
+		io_u->error = direct_rw(io_u);
+		break;
+	case DDIR_SYNC:
+		io_u->error = fsync(fd) ? errno : 0;
+		break;
+	case DDIR_DATASYNC:
+		io_u->error = fdatasync(fd) ? errno : 0;
+		break;
+	default:
+		io_u->error = EINVAL;
+		break;
+	}
 }
 
-static int gas_direct_io_open_file(struct thread_data *td, struct fio_file *f)
+#ifdef ARCH_HAVE_IOURING
+/**
+ * gas_uring: the same requests as perform_work(), as a single SQE each
+ */
+static int direct_prep_sqe(struct gas_io *gas_io, struct io_uring_sqe *sqe)
 {
-	// Nothing to do
+	struct io_u *io_u = gas_io->io_u;
+
+	sqe->fd = io_u->file->fd;
+
+	switch (io_u->ddir) {
+	case DDIR_READ:
+	case DDIR_WRITE:
+		sqe->opcode = io_u->ddir == DDIR_READ ? IORING_OP_READ :
+							IORING_OP_WRITE;
+		sqe->addr = (uintptr_t) io_u->xfer_buf;
+		sqe->len = io_u->xfer_buflen;
+		sqe->off = io_u->offset;
+		break;
+	case DDIR_DATASYNC:
+		sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+		/* fall through */
+	case DDIR_SYNC:
+		sqe->opcode = IORING_OP_FSYNC;
+		break;
+	default:
+		return EINVAL;
+	}
+
 	return 0;
 }
+#endif
 
-static int gas_direct_io_close_file(struct thread_data *td, struct fio_file *f)
+/**
+ * Files are opened once, by fio, and their fd is shared by the workers.
+ * Everything bypasses the page cache, whatever 'direct' says.
+ */
+static int gas_direct_io_open_file(struct thread_data *td, struct fio_file *f)
 {
-	// Nothing to do
+	int flags;
+
+	if (generic_open_file(td, f))
+		return 1;
+
+	flags = fcntl(f->fd, F_GETFL);
+	if (flags < 0 || fcntl(f->fd, F_SETFL, flags | O_DIRECT) < 0) {
+		int fio_unused __ret;
+
+		td_verror(td, errno, "fcntl O_DIRECT");
+		__ret = generic_close_file(td, f);
+		return 1;
+	}
+
 	return 0;
 }
 
 static int gas_direct_io_init_async(struct thread_data *td)
 {
-	gas_init_async(td, perform_work);
-	return 0;
+	struct gas_direct_io_options *o = td->eo;
+	const unsigned int caps = GAS_CAP_READ | GAS_CAP_WRITE | GAS_CAP_SYNC;
+
+#ifdef ARCH_HAVE_IOURING
+	if (o->uring)
+		return gas_init_uring(td, direct_prep_sqe, NULL, caps);
+#else
+	if (o->uring) {
+		log_err("gas-direct-io: gas_uring is not supported on this platform\n");
+		return 1;
+	}
+#endif
+
+	return gas_init_async(td, perform_work, caps);
 }
 
 static struct ioengine_ops gas_direct_io_ioengine = {
@@ -91,10 +177,11 @@ static struct ioengine_ops gas_direct_io_ioengine = {
 	.init               = gas_direct_io_init_async,
 
 	.open_file          = gas_direct_io_open_file,
-	.close_file         = gas_direct_io_close_file,
-	.option_struct_size = sizeof(gas_direct_io_options),
+	.close_file         = generic_close_file,
+	.get_file_size      = generic_get_file_size,
+	.option_struct_size = sizeof(struct gas_direct_io_options),
 	.options            = gas_direct_io_options,
-	.flags              = FIO_DISKLESSIO | FIO_NODISKUTIL | FIO_FAKEIO
+	.flags              = FIO_RAWIO
 };
 
 static void fio_init fio_gas_direct_io_register(void)
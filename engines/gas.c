@@ -10,11 +10,21 @@
 #include <unistd.h>
 #include <errno.h>
 #include <assert.h>
-#include <libaio.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 
 #include "../lib/pow2.h"
+#include "../lib/fls.h"
 #include "../optgroup.h"
 #include "../io_ddir.h"
+#include "../verify.h"
+
+#ifdef ARCH_HAVE_IOURING
+#include <sys/mman.h>
+#include "../os/linux/io_uring.h"
+#endif
 
 /**
  * Allocate a new QOP
@@ -63,53 +73,663 @@ int qop_used(qop *q)
 	return q->used;
 }
 
+static unsigned int roundup_pow2(unsigned int depth)
+{
+	return 1UL << __fls(depth - 1);
+}
+
+/**
+ * Initialize the completion ring to hold at least 'depth' entries
+ */
+static int gas_ring_init(struct gas_ring *r, unsigned int depth)
+{
+	unsigned int i, entries = depth > 1 ? roundup_pow2(depth) : 1;
+
+	r->slots = calloc(entries, sizeof(*r->slots));
+	if (!r->slots)
+		return 1;
+
+	for (i = 0; i < entries; i++)
+		r->slots[i].seq = i;
+
+	r->mask = entries - 1;
+	r->head = 0;
+	r->tail = 0;
+	return 0;
+}
+
+/**
+ * Push a finished request, can be called from any thread.
+ *
+ * There are never more requests in flight than there are slots in the
+ * ring, so the slot we get is either free already, or will be released
+ * by the consumer momentarily.
+ */
+static void gas_ring_push(struct gas_ring *r, struct gas_io *io)
+{
+	unsigned int pos = __sync_fetch_and_add(&r->tail, 1);
+	struct gas_ring_slot *slot = &r->slots[pos & r->mask];
+
+	while (slot->seq != pos)
+		nop;
+
+	slot->io = io;
+	write_barrier();
+	slot->seq = pos + 1;
+}
+
+/**
+ * Pop a finished request, only called from the job thread.
+ * @return NULL if the ring is empty
+ */
+static struct gas_io *gas_ring_pop(struct gas_ring *r)
+{
+	struct gas_ring_slot *slot = &r->slots[r->head & r->mask];
+	struct gas_io *io;
+
+	if (slot->seq != r->head + 1)
+		return NULL;
+
+	read_barrier();
+	io = slot->io;
+	write_barrier();
+	slot->seq = r->head + r->mask + 1;
+	r->head++;
+
+	return io;
+}
+
 /**
- * Options state for GAS
+ * Options state for the GAS test engine
  */
-struct gas_options {
-	void *pad;
+struct gas_engine_options {
+	struct gas_options gas;
+	unsigned int evented;
 };
 
 /**
- * GAS options definitions
+ * GAS test engine options definitions
  */
 static struct fio_option options[] = {
+	GAS_OPTIONS(struct gas_engine_options)
+	{
+		.name	= "gas_evented",
+		.lname	= "GAS test engine uses event loops",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct gas_engine_options, evented),
+		.def	= "0",
+		.help	= "Wait on timers in event loops instead of sleeping in workers",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_GAS,
+	},
 	{
 		.name = NULL,
 	},
 };
 
+#ifdef FIO_HAVE_CPU_AFFINITY
+int gas_cpus_allowed_cb(void *data, const char *input)
+{
+	struct gas_options *o = data;
+	int ret;
+
+	if (parse_dryrun())
+		return 0;
+
+	ret = set_cpus_allowed(o->pad, &o->cpumask, input);
+	if (!ret)
+		o->cpumask_set = 1;
+
+	return ret;
+}
+#endif
+
+#ifdef CONFIG_LIBNUMA
+int gas_numa_nodes_cb(void *data, const char *input)
+{
+	struct bitmask *verify_bitmask;
+
+	if (parse_dryrun())
+		return 0;
+
+	verify_bitmask = numa_parse_nodestring(input);
+	if (verify_bitmask == NULL) {
+		log_err("gas: numa_parse_nodestring failed\n");
+		return 1;
+	}
+	numa_free_nodemask(verify_bitmask);
+
+	return 0;
+}
+#endif
+
 /**
- * Initializes GAS state
+ * Places a new worker thread according to gas_numa_node / gas_cpus_allowed
+ */
+static void gas_worker_init(int id, void *arg)
+{
+	struct gas_options *o = arg;
+
+#ifdef CONFIG_LIBNUMA
+	if (o->numa_nodes) {
+		struct bitmask *mask = numa_parse_nodestring(o->numa_nodes);
+
+		if (numa_run_on_node_mask(mask) == -1)
+			log_err("gas: numa_run_on_node_mask failed: %s\n",
+				strerror(errno));
+		numa_free_nodemask(mask);
+	}
+#endif
+
+#ifdef FIO_HAVE_CPU_AFFINITY
+	if (o->cpumask_set) {
+		os_cpu_mask_t mask = o->cpumask;
+
+		if (o->cpus_allowed_policy == FIO_CPUS_SPLIT &&
+		    !fio_cpus_split(&mask, id)) {
+			log_err("gas: worker %d has no CPU to run on\n", id);
+			return;
+		}
+
+		if (fio_setaffinity(0, mask) == -1)
+			log_err("gas: worker %d setaffinity failed: %s\n", id,
+				strerror(errno));
+	}
+#endif
+}
+
+/**
+ * @return true if the backend can execute requests of this direction
  */
-static int fio_gas_init(struct thread_data *td)
+static bool gas_ddir_supported(struct gas_data *d, enum fio_ddir ddir)
 {
+	switch (ddir) {
+	case DDIR_READ:
+		return d->caps & GAS_CAP_READ;
+	case DDIR_WRITE:
+		return d->caps & GAS_CAP_WRITE;
+	case DDIR_TRIM:
+		return d->caps & GAS_CAP_TRIM;
+	case DDIR_SYNC:
+	case DDIR_DATASYNC:
+		return d->caps & GAS_CAP_SYNC;
+	default:
+		return false;
+	}
+}
+
+/**
+ * Checks the job only issues requests the backend supports
+ */
+static int gas_check_caps(struct thread_data *td, unsigned int caps)
+{
+	struct thread_options *o = &td->o;
+	const char *what = NULL;
+
+	if ((td_read(td) || (td_write(td) && o->verify != VERIFY_NONE)) &&
+	    !(caps & GAS_CAP_READ))
+		what = "reads";
+	else if (td_write(td) && !(caps & GAS_CAP_WRITE))
+		what = "writes";
+	else if (td_trim(td) && !(caps & GAS_CAP_TRIM))
+		what = "trims";
+	else if ((o->fsync_blocks || o->fdatasync_blocks || o->end_fsync) &&
+		 !(caps & GAS_CAP_SYNC))
+		what = "fsync/fdatasync";
+	else if (o->sync_file_range)
+		what = "sync_file_range";
+
+	if (what) {
+		log_err("gas: %s engine does not support %s\n",
+			td->io_ops->name, what);
+		return 1;
+	}
 
+	return 0;
+}
+
+/**
+ * Initializes GAS state
+ */
+static int fio_gas_init(struct thread_data *td, unsigned int caps)
+{
 	struct gas_options *o = td->eo;
 	struct gas_data *d = td->io_ops_data;
 	int res;
 
 	assert(d == NULL);
+
+	if (gas_check_caps(td, caps))
+		return 1;
+
 	d = calloc(1, sizeof(*d));
 
 	d->depth = td->o.iodepth;
+	d->o = o;
+	d->caps = caps;
+	INIT_FLIST_HEAD(&d->inflight);
 
 	d->queued_io_us = qop_new(d->depth);
-	d->done_gas_ios = qop_new(d->depth);
+
+	res = gas_ring_init(&d->done_ring, d->depth);
+	if (res) {
+		log_err("gas: failed to allocate completion ring\n");
+		goto err;
+	}
+
+	d->done_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (d->done_efd < 0) {
+		td_verror(td, errno, "eventfd");
+		goto err;
+	}
 
 	d->last_done_gas_ios = calloc(d->depth, sizeof(struct gas_io *));
 	d->last_done_used = 0;
 
-	res = pthread_mutex_init(&d->done_mutex, NULL);
-	assert(res == 0);
+	td->io_ops_data = d;
 
-	d->thpool = thpool_init(d->depth);
+	return 0;
+err:
+	if (d->done_efd > 0)
+		close(d->done_efd);
+	free(d->done_ring.slots);
+	free(d);
+	return 1;
+}
 
-	td->io_ops_data = d;
+/**
+ * Event loop of evented backends
+ */
+static void *gas_loop_thread(void *arg)
+{
+	struct gas_loop *l = arg;
+	struct epoll_event events[64];
+	int i, nr;
+
+	gas_worker_init(l->id, l->o);
+
+	for (;;) {
+		nr = epoll_wait(l->epfd, events, ARRAY_SIZE(events), -1);
+		if (nr < 0) {
+			if (errno == EINTR)
+				continue;
+			log_err("gas: epoll_wait failed: %s\n", strerror(errno));
+			break;
+		}
+
+		for (i = 0; i < nr; i++) {
+			struct gas_io *io = events[i].data.ptr;
+
+			// Only the stop eventfd has no request attached
+			if (!io)
+				return NULL;
+
+			io->ready(io, events[i].events);
+		}
+	}
+
+	return NULL;
+}
+
+static void gas_loops_stop(struct gas_data *d)
+{
+	int i;
+
+	for (i = 0; i < d->nr_loops; i++) {
+		struct gas_loop *l = &d->loops[i];
+
+		eventfd_write(l->stop_efd, 1);
+		pthread_join(l->thread, NULL);
+		close(l->stop_efd);
+		close(l->epfd);
+	}
+
+	free(d->loops);
+	d->loops = NULL;
+	d->nr_loops = 0;
+}
+
+static int gas_loops_start(struct gas_data *d, int nr_loops)
+{
+	int i;
+
+	d->loops = calloc(nr_loops, sizeof(*d->loops));
+
+	for (i = 0; i < nr_loops; i++) {
+		struct gas_loop *l = &d->loops[i];
+		struct epoll_event ev = {
+			.events		= EPOLLIN,
+			.data.ptr	= NULL,
+		};
+
+		l->id = i;
+		l->o = d->o;
+		l->epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (l->epfd < 0)
+			goto err;
+
+		l->stop_efd = eventfd(0, EFD_CLOEXEC);
+		if (l->stop_efd < 0) {
+			close(l->epfd);
+			goto err;
+		}
+
+		if (epoll_ctl(l->epfd, EPOLL_CTL_ADD, l->stop_efd, &ev) ||
+		    pthread_create(&l->thread, NULL, gas_loop_thread, l)) {
+			close(l->stop_efd);
+			close(l->epfd);
+			goto err;
+		}
+
+		d->nr_loops++;
+	}
+
+	return 0;
+err:
+	log_err("gas: failed to start event loop %d: %s\n", i, strerror(errno));
+	gas_loops_stop(d);
+	return 1;
+}
+
+int gas_wait_fd(struct gas_io *io, int fd, uint32_t events, gas_ready_fn ready)
+{
+	struct epoll_event ev = {
+		.events		= events | EPOLLONESHOT,
+		.data.ptr	= io,
+	};
+	int op, ret;
+
+	io->ready = ready;
+
+	// Re-arm a known fd, otherwise register it. Closed fds are dropped
+	// by epoll, and their number may be reused.
+	op = io->wait_fd == fd ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	ret = epoll_ctl(io->loop->epfd, op, fd, &ev);
+	if (ret && errno == ENOENT)
+		ret = epoll_ctl(io->loop->epfd, EPOLL_CTL_ADD, fd, &ev);
+	else if (ret && errno == EEXIST)
+		ret = epoll_ctl(io->loop->epfd, EPOLL_CTL_MOD, fd, &ev);
+
+	if (ret) {
+		io->wait_fd = -1;
+		return errno;
+	}
+
+	io->wait_fd = fd;
+	return 0;
+}
+
+#ifdef ARCH_HAVE_IOURING
+/**
+ * Per-job io_uring of io_uring backends, only touched by the job thread
+ */
+struct gas_uring {
+	int fd;
+	unsigned int entries;
+
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_array;
+	unsigned int sq_mask;
+	struct io_uring_sqe *sqes;
+
+	/** SQEs filled, but not yet handed to the kernel */
+	unsigned int sq_local_tail;
+	unsigned int to_submit;
+
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+
+	struct {
+		void *ptr;
+		size_t len;
+	} mmap[3];
+};
+
+static void gas_uring_exit(struct gas_uring *u)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(u->mmap); i++)
+		if (u->mmap[i].ptr && u->mmap[i].ptr != MAP_FAILED)
+			munmap(u->mmap[i].ptr, u->mmap[i].len);
+	if (u->fd >= 0)
+		close(u->fd);
+	free(u);
+}
+
+static void *gas_uring_mmap(struct gas_uring *u, int i, size_t len, off_t off)
+{
+	u->mmap[i].len = len;
+	u->mmap[i].ptr = mmap(0, len, PROT_READ | PROT_WRITE,
+			      MAP_SHARED | MAP_POPULATE, u->fd, off);
+	return u->mmap[i].ptr == MAP_FAILED ? NULL : u->mmap[i].ptr;
+}
+
+static struct gas_uring *gas_uring_setup(unsigned int depth)
+{
+	struct io_uring_params p;
+	struct gas_uring *u;
+	void *ptr;
+
+	u = calloc(1, sizeof(*u));
+
+	// Room for a cancel of every request on top of its own SQE
+	memset(&p, 0, sizeof(p));
+	u->fd = syscall(__NR_io_uring_setup, 2 * depth, &p);
+	if (u->fd < 0)
+		goto err;
+
+	u->entries = p.sq_entries;
+
+	ptr = gas_uring_mmap(u, 0, p.sq_off.array + p.sq_entries * sizeof(__u32),
+			     IORING_OFF_SQ_RING);
+	if (!ptr)
+		goto err;
+	u->sq_head = ptr + p.sq_off.head;
+	u->sq_tail = ptr + p.sq_off.tail;
+	u->sq_array = ptr + p.sq_off.array;
+	u->sq_mask = *(unsigned int *) (ptr + p.sq_off.ring_mask);
+	u->sq_local_tail = *u->sq_tail;
+
+	u->sqes = gas_uring_mmap(u, 1, p.sq_entries * sizeof(struct io_uring_sqe),
+				 IORING_OFF_SQES);
+	if (!u->sqes)
+		goto err;
+
+	ptr = gas_uring_mmap(u, 2, p.cq_off.cqes +
+			     p.cq_entries * sizeof(struct io_uring_cqe),
+			     IORING_OFF_CQ_RING);
+	if (!ptr)
+		goto err;
+	u->cq_head = ptr + p.cq_off.head;
+	u->cq_tail = ptr + p.cq_off.tail;
+	u->cq_mask = *(unsigned int *) (ptr + p.cq_off.ring_mask);
+	u->cqes = ptr + p.cq_off.cqes;
+
+	return u;
+err:
+	log_err("gas: failed to set up io_uring: %s\n", strerror(errno));
+	gas_uring_exit(u);
+	return NULL;
+}
+
+static struct io_uring_sqe *gas_uring_get_sqe(struct gas_uring *u)
+{
+	unsigned int index = u->sq_local_tail & u->sq_mask;
+	struct io_uring_sqe *sqe;
+
+	read_barrier();
+	if (u->sq_local_tail - *u->sq_head >= u->entries)
+		return NULL;
+
+	sqe = &u->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	u->sq_array[index] = index;
+	u->sq_local_tail++;
+	u->to_submit++;
+	return sqe;
+}
+
+/**
+ * Hands the filled SQEs to the kernel
+ * @return 0 on success, an errno value otherwise
+ */
+static int gas_uring_flush(struct gas_uring *u)
+{
+	int ret;
+
+	if (!u->to_submit)
+		return 0;
+
+	write_barrier();
+	*u->sq_tail = u->sq_local_tail;
+	write_barrier();
+
+	do {
+		ret = syscall(__NR_io_uring_enter, u->fd, u->to_submit, 0, 0,
+			      NULL, 0);
+		if (ret > 0)
+			u->to_submit -= ret;
+		else if (ret < 0 && errno != EINTR)
+			// EAGAIN and EBUSY: try again after reaping
+			return errno == EAGAIN || errno == EBUSY ? 0 : errno;
+	} while (u->to_submit && ret > 0);
 
 	return 0;
 }
 
+struct io_uring_sqe *gas_uring_sqe(struct gas_io *io)
+{
+	struct io_uring_sqe *sqe = gas_uring_get_sqe(io->gas_data->uring);
+
+	if (sqe)
+		sqe->user_data = (uintptr_t) io;
+	return sqe;
+}
+
+/**
+ * Result of a request made of a single read or write-like SQE
+ */
+static bool gas_uring_default_cqe(struct gas_io *io, int res)
+{
+	struct io_u *io_u = io->io_u;
+
+	if (res < 0)
+		io_u->error = -res;
+	else if (res < io_u->xfer_buflen)
+		io_u->resid = io_u->xfer_buflen - res;
+
+	return true;
+}
+
+/**
+ * Finishes requests whose CQEs arrived, then submits what they queued
+ */
+static void gas_uring_reap(struct gas_data *d)
+{
+	struct gas_uring *u = d->uring;
+	unsigned int head = *u->cq_head;
+	int err;
+
+	for (;;) {
+		struct io_uring_cqe *cqe;
+		struct gas_io *io;
+
+		read_barrier();
+		if (head == *u->cq_tail)
+			break;
+
+		cqe = &u->cqes[head & u->cq_mask];
+		io = (struct gas_io *) (uintptr_t) cqe->user_data;
+		head++;
+
+		// Cancels carry no request
+		if (io && d->cqe(io, cqe->res))
+			gas_complete(io);
+	}
+
+	*u->cq_head = head;
+	write_barrier();
+
+	err = gas_uring_flush(u);
+	if (err)
+		log_err("gas: io_uring submit failed: %s\n", strerror(err));
+}
+
+static void gas_uring_cancel(struct gas_io *io)
+{
+	struct io_uring_sqe *sqe = gas_uring_get_sqe(io->gas_data->uring);
+
+	if (!sqe)
+		return;
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = (uintptr_t) io;
+	gas_uring_flush(io->gas_data->uring);
+}
+
+static void gas_uring_submit(struct gas_data *d, struct gas_io *io)
+{
+	struct io_uring_sqe *sqe;
+	int err;
+
+	sqe = gas_uring_get_sqe(d->uring);
+	if (!sqe) {
+		// Make room by submitting what's there, and reaping CQEs
+		gas_uring_reap(d);
+		sqe = gas_uring_get_sqe(d->uring);
+	}
+
+	if (!sqe)
+		err = EBUSY;
+	else if ((err = d->prep_sqe(io, sqe)) != 0)
+		sqe->opcode = IORING_OP_NOP;	// user_data is 0, ignored
+	else
+		sqe->user_data = (uintptr_t) io;
+
+	if (err) {
+		io->io_u->error = err;
+		gas_complete(io);
+	}
+}
+#endif
+
+/**
+ * Releases GAS state, after all requests have finished
+ */
+static void fio_gas_cleanup(struct thread_data *td)
+{
+	struct gas_data *d = td->io_ops_data;
+
+	if (!d)
+		return;
+
+	// Workers might still be signalling the last completions
+	if (d->thpool) {
+		thpool_wait(d->thpool);
+		thpool_destroy(d->thpool);
+	}
+	gas_loops_stop(d);
+#ifdef ARCH_HAVE_IOURING
+	if (d->uring)
+		gas_uring_exit(d->uring);
+#endif
+
+	close(d->done_efd);
+	free(d->done_ring.slots);
+	free(d->last_done_gas_ios);
+	free(d->queued_io_us->pointers);
+	free(d->queued_io_us);
+	free(d);
+
+	td->io_ops_data = NULL;
+}
+
+static void worker_wrapper(void *arg);
+
 /**
  * Prepares a single io_u - just initialize the gas_io struct
  */
@@ -119,17 +739,20 @@ static int fio_gas_prep(struct thread_data *td, struct io_u *io_u)
 	struct gas_data *d = td->io_ops_data;
 
 	if (!io) {
-		io = malloc(sizeof(*io));
+		io = calloc(1, sizeof(*io));
+		io->wait_fd = -1;
+		io->job.function = worker_wrapper;
+		io->job.arg = io;
+		if (d->nr_loops)
+			io->loop = &d->loops[d->next_loop++ % d->nr_loops];
 		io_u->gas_io = io;
 	}
 
-	memset(io, 0, sizeof(*io));
 	io->io_u = io_u;
 	io->gas_data = d;
-
-	if (io_u->ddir != DDIR_READ) {
-		log_err("gas: ddir not supported: %d\n", io_u->ddir);
-	}
+	io->ready = NULL;
+	io->cancelled = 0;
+	io->timed_out = 0;
 
 	return 0;
 }
@@ -137,7 +760,8 @@ static int fio_gas_prep(struct thread_data *td, struct io_u *io_u)
 /**
  * Queues a single io for execution
  */
-static int fio_gas_queue(struct thread_data *td, struct io_u *io_u)
+static enum fio_q_status fio_gas_queue(struct thread_data *td,
+					  struct io_u *io_u)
 {
 	struct gas_data *d = td->io_ops_data;
 	struct gas_io *gas_io;
@@ -148,12 +772,9 @@ static int fio_gas_queue(struct thread_data *td, struct io_u *io_u)
 		return FIO_Q_BUSY;
 	}
 
-	if (io_u->ddir != DDIR_READ) {
-		log_err("gas: ddir not supported: %d\n", io_u->ddir);
-	}
-
-	if (ddir_sync(io_u->ddir)) {
-		log_err("gas: ddir_sync not supported: %d\n", io_u->ddir);
+	if (!gas_ddir_supported(d, io_u->ddir)) {
+		io_u->error = EINVAL;
+		return FIO_Q_COMPLETED;
 	}
 
 	gas_io = io_u->gas_io;
@@ -173,7 +794,7 @@ static int fio_gas_queue(struct thread_data *td, struct io_u *io_u)
 static void fio_gas_queued(struct thread_data *td, struct io_u **io_us,
 			   unsigned int nr)
 {
-	struct timeval now;
+	struct timespec now;
 	unsigned int i;
 
 	if (!fio_fill_issue_time(td))
@@ -190,20 +811,32 @@ static void fio_gas_queued(struct thread_data *td, struct io_u **io_us,
 }
 
 
+void gas_complete(struct gas_io *gas_io)
+{
+	struct gas_data *d = gas_io->gas_data;
+	int nr_done, wait_nr;
+
+	gas_ring_push(&d->done_ring, gas_io);
+
+	// Only wake up the job thread once it has enough to reap
+	nr_done = __sync_add_and_fetch(&d->nr_done, 1);
+	wait_nr = d->wait_nr;
+	if (wait_nr && nr_done >= wait_nr)
+		eventfd_write(d->done_efd, 1);
+}
+
 static void worker_wrapper(void *arg)
 {
 	struct gas_io *gas_io = (struct gas_io *) arg;
 	struct gas_data *d = gas_io->gas_data;
 
-	int du;
+	// Call the actual worker, unless cancelled while waiting for it
+	if (!gas_io->cancelled)
+		d->worker(arg);
+	else
+		gas_io->io_u->error = ECANCELED;
 
-	// Call the actual worker
-	d->worker(arg);
-
-	pthread_mutex_lock(&d->done_mutex);
-	qop_push(d->done_gas_ios, gas_io);
-	du = d->done_gas_ios->used;
-	pthread_mutex_unlock(&d->done_mutex);
+	gas_complete(gas_io);
 }
 
 static void sleepy_worker(void *arg)
@@ -217,50 +850,206 @@ static void sleepy_worker(void *arg)
 static int fio_gas_commit(struct thread_data *td)
 {
 	struct gas_data *d = td->io_ops_data;
+	struct timespec now = { 0 };
+	int nr_jobs = 0;
 	int ret = 0;
 
+	if (d->o->timeout)
+		fio_gettime(&now, NULL);
+
 	while (qop_used(d->queued_io_us)) {
 		struct io_u *io_u = qop_pop(d->queued_io_us);
 
-		thpool_add_work(d->thpool, worker_wrapper, io_u->gas_io);
-		// perform_work(io_u->gas_io);
-
 		fio_gas_queued(td, &io_u, 1);
 		io_u_mark_submit(td, 1);
+
+		io_u->gas_io->start_time = now;
+		flist_add_tail(&io_u->gas_io->inflight_list, &d->inflight);
+
+		if (d->submit) {
+			int err = d->submit(io_u->gas_io);
+
+			if (err) {
+				io_u->error = err;
+				gas_complete(io_u->gas_io);
+			}
+#ifdef ARCH_HAVE_IOURING
+		} else if (d->uring) {
+			gas_uring_submit(d, io_u->gas_io);
+#endif
+		} else {
+			thpool_add_job(d->thpool, &io_u->gas_io->job);
+			nr_jobs++;
+		}
+	}
+
+	// One wakeup round for the whole batch
+	if (nr_jobs)
+		thpool_wake(d->thpool, nr_jobs);
+
+#ifdef ARCH_HAVE_IOURING
+	if (d->uring) {
+		int err = gas_uring_flush(d->uring);
+
+		if (err) {
+			td_verror(td, err, "io_uring_enter");
+			ret = -err;
+		}
 	}
+#endif
 
 	return ret;
 }
 
 
+/**
+ * Move up to 'max' finished requests to last_done_gas_ios, starting at 'events'
+ * @return the new number of events
+ */
+static unsigned int gas_reap(struct thread_data *td, unsigned int events,
+			     unsigned int max)
+{
+	struct gas_data *d = td->io_ops_data;
+	unsigned int reaped = 0;
+	struct gas_io *io;
+
+	while (events < max && (io = gas_ring_pop(&d->done_ring)) != NULL) {
+		flist_del(&io->inflight_list);
+		if (io->timed_out) {
+			io->io_u->error = ETIMEDOUT;
+			td->ts.nr_timeouts++;
+		}
+
+		d->last_done_gas_ios[events++] = io;
+		reaped++;
+	}
+
+	if (reaped)
+		__sync_sub_and_fetch(&d->nr_done, reaped);
+
+	return events;
+}
+
+/**
+ * Sleep until at least 'nr' requests are finished, or the timeout expires
+ * @param timeout_ms  -1 to wait without a timeout
+ */
+static void gas_wait_done(struct gas_data *d, int nr, int timeout_ms)
+{
+	struct pollfd pfd[2] = {
+		{ .fd = d->done_efd, .events = POLLIN, },
+	};
+	int nfds = 1;
+	eventfd_t val;
+
+#ifdef ARCH_HAVE_IOURING
+	// The ring fd is readable once it has CQEs
+	if (d->uring) {
+		pfd[1].fd = d->uring->fd;
+		pfd[1].events = POLLIN;
+		nfds++;
+	}
+#endif
+
+	d->wait_nr = nr;
+	__sync_synchronize();
+
+	// Workers check wait_nr after bumping nr_done, so one of us sees the other
+	if (d->nr_done < nr)
+		poll(pfd, nfds, timeout_ms);
+
+	d->wait_nr = 0;
+	eventfd_read(d->done_efd, &val);
+}
+
+/**
+ * Asks a request to finish early, it still completes through the ring
+ */
+static void gas_cancel_io(struct gas_data *d, struct gas_io *io)
+{
+	if (io->cancelled)
+		return;
+
+	io->cancelled = 1;
+	if (d->cancel)
+		d->cancel(io);
+}
+
+/**
+ * Cancels requests running longer than gas_timeout
+ * @return msec until the next request would time out, -1 if none
+ */
+static int gas_expire(struct gas_data *d)
+{
+	struct flist_head *entry;
+	struct timespec now;
+
+	if (!d->o->timeout || flist_empty(&d->inflight))
+		return -1;
+
+	fio_gettime(&now, NULL);
+
+	// Oldest first, so stop at the first one still in time
+	flist_for_each(entry, &d->inflight) {
+		struct gas_io *io = flist_entry(entry, struct gas_io, inflight_list);
+		uint64_t usec = utime_since(&io->start_time, &now);
+
+		if (usec < d->o->timeout)
+			return (d->o->timeout - usec + 999) / 1000;
+
+		if (!io->cancelled) {
+			dprint(FD_IO, "gas: io_u %p timed out\n", io->io_u);
+			io->timed_out = 1;
+			gas_cancel_io(d, io);
+		}
+	}
+
+	return -1;
+}
+
 static int fio_gas_getevents(struct thread_data *td, unsigned int min,
 			     unsigned int max, const struct timespec *t)
 {
 	struct gas_data *d = td->io_ops_data;
-	int events = 0;
+	unsigned long long timeout_ms = 0;
+	struct timespec start;
+	unsigned int events = 0;
 
-	assert(0 <= min);
 	assert(min <= max && 0 < max);
 
-	do {
-		int take;
-
-		pthread_mutex_lock(&d->done_mutex);
-		take = d->done_gas_ios->used;
-		if (events + take > max)
-			take = max - events;
-		while (take) {
-			d->last_done_gas_ios[events++] = qop_pop(d->done_gas_ios);
-			take--;
-		}
-		assert(events <= max);
-		d->last_done_used = events;
-		pthread_mutex_unlock(&d->done_mutex);
-		if (events < min) {
-			usleep(10);
+	if (t) {
+		timeout_ms = t->tv_sec * 1000ULL + (t->tv_nsec + 999999) / 1000000;
+		fio_gettime(&start, NULL);
+	}
+
+	for (;;) {
+		int expire_ms, wait_ms = -1;
+
+#ifdef ARCH_HAVE_IOURING
+		if (d->uring)
+			gas_uring_reap(d);
+#endif
+		events = gas_reap(td, events, max);
+		if (events >= min)
+			break;
+
+		if (t) {
+			unsigned long long elapsed = mtime_since_now(&start);
+
+			if (elapsed >= timeout_ms)
+				break;
+			wait_ms = timeout_ms - elapsed;
 		}
-	} while (events < min);
 
+		// Wake up in time to cancel the next request running too long
+		expire_ms = gas_expire(d);
+		if (expire_ms >= 0 && (wait_ms < 0 || expire_ms < wait_ms))
+			wait_ms = expire_ms;
+
+		gas_wait_done(d, min - events, wait_ms);
+	}
+
+	d->last_done_used = events;
 	return events;
 }
 
@@ -277,22 +1066,124 @@ static struct io_u *fio_gas_event(struct thread_data *td, int event)
 	return io_u;
 }
 
-void gas_init_async(struct thread_data *td, void (*worker)(void *))
+int gas_init_async(struct thread_data *td, void (*worker)(void *),
+		   unsigned int caps)
 {
 	struct gas_data *d;
+	int workers;
 
-	fio_gas_init(td);
+	if (fio_gas_init(td, caps))
+		return 1;
 
 	d = td->io_ops_data;
 	d->worker = worker;
+
+	workers = d->o->workers ? d->o->workers : d->depth;
+	dprint(FD_IO, "gas: starting %d workers for depth %d\n", workers,
+	       d->depth);
+
+	d->thpool = thpool_init_cb(workers, gas_worker_init, d->o);
+	if (!d->thpool) {
+		log_err("gas: failed to start worker threads\n");
+		fio_gas_cleanup(td);
+		return 1;
+	}
+
+	return 0;
+}
+
+int gas_init_callback(struct thread_data *td, gas_submit_fn submit,
+		      unsigned int caps)
+{
+	struct gas_data *d;
+
+	if (fio_gas_init(td, caps))
+		return 1;
+
+	d = td->io_ops_data;
+	d->submit = submit;
+
+	return 0;
+}
+
+int gas_init_evented(struct thread_data *td, gas_submit_fn submit,
+		     unsigned int caps)
+{
+	struct gas_data *d;
+
+	if (gas_init_callback(td, submit, caps))
+		return 1;
+
+	d = td->io_ops_data;
+
+	dprint(FD_IO, "gas: starting %d event loops for depth %d\n",
+	       d->o->loops, d->depth);
+
+	if (gas_loops_start(d, d->o->loops)) {
+		fio_gas_cleanup(td);
+		return 1;
+	}
+
+	return 0;
+}
+
+int gas_init_uring(struct thread_data *td, gas_prep_sqe_fn prep,
+		   gas_cqe_fn cqe, unsigned int caps)
+{
+#ifdef ARCH_HAVE_IOURING
+	struct gas_data *d;
+
+	if (fio_gas_init(td, caps))
+		return 1;
+
+	d = td->io_ops_data;
+	d->prep_sqe = prep;
+	d->cqe = cqe ? cqe : gas_uring_default_cqe;
+	d->cancel = gas_uring_cancel;
+
+	dprint(FD_IO, "gas: setting up io_uring for depth %d\n", d->depth);
+
+	d->uring = gas_uring_setup(d->depth);
+	if (!d->uring) {
+		fio_gas_cleanup(td);
+		return 1;
+	}
+
+	return 0;
+#else
+	log_err("gas: io_uring is not supported on this platform\n");
+	return 1;
+#endif
+}
+
+void gas_cleanup_async(struct thread_data *td)
+{
+	fio_gas_cleanup(td);
+}
+
+void gas_io_u_free_async(struct thread_data *td, struct io_u *io_u)
+{
+	free(io_u->gas_io);
+	io_u->gas_io = NULL;
 }
 
+void gas_set_cancel(struct thread_data *td, gas_cancel_fn cancel)
+{
+	struct gas_data *d = td->io_ops_data;
+
+	d->cancel = cancel;
+}
+
+/**
+ * Cancellation is cooperative, so the request is never gone right away.
+ * It completes (with ECANCELED, or normally if it was too late) later.
+ */
 static int gas_cancel(struct thread_data *td, struct io_u *io_u)
 {
-	struct gas_data *ld = td->io_ops_data;
+	struct gas_data *d = td->io_ops_data;
 
-	printf("Received cancel\n");
-	fflush(stdout);
+	if (io_u->gas_io)
+		gas_cancel_io(d, io_u->gas_io);
 
 	return -1;
 }
@@ -307,15 +1198,102 @@ void gas_register_async(struct ioengine_ops *ops)
 	ops->getevents = fio_gas_getevents;
 	ops->event = fio_gas_event;
 	ops->cancel = gas_cancel;
+	if (!ops->cleanup)
+		ops->cleanup = fio_gas_cleanup;
+	if (!ops->io_u_free)
+		ops->io_u_free = gas_io_u_free_async;
 
 	register_ioengine(ops);
 }
 
 
+/** Per io_u state of the evented test engine */
+struct sleepy_data {
+	int timer_fd;
+};
+
+static void sleepy_ready(struct gas_io *io, uint32_t events)
+{
+	struct sleepy_data *sd = io->backend_data;
+	uint64_t expirations;
+
+	if (read(sd->timer_fd, &expirations, sizeof(expirations)) < 0)
+		io->io_u->error = errno;
+	else if (gas_io_cancelled(io))
+		io->io_u->error = ECANCELED;
+
+	gas_complete(io);
+}
+
+/**
+ * Fires the timer right away, sleepy_ready() then finishes the request
+ */
+static void sleepy_cancel(struct gas_io *io)
+{
+	struct itimerspec its = {
+		.it_value.tv_nsec = 1,
+	};
+	struct sleepy_data *sd = io->backend_data;
+
+	timerfd_settime(sd->timer_fd, 0, &its, NULL);
+}
+
+/**
+ * Evented version of sleepy_worker, waiting on a timerfd kept per io_u
+ */
+static int sleepy_submit(struct gas_io *io)
+{
+	struct itimerspec its = {
+		.it_value.tv_nsec = 100000,
+	};
+	struct sleepy_data *sd = io->backend_data;
+
+	if (!sd) {
+		int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+		if (fd < 0)
+			return errno;
+		sd = malloc(sizeof(*sd));
+		sd->timer_fd = fd;
+		io->backend_data = sd;
+	}
+
+	if (timerfd_settime(sd->timer_fd, 0, &its, NULL))
+		return errno;
+
+	return gas_wait_fd(io, sd->timer_fd, EPOLLIN, sleepy_ready);
+}
+
 static int gas_init(struct thread_data *td)
 {
-	gas_init_async(td, sleepy_worker);
-	return 0;
+	struct gas_engine_options *o = td->eo;
+
+	// Sleeping works the same for any kind of request
+	const unsigned int caps = GAS_CAP_READ | GAS_CAP_WRITE | GAS_CAP_TRIM |
+				  GAS_CAP_SYNC;
+
+	if (o->evented) {
+		if (gas_init_evented(td, sleepy_submit, caps))
+			return 1;
+		gas_set_cancel(td, sleepy_cancel);
+		return 0;
+	}
+
+	return gas_init_async(td, sleepy_worker, caps);
+}
+
+static void gas_io_u_free(struct thread_data *td, struct io_u *io_u)
+{
+	struct gas_io *io = io_u->gas_io;
+	struct sleepy_data *sd = io ? io->backend_data : NULL;
+
+	if (sd) {
+		close(sd->timer_fd);
+		free(sd);
+		io->backend_data = NULL;
+	}
+
+	gas_io_u_free_async(td, io_u);
 }
 
 static struct ioengine_ops gas_ioengine = {
@@ -323,12 +1301,13 @@ static struct ioengine_ops gas_ioengine = {
 	.version            = FIO_IOOPS_VERSION,
 
 	.init               = gas_init,
+	.io_u_free          = gas_io_u_free,
 
 	.open_file          = generic_open_file,
 	.close_file         = generic_close_file,
 	.get_file_size      = generic_get_file_size,
 	.cancel             = gas_cancel,
-	.option_struct_size = sizeof(struct gas_options),
+	.option_struct_size = sizeof(struct gas_engine_options),
 	.options            = options,
 };
 
@@ -7,6 +7,7 @@
 #include <pthread.h>
 
 #include "../fio.h"
+#include "../optgroup.h"
 
 // From https://github.com/Pithikos/C-Thread-Pool
 #include "thpool.h"
@@ -21,35 +22,376 @@ typedef struct {
 	int head;
 } qop;
 
+/**
+ * Options shared by all GAS engines.
+ * Must be the first member of the engine's option struct.
+ */
+struct gas_options {
+	void *pad;  // thread_data, set by fio
+	unsigned int workers;
+	unsigned int loops;
+	unsigned long long timeout;
+	unsigned int cpumask_set;
+	os_cpu_mask_t cpumask;
+	unsigned int cpus_allowed_policy;
+	char *numa_nodes;
+};
+
+int gas_cpus_allowed_cb(void *data, const char *input);
+int gas_numa_nodes_cb(void *data, const char *input);
+
+#ifdef FIO_HAVE_CPU_AFFINITY
+#define GAS_CPU_OPTIONS(opt_struct)					\
+	{								\
+		.name	= "gas_cpus_allowed",				\
+		.lname	= "GAS worker CPUs allowed",			\
+		.type	= FIO_OPT_STR,					\
+		.cb	= gas_cpus_allowed_cb,				\
+		.off1	= offsetof(opt_struct, gas.cpumask),		\
+		.help	= "Set CPUs allowed for GAS worker threads",	\
+		.category = FIO_OPT_C_ENGINE,				\
+		.group	= FIO_OPT_G_GAS,				\
+	},								\
+	{								\
+		.name	= "gas_cpus_allowed_policy",			\
+		.lname	= "GAS worker CPUs allowed distribution policy", \
+		.type	= FIO_OPT_STR,					\
+		.off1	= offsetof(opt_struct, gas.cpus_allowed_policy), \
+		.help	= "Distribution policy for gas_cpus_allowed",	\
+		.parent	= "gas_cpus_allowed",				\
+		.prio	= 1,						\
+		.posval = {						\
+			  { .ival = "shared",				\
+			    .oval = FIO_CPUS_SHARED,			\
+			    .help = "Mask shared between workers",	\
+			  },						\
+			  { .ival = "split",				\
+			    .oval = FIO_CPUS_SPLIT,			\
+			    .help = "Mask split between workers",	\
+			  },						\
+		},							\
+		.category = FIO_OPT_C_ENGINE,				\
+		.group	= FIO_OPT_G_GAS,				\
+	},
+#else
+#define GAS_CPU_OPTIONS(opt_struct)					\
+	{								\
+		.name	= "gas_cpus_allowed",				\
+		.lname	= "GAS worker CPUs allowed",			\
+		.type	= FIO_OPT_UNSUPPORTED,				\
+		.help	= "Your platform does not support CPU affinities", \
+	},								\
+	{								\
+		.name	= "gas_cpus_allowed_policy",			\
+		.lname	= "GAS worker CPUs allowed distribution policy", \
+		.type	= FIO_OPT_UNSUPPORTED,				\
+		.help	= "Your platform does not support CPU affinities", \
+	},
+#endif
+
+#ifdef CONFIG_LIBNUMA
+#define GAS_NUMA_OPTIONS(opt_struct)					\
+	{								\
+		.name	= "gas_numa_node",				\
+		.lname	= "GAS worker NUMA nodes",			\
+		.type	= FIO_OPT_STR_STORE,				\
+		.cb	= gas_numa_nodes_cb,				\
+		.off1	= offsetof(opt_struct, gas.numa_nodes),		\
+		.help	= "NUMA nodes to run GAS worker threads on",	\
+		.category = FIO_OPT_C_ENGINE,				\
+		.group	= FIO_OPT_G_GAS,				\
+	},
+#else
+#define GAS_NUMA_OPTIONS(opt_struct)					\
+	{								\
+		.name	= "gas_numa_node",				\
+		.lname	= "GAS worker NUMA nodes",			\
+		.type	= FIO_OPT_UNSUPPORTED,				\
+		.help	= "Build fio with libnuma-dev(el) to enable this option", \
+	},
+#endif
+
+/**
+ * Option definitions of struct gas_options, to be included in the options
+ * array of every GAS engine. 'opt_struct' is the engine's option struct,
+ * with struct gas_options as a member named 'gas'.
+ */
+#define GAS_OPTIONS(opt_struct)						\
+	{								\
+		.name	= "gas_workers",				\
+		.lname	= "GAS worker threads",				\
+		.type	= FIO_OPT_INT,					\
+		.off1	= offsetof(opt_struct, gas.workers),		\
+		.def	= "0",						\
+		.help	= "Number of worker threads (0 means iodepth)",	\
+		.category = FIO_OPT_C_ENGINE,				\
+		.group	= FIO_OPT_G_GAS,				\
+	},								\
+	{								\
+		.name	= "gas_timeout",				\
+		.lname	= "GAS request timeout",			\
+		.type	= FIO_OPT_STR_VAL_TIME,				\
+		.off1	= offsetof(opt_struct, gas.timeout),		\
+		.is_time = 1,						\
+		.def	= "0",						\
+		.help	= "Cancel requests running longer than this (usec)", \
+		.category = FIO_OPT_C_ENGINE,				\
+		.group	= FIO_OPT_G_GAS,				\
+	},								\
+	{								\
+		.name	= "gas_loops",					\
+		.lname	= "GAS event loop threads",			\
+		.type	= FIO_OPT_INT,					\
+		.off1	= offsetof(opt_struct, gas.loops),		\
+		.def	= "1",						\
+		.minval	= 1,						\
+		.help	= "Number of event loop threads for evented engines", \
+		.category = FIO_OPT_C_ENGINE,				\
+		.group	= FIO_OPT_G_GAS,				\
+	},								\
+	GAS_CPU_OPTIONS(opt_struct)					\
+	GAS_NUMA_OPTIONS(opt_struct)
+
+/**
+ * A single slot of the completion ring
+ */
+struct gas_ring_slot {
+	volatile unsigned int seq;
+	struct gas_io *io;
+};
+
+/**
+ * Bounded multi-producer / single-consumer ring of finished requests.
+ * Workers push from any thread, only the job thread pops.
+ */
+struct gas_ring {
+	unsigned int mask;
+	unsigned int head;
+	unsigned int tail;
+	struct gas_ring_slot *slots;
+};
+
+struct gas_io;
+
+/**
+ * Request types a backend supports, passed to gas_init_*().
+ * Jobs issuing anything else are rejected at init.
+ */
+enum {
+	GAS_CAP_READ	= 1 << 0,
+	GAS_CAP_WRITE	= 1 << 1,
+	GAS_CAP_TRIM	= 1 << 2,
+	GAS_CAP_SYNC	= 1 << 3,	// DDIR_SYNC and DDIR_DATASYNC
+};
+
+/**
+ * Starts a request of an evented backend, on the job thread.
+ * Must not block, the request is finished with gas_complete().
+ * @return 0 if the request was started, an errno value otherwise
+ */
+typedef int (*gas_submit_fn)(struct gas_io *io);
+
+/**
+ * Continues a request of an evented backend, on an event loop thread,
+ * once the fd given to gas_wait_fd() is ready.
+ * @param events  the ready epoll events
+ */
+typedef void (*gas_ready_fn)(struct gas_io *io, uint32_t events);
+
+/**
+ * Asks the backend to abort a running request, on the job thread.
+ * Must not block. The backend still finishes the request with its
+ * usual completion, as soon as it can.
+ */
+typedef void (*gas_cancel_fn)(struct gas_io *io);
+
+struct io_uring_sqe;
+
+/**
+ * Fills the SQE of a request of an io_uring backend, on the job thread.
+ * GAS owns sqe->user_data.
+ * @return 0 if the SQE is ready, an errno value otherwise
+ */
+typedef int (*gas_prep_sqe_fn)(struct gas_io *io, struct io_uring_sqe *sqe);
+
+/**
+ * Handles a CQE of a request of an io_uring backend, on the job thread.
+ * @param res  cqe->res
+ * @return true if the request is finished, with io->io_u->error and
+ *         io->io_u->resid set, false if it goes on with gas_uring_sqe()
+ */
+typedef bool (*gas_cqe_fn)(struct gas_io *io, int res);
+
+struct gas_uring;
+
+/**
+ * An event loop thread, driving requests of evented backends
+ */
+struct gas_loop {
+	int id;
+	int epfd;
+	int stop_efd;
+	pthread_t thread;
+	struct gas_options *o;
+};
+
 /**
  * The global state of GAS
  */
 struct gas_data {
 	int depth;
 
+	/** GAS_CAP_* of the backend */
+	unsigned int caps;
+
+	struct gas_options *o;
+
 	/** io_us ready to be committed */
 	qop *queued_io_us;
 
 	/** Entries that are finished */
-	qop *done_gas_ios;
+	struct gas_ring done_ring;
+
+	/** Number of entries pushed to done_ring, but not yet reaped */
+	int nr_done;
+
+	/** Number of completions the job thread is sleeping for, 0 if awake */
+	int wait_nr;
+
+	/** Used to wake up the job thread in getevents */
+	int done_efd;
 
 	struct gas_io **last_done_gas_ios;
 	unsigned int last_done_used;
 
-	pthread_mutex_t done_mutex;
-
 	threadpool thpool;
 
 	void (*worker)(void *);
+
+	/** Evented backends: submit callback and the loops driving it */
+	gas_submit_fn submit;
+	struct gas_loop *loops;
+	int nr_loops;
+	unsigned int next_loop;
+
+	/** io_uring backends: the job's ring and the backend callbacks */
+	struct gas_uring *uring;
+	gas_prep_sqe_fn prep_sqe;
+	gas_cqe_fn cqe;
+
+	/** Optional backend hook for cancelled and timed out requests */
+	gas_cancel_fn cancel;
+
+	/** Submitted, not yet reaped requests, oldest first */
+	struct flist_head inflight;
+
+	/** Owned by the backend, job wide state */
+	void *backend_data;
 };
 
 /** A single in-flight GAS request */
 struct gas_io {
 	struct io_u *io_u;
 	struct gas_data *gas_data;
+
+	/** Owned by the backend, kept across requests of the same io_u */
 	void *backend_data;
+
+	/** On gas_data->inflight while submitted */
+	struct flist_head inflight_list;
+	struct timespec start_time;
+
+	/** Set when the request should be given up, see gas_io_cancelled() */
+	volatile int cancelled;
+	int timed_out;
+
+	/** Thread pool backends: the job running the worker */
+	struct thpool_job job;
+
+	/** Evented backends: the loop waiting for wait_fd, and what to call */
+	struct gas_loop *loop;
+	int wait_fd;
+	gas_ready_fn ready;
 };
 
-void gas_init_async(struct thread_data *td, void (*perform_work)(void *));
+/**
+ * Initializes GAS for a backend with a blocking worker, executed on
+ * the worker threads for every request. The worker handles every
+ * io_u->ddir it advertises in 'caps'.
+ */
+int gas_init_async(struct thread_data *td, void (*perform_work)(void *),
+		   unsigned int caps);
+
+/**
+ * Initializes GAS for an evented backend. Requests are started with
+ * 'submit' and continued by callbacks on gas_loops event loop threads,
+ * so a few threads can drive any number of requests in flight.
+ */
+int gas_init_evented(struct thread_data *td, gas_submit_fn submit,
+		     unsigned int caps);
+
+/**
+ * Initializes GAS for a backend that runs requests on its own threads.
+ * Requests are started with 'submit', and the backend calls gas_complete()
+ * for them. No GAS threads are started.
+ */
+int gas_init_callback(struct thread_data *td, gas_submit_fn submit,
+		      unsigned int caps);
+
+/**
+ * Initializes GAS for an io_uring backend. Requests are started as SQEs
+ * filled by 'prep' on a per-job ring, and finished by their CQEs, without
+ * any GAS threads. 'cqe' can be NULL if a request is always a single read
+ * or write-like SQE, its result is then mapped to io_u->error and resid.
+ * Cancelled and timed out requests get an IORING_OP_ASYNC_CANCEL.
+ */
+int gas_init_uring(struct thread_data *td, gas_prep_sqe_fn prep, gas_cqe_fn cqe,
+		   unsigned int caps);
+
+/**
+ * Gets the next SQE of a request of an io_uring backend, to be called from
+ * its gas_cqe_fn. The SQE is submitted before the job thread waits again.
+ * @return NULL if the ring is full
+ */
+struct io_uring_sqe *gas_uring_sqe(struct gas_io *io);
+
+/**
+ * Waits (once) for 'events' on 'fd', then calls 'ready' on the event loop
+ * of the request. Can be called from submit or from a ready callback.
+ * @return 0 on success, an errno value otherwise
+ */
+int gas_wait_fd(struct gas_io *io, int fd, uint32_t events, gas_ready_fn ready);
+
+/**
+ * Marks a request as finished, can be called from any thread.
+ * Set io->io_u->error before calling this if the request failed.
+ */
+void gas_complete(struct gas_io *io);
+
+/**
+ * Registers a hook to abort running requests, see gas_cancel_fn.
+ * Call after gas_init_*().
+ */
+void gas_set_cancel(struct thread_data *td, gas_cancel_fn cancel);
+
+/**
+ * @return true if the request was cancelled or timed out.
+ * Long running backends should check this and give up early.
+ */
+static inline bool gas_io_cancelled(struct gas_io *io)
+{
+	return io->cancelled;
+}
+
+/**
+ * Releases GAS state, for engines having their own cleanup hook
+ */
+void gas_cleanup_async(struct thread_data *td);
+
+/**
+ * Releases the gas_io of an io_u, for engines having their own io_u_free
+ * hook to release backend_data
+ */
+void gas_io_u_free_async(struct thread_data *td, struct io_u *io_u);
 
 void gas_register_async(struct ioengine_ops *ops);
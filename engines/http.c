@@ -1,7 +1,8 @@
 /*
  * HTTP GET/PUT IO engine
  *
- * IO engine to perform HTTP(S) GET/PUT requests via libcurl-easy.
+ * IO engine to perform HTTP(S) GET/PUT requests via libcurl-easy, or
+ * with http_async, many requests in flight via libcurl-multi.
  *
  * Copyright (C) 2018 SUSE LLC
  *
@@ -21,6 +22,7 @@
  */
 
 #include <pthread.h>
+#include <stdarg.h>
 #include <time.h>
 #include <curl/curl.h>
 #include <openssl/hmac.h>
@@ -40,8 +42,42 @@ enum {
 	FIO_HTTPS_INSECURE  = 2,
 };
 
+/*
+ * Request headers, built in place so that setting up a request needs no
+ * allocations. curl only reads the list while the request runs.
+ */
+#define HTTP_MAX_HEADERS	8
+#define HTTP_HEADER_SPACE	1024
+
+struct http_headers {
+	struct curl_slist list[HTTP_MAX_HEADERS];
+	char buf[HTTP_HEADER_SPACE];
+	unsigned int nr;
+	size_t used;
+};
+
+/* SigV4 state of a job, requests are signed in the job thread only */
+struct http_sign {
+	HMAC_CTX *ctx;
+#ifndef CONFIG_HAVE_OPAQUE_HMAC_CTX
+	HMAC_CTX _ctx;
+#endif
+	time_t now;
+	char date_short[16];
+	char date_iso[32];
+	char key_date[16];
+	unsigned char key[SHA256_DIGEST_LENGTH];
+};
+
 struct http_data {
 	CURL *curl;
+	struct http_headers headers;
+	struct http_sign sign;
+
+	/* http_async: one multi handle sharing its connections */
+	CURLM *multi;
+	struct io_u **events;
+	unsigned int nr_events;
 };
 
 struct http_options {
@@ -56,6 +92,8 @@ struct http_options {
 	char *swift_auth_token;
 	int verbose;
 	unsigned int mode;
+	unsigned int async;
+	unsigned int max_connections;
 };
 
 struct http_curl_stream {
@@ -64,6 +102,13 @@ struct http_curl_stream {
 	size_t max;
 };
 
+/* http_async: per io_u request state, with its own easy handle */
+struct http_io {
+	CURL *curl;
+	struct http_headers headers;
+	struct http_curl_stream stream;
+};
+
 static struct fio_option options[] = {
 	{
 		.name     = "https",
@@ -191,29 +236,42 @@ static struct fio_option options[] = {
 		.category = FIO_OPT_C_ENGINE,
 		.group    = FIO_OPT_G_HTTP,
 	},
+	{
+		.name     = "http_async",
+		.lname    = "HTTP async requests",
+		.type     = FIO_OPT_BOOL,
+		.help     = "Keep up to iodepth requests in flight with libcurl-multi",
+		.off1     = offsetof(struct http_options, async),
+		.def	  = "0",
+		.category = FIO_OPT_C_ENGINE,
+		.group    = FIO_OPT_G_HTTP,
+	},
+	{
+		.name     = "http_max_connections",
+		.lname    = "HTTP max connections",
+		.type     = FIO_OPT_INT,
+		.help     = "Size of the http_async connection pool (0 = iodepth)",
+		.off1     = offsetof(struct http_options, max_connections),
+		.def	  = "0",
+		.category = FIO_OPT_C_ENGINE,
+		.group    = FIO_OPT_G_HTTP,
+	},
 	{
 		.name     = NULL,
 	},
 };
 
-static char *_aws_uriencode(const char *uri)
+static int _aws_uriencode(const char *uri, char *r, size_t bufsize)
 {
-	size_t bufsize = 1024;
-	char *r = malloc(bufsize);
 	char c;
 	int i, n;
 	const char *hex = "0123456789ABCDEF";
 
-	if (!r) {
-		log_err("malloc failed\n");
-		return NULL;
-	}
-
 	n = 0;
 	for (i = 0; (c = uri[i]); i++) {
 		if (n > bufsize-5) {
 			log_err("encoding the URL failed\n");
-			return NULL;
+			return -1;
 		}
 
 		if ( (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z')
@@ -227,63 +285,105 @@ static char *_aws_uriencode(const char *uri)
 		}
 	}
 	r[n++] = 0;
-	return r;
+	return 0;
 }
 
-static char *_conv_hex(const unsigned char *p, size_t len)
+/* r must hold len * 2 + 1 bytes */
+static void _conv_hex(const unsigned char *p, size_t len, char *r)
 {
-	char *r;
 	int i,n;
 	const char *hex = "0123456789abcdef";
-	r = malloc(len * 2 + 1);
 	n = 0;
 	for (i = 0; i < len; i++) {
 		r[n++] = hex[(p[i] >> 4 ) & 0xF];
 		r[n++] = hex[p[i] & 0xF];
 	}
 	r[n] = 0;
-
-	return r;
 }
 
-static char *_gen_hex_sha256(const char *p, size_t len)
+static void _gen_hex_sha256(const char *p, size_t len, char *r)
 {
 	unsigned char hash[SHA256_DIGEST_LENGTH];
 
 	SHA256((unsigned char*)p, len, hash);
-	return _conv_hex(hash, SHA256_DIGEST_LENGTH);
+	_conv_hex(hash, SHA256_DIGEST_LENGTH, r);
 }
 
-static char *_gen_hex_md5(const char *p, size_t len)
+static void _gen_hex_md5(const char *p, size_t len, char *r)
 {
 	unsigned char hash[MD5_DIGEST_LENGTH];
 
 	MD5((unsigned char*)p, len, hash);
-	return _conv_hex(hash, MD5_DIGEST_LENGTH);
+	_conv_hex(hash, MD5_DIGEST_LENGTH, r);
 }
 
-static void _hmac(unsigned char *md, void *key, int key_len, char *data) {
-#ifndef CONFIG_HAVE_OPAQUE_HMAC_CTX
-	HMAC_CTX _ctx;
-#endif
-	HMAC_CTX *ctx;
-	unsigned int hmac_len;
-
+static int _hmac_init(struct http_sign *sign)
+{
 #ifdef CONFIG_HAVE_OPAQUE_HMAC_CTX
-	ctx = HMAC_CTX_new();
+	sign->ctx = HMAC_CTX_new();
+	if (!sign->ctx)
+		return 1;
 #else
-	ctx = &_ctx;
+	sign->ctx = &sign->_ctx;
 	/* work-around crash in certain versions of libssl */
-	HMAC_CTX_init(ctx);
+	HMAC_CTX_init(sign->ctx);
 #endif
-	HMAC_Init_ex(ctx, key, key_len, EVP_sha256(), NULL);
-	HMAC_Update(ctx, (unsigned char*)data, strlen(data));
-	HMAC_Final(ctx, md, &hmac_len);
+	return 0;
+}
+
+static void _hmac_exit(struct http_sign *sign)
+{
+	if (!sign->ctx)
+		return;
 #ifdef CONFIG_HAVE_OPAQUE_HMAC_CTX
-	HMAC_CTX_free(ctx);
+	HMAC_CTX_free(sign->ctx);
 #else
-	HMAC_CTX_cleanup(ctx);
+	HMAC_CTX_cleanup(sign->ctx);
 #endif
+	sign->ctx = NULL;
+}
+
+static void _hmac(struct http_sign *sign, unsigned char *md, void *key,
+		  int key_len, const char *data)
+{
+	unsigned int hmac_len;
+
+	HMAC_Init_ex(sign->ctx, key, key_len, EVP_sha256(), NULL);
+	HMAC_Update(sign->ctx, (unsigned char*)data, strlen(data));
+	HMAC_Final(sign->ctx, md, &hmac_len);
+}
+
+/*
+ * Append a header to the list built in h. Returns the list, which stays
+ * valid until h is reset for the next request.
+ */
+static struct curl_slist *_hdr_add(struct http_headers *h, const char *fmt, ...)
+{
+	size_t space = sizeof(h->buf) - h->used;
+	char *s = &h->buf[h->used];
+	va_list args;
+	int len;
+
+	if (h->nr == HTTP_MAX_HEADERS) {
+		log_err("http: too many request headers\n");
+		return h->nr ? h->list : NULL;
+	}
+
+	va_start(args, fmt);
+	len = vsnprintf(s, space, fmt, args);
+	va_end(args);
+	if (len < 0 || len >= space) {
+		log_err("http: request headers too long\n");
+		return h->nr ? h->list : NULL;
+	}
+
+	h->list[h->nr].data = s;
+	h->list[h->nr].next = NULL;
+	if (h->nr)
+		h->list[h->nr - 1].next = &h->list[h->nr];
+	h->nr++;
+	h->used += len + 1;
+	return h->list;
 }
 
 static int _curl_trace(CURL *handle, curl_infotype type,
@@ -322,36 +422,65 @@ static int _curl_trace(CURL *handle, curl_infotype type,
 	return 0;
 }
 
+/* SHA256 of an empty body, as sent for GET and DELETE */
+static const char *empty_sha256 =
+	"e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855";
+
+/*
+ * The SigV4 signing key depends on the secret, the day, the region and the
+ * service only, so derive it once per day instead of per request.
+ */
+static const unsigned char *_aws_signing_key(struct http_sign *sign,
+					     struct http_options *o,
+					     const char *service)
+{
+	char dkey[128];
+
+	if (!strcmp(sign->key_date, sign->date_short))
+		return sign->key;
+
+	snprintf(dkey, sizeof(dkey), "AWS4%s", o->s3_key);
+	_hmac(sign, sign->key, dkey, strlen(dkey), sign->date_short);
+	_hmac(sign, sign->key, sign->key, SHA256_DIGEST_LENGTH, o->s3_region);
+	_hmac(sign, sign->key, sign->key, SHA256_DIGEST_LENGTH, service);
+	_hmac(sign, sign->key, sign->key, SHA256_DIGEST_LENGTH, "aws4_request");
+	strcpy(sign->key_date, sign->date_short);
+
+	return sign->key;
+}
+
 /* https://docs.aws.amazon.com/AmazonS3/latest/API/sig-v4-header-based-auth.html
  * https://docs.aws.amazon.com/AmazonS3/latest/API/sig-v4-authenticating-requests.html#signing-request-intro
  */
-static void _add_aws_auth_header(CURL *curl, struct curl_slist *slist, struct http_options *o,
+static void _add_aws_auth_header(CURL *curl, struct http_sign *sign,
+		struct http_headers *h, struct http_options *o,
 		int op, const char *uri, char *buf, size_t len)
 {
-	char date_short[16];
-	char date_iso[32];
 	char method[8];
-	char dkey[128];
+	char uri_encoded[1024];
+	char dsha[SHA256_DIGEST_LENGTH * 2 + 1];
+	char csha[SHA256_DIGEST_LENGTH * 2 + 1];
+	char signature[SHA256_DIGEST_LENGTH * 2 + 1];
 	char creq[512];
 	char sts[256];
-	char s[512];
-	char *uri_encoded = NULL;
-	char *dsha = NULL;
-	char *csha = NULL;
-	char *signature = NULL;
 	const char *service = "s3";
 	const char *aws = "aws4_request";
 	unsigned char md[SHA256_DIGEST_LENGTH];
-
+	struct curl_slist *slist;
+	struct tm gtm;
 	time_t t = time(NULL);
-	struct tm *gtm = gmtime(&t);
 
-	strftime (date_short, sizeof(date_short), "%Y%m%d", gtm);
-	strftime (date_iso, sizeof(date_iso), "%Y%m%dT%H%M%SZ", gtm);
-	uri_encoded = _aws_uriencode(uri);
+	if (t != sign->now) {
+		gmtime_r(&t, &gtm);
+		strftime(sign->date_short, sizeof(sign->date_short), "%Y%m%d", &gtm);
+		strftime(sign->date_iso, sizeof(sign->date_iso), "%Y%m%dT%H%M%SZ", &gtm);
+		sign->now = t;
+	}
+	if (_aws_uriencode(uri, uri_encoded, sizeof(uri_encoded)))
+		uri_encoded[0] = '\0';
 
 	if (op == DDIR_WRITE) {
-		dsha = _gen_hex_sha256(buf, len);
+		_gen_hex_sha256(buf, len, dsha);
 		sprintf(method, "PUT");
 	} else {
 		/* DDIR_READ && DDIR_TRIM supply an empty body */
@@ -359,7 +488,7 @@ static void _add_aws_auth_header(CURL *curl, struct curl_slist *slist, struct ht
 			sprintf(method, "GET");
 		else
 			sprintf(method, "DELETE");
-		dsha = _gen_hex_sha256("", 0);
+		strcpy(dsha, empty_sha256);
 	}
 
 	/* Create the canonical request first */
@@ -374,64 +503,45 @@ static void _add_aws_auth_header(CURL *curl, struct curl_slist *slist, struct ht
 	"host;x-amz-content-sha256;x-amz-date\n"
 	"%s"
 	, method
-	, uri_encoded, o->host, dsha, date_iso, dsha);
+	, uri_encoded, o->host, dsha, sign->date_iso, dsha);
 
-	csha = _gen_hex_sha256(creq, strlen(creq));
+	_gen_hex_sha256(creq, strlen(creq), csha);
 	snprintf(sts, sizeof(sts), "AWS4-HMAC-SHA256\n%s\n%s/%s/%s/%s\n%s",
-		date_iso, date_short, o->s3_region, service, aws, csha);
+		sign->date_iso, sign->date_short, o->s3_region, service, aws, csha);
 
-	snprintf((char *)dkey, sizeof(dkey), "AWS4%s", o->s3_key);
-	_hmac(md, dkey, strlen(dkey), date_short);
-	_hmac(md, md, SHA256_DIGEST_LENGTH, o->s3_region);
-	_hmac(md, md, SHA256_DIGEST_LENGTH, (char*) service);
-	_hmac(md, md, SHA256_DIGEST_LENGTH, (char*) aws);
-	_hmac(md, md, SHA256_DIGEST_LENGTH, sts);
-
-	signature = _conv_hex(md, SHA256_DIGEST_LENGTH);
+	_hmac(sign, md, (void *) _aws_signing_key(sign, o, service),
+		SHA256_DIGEST_LENGTH, sts);
+	_conv_hex(md, SHA256_DIGEST_LENGTH, signature);
 
 	/* Surpress automatic Accept: header */
-	slist = curl_slist_append(slist, "Accept:");
-
-	snprintf(s, sizeof(s), "x-amz-content-sha256: %s", dsha);
-	slist = curl_slist_append(slist, s);
-
-	snprintf(s, sizeof(s), "x-amz-date: %s", date_iso);
-	slist = curl_slist_append(slist, s);
-
-	snprintf(s, sizeof(s), "Authorization: AWS4-HMAC-SHA256 Credential=%s/%s/%s/s3/aws4_request,"
+	slist = _hdr_add(h, "Accept:");
+	slist = _hdr_add(h, "x-amz-content-sha256: %s", dsha);
+	slist = _hdr_add(h, "x-amz-date: %s", sign->date_iso);
+	slist = _hdr_add(h, "Authorization: AWS4-HMAC-SHA256 Credential=%s/%s/%s/s3/aws4_request,"
 	"SignedHeaders=host;x-amz-content-sha256;x-amz-date,Signature=%s",
-	o->s3_keyid, date_short, o->s3_region, signature);
-	slist = curl_slist_append(slist, s);
+	o->s3_keyid, sign->date_short, o->s3_region, signature);
 
 	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, slist);
-
-	free(uri_encoded);
-	free(csha);
-	free(dsha);
-	free(signature);
 }
 
-static void _add_swift_header(CURL *curl, struct curl_slist *slist, struct http_options *o,
-		int op, const char *uri, char *buf, size_t len)
+static void _add_swift_header(CURL *curl, struct http_headers *h,
+		struct http_options *o, int op, const char *uri, char *buf,
+		size_t len)
 {
-	char *dsha = NULL;
-	char s[512];
+	char dsha[MD5_DIGEST_LENGTH * 2 + 1];
+	struct curl_slist *slist;
 
-	if (op == DDIR_WRITE) {
-		dsha = _gen_hex_md5(buf, len);
-	}
 	/* Surpress automatic Accept: header */
-	slist = curl_slist_append(slist, "Accept:");
+	slist = _hdr_add(h, "Accept:");
 
-	snprintf(s, sizeof(s), "etag: %s", dsha);
-	slist = curl_slist_append(slist, s);
+	if (op == DDIR_WRITE) {
+		_gen_hex_md5(buf, len, dsha);
+		slist = _hdr_add(h, "etag: %s", dsha);
+	}
 
-	snprintf(s, sizeof(s), "x-auth-token: %s", o->swift_auth_token);
-	slist = curl_slist_append(slist, s);
+	slist = _hdr_add(h, "x-auth-token: %s", o->swift_auth_token);
 
 	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, slist);
-
-	free(dsha);
 }
 
 static void fio_http_cleanup(struct thread_data *td)
@@ -440,6 +550,10 @@ static void fio_http_cleanup(struct thread_data *td)
 
 	if (http) {
 		curl_easy_cleanup(http->curl);
+		if (http->multi)
+			curl_multi_cleanup(http->multi);
+		_hmac_exit(&http->sign);
+		free(http->events);
 		free(http);
 	}
 }
@@ -483,113 +597,305 @@ static int _http_seek(void *stream, curl_off_t offset, int origin)
 		return CURL_SEEKFUNC_FAIL;
 }
 
-static enum fio_q_status fio_http_queue(struct thread_data *td,
-					 struct io_u *io_u)
+static CURL *_http_easy_init(struct http_options *o)
+{
+	CURL *curl;
+
+	curl = curl_easy_init();
+	if (!curl)
+		return NULL;
+
+	if (o->verbose)
+		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+	if (o->verbose > 1)
+		curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, &_curl_trace);
+	curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L);
+	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+	curl_easy_setopt(curl, CURLOPT_PROTOCOLS, CURLPROTO_HTTP|CURLPROTO_HTTPS);
+	if (o->https == FIO_HTTPS_INSECURE) {
+		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+	}
+	curl_easy_setopt(curl, CURLOPT_READFUNCTION, _http_read);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _http_write);
+	curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, &_http_seek);
+	if (o->user && o->pass) {
+		curl_easy_setopt(curl, CURLOPT_USERNAME, o->user);
+		curl_easy_setopt(curl, CURLOPT_PASSWORD, o->pass);
+		curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
+	}
+
+	return curl;
+}
+
+/*
+ * Point the handle at the object of this io_u and set up method and
+ * headers, which must stay untouched until the request is done.
+ */
+static void _http_prep(struct thread_data *td, CURL *curl, struct io_u *io_u,
+		       struct http_headers *h, struct http_curl_stream *stream)
 {
 	struct http_data *http = td->io_ops_data;
 	struct http_options *o = td->eo;
-	struct http_curl_stream _curl_stream;
-	struct curl_slist *slist = NULL;
 	char object[512];
 	char url[1024];
-	long status;
-	CURLcode res;
-	int r = -1;
 
-	fio_ro_check(td, io_u);
-	memset(&_curl_stream, 0, sizeof(_curl_stream));
 	snprintf(object, sizeof(object), "%s_%llu_%llu", td->files[0]->file_name,
 		io_u->offset, io_u->xfer_buflen);
 	if (o->https == FIO_HTTPS_OFF)
 		snprintf(url, sizeof(url), "http://%s%s", o->host, object);
 	else
 		snprintf(url, sizeof(url), "https://%s%s", o->host, object);
-	curl_easy_setopt(http->curl, CURLOPT_URL, url);
-	_curl_stream.buf = io_u->xfer_buf;
-	_curl_stream.max = io_u->xfer_buflen;
-	curl_easy_setopt(http->curl, CURLOPT_SEEKDATA, &_curl_stream);
-	curl_easy_setopt(http->curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)io_u->xfer_buflen);
-
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	stream->buf = io_u->xfer_buf;
+	stream->pos = 0;
+	stream->max = io_u->xfer_buflen;
+	curl_easy_setopt(curl, CURLOPT_SEEKDATA, stream);
+	curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)io_u->xfer_buflen);
+
+	h->nr = 0;
+	h->used = 0;
 	if (o->mode == FIO_HTTP_S3)
-		_add_aws_auth_header(http->curl, slist, o, io_u->ddir, object,
+		_add_aws_auth_header(curl, &http->sign, h, o, io_u->ddir, object,
 			io_u->xfer_buf, io_u->xfer_buflen);
 	else if (o->mode == FIO_HTTP_SWIFT)
-		_add_swift_header(http->curl, slist, o, io_u->ddir, object,
+		_add_swift_header(curl, h, o, io_u->ddir, object,
 			io_u->xfer_buf, io_u->xfer_buflen);
 
 	if (io_u->ddir == DDIR_WRITE) {
-		curl_easy_setopt(http->curl, CURLOPT_READDATA, &_curl_stream);
-		curl_easy_setopt(http->curl, CURLOPT_WRITEDATA, NULL);
-		curl_easy_setopt(http->curl, CURLOPT_UPLOAD, 1L);
-		res = curl_easy_perform(http->curl);
-		if (res == CURLE_OK) {
-			curl_easy_getinfo(http->curl, CURLINFO_RESPONSE_CODE, &status);
-			if (status == 100 || (status >= 200 && status <= 204))
-				goto out;
-			log_err("DDIR_WRITE failed with HTTP status code %ld\n", status);
-			goto err;
-		}
+		curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, NULL);
+		curl_easy_setopt(curl, CURLOPT_READDATA, stream);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, NULL);
+		curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
 	} else if (io_u->ddir == DDIR_READ) {
-		curl_easy_setopt(http->curl, CURLOPT_READDATA, NULL);
-		curl_easy_setopt(http->curl, CURLOPT_WRITEDATA, &_curl_stream);
-		curl_easy_setopt(http->curl, CURLOPT_HTTPGET, 1L);
-		res = curl_easy_perform(http->curl);
-		if (res == CURLE_OK) {
-			curl_easy_getinfo(http->curl, CURLINFO_RESPONSE_CODE, &status);
-			if (status == 200)
-				goto out;
-			else if (status == 404) {
-				/* Object doesn't exist. Pretend we read
-				 * zeroes */
-				memset(io_u->xfer_buf, 0, io_u->xfer_buflen);
-				goto out;
-			}
-			log_err("DDIR_READ failed with HTTP status code %ld\n", status);
+		curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, NULL);
+		curl_easy_setopt(curl, CURLOPT_READDATA, NULL);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, stream);
+		curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+	} else {
+		curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+		curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
+		curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)0);
+		curl_easy_setopt(curl, CURLOPT_READDATA, NULL);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, NULL);
+	}
+}
+
+/*
+ * Check the outcome of a finished request, returns 0 or an errno value.
+ */
+static int _http_check(struct io_u *io_u, CURL *curl, CURLcode res)
+{
+	long status;
+
+	if (res != CURLE_OK) {
+		log_err("http: transfer failed: %s\n", curl_easy_strerror(res));
+		return EIO;
+	}
+
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+	if (io_u->ddir == DDIR_WRITE) {
+		if (status == 100 || (status >= 200 && status <= 204))
+			return 0;
+		log_err("DDIR_WRITE failed with HTTP status code %ld\n", status);
+	} else if (io_u->ddir == DDIR_READ) {
+		if (status == 200)
+			return 0;
+		else if (status == 404) {
+			/* Object doesn't exist. Pretend we read
+			 * zeroes */
+			memset(io_u->xfer_buf, 0, io_u->xfer_buflen);
+			return 0;
 		}
-		goto err;
-	} else if (io_u->ddir == DDIR_TRIM) {
-		curl_easy_setopt(http->curl, CURLOPT_HTTPGET, 1L);
-		curl_easy_setopt(http->curl, CURLOPT_CUSTOMREQUEST, "DELETE");
-		curl_easy_setopt(http->curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)0);
-		curl_easy_setopt(http->curl, CURLOPT_READDATA, NULL);
-		curl_easy_setopt(http->curl, CURLOPT_WRITEDATA, NULL);
-		res = curl_easy_perform(http->curl);
-		if (res == CURLE_OK) {
-			curl_easy_getinfo(http->curl, CURLINFO_RESPONSE_CODE, &status);
-			if (status == 200 || status == 202 || status == 204 || status == 404)
-				goto out;
-			log_err("DDIR_TRIM failed with HTTP status code %ld\n", status);
+		log_err("DDIR_READ failed with HTTP status code %ld\n", status);
+	} else {
+		if (status == 200 || status == 202 || status == 204 || status == 404)
+			return 0;
+		log_err("DDIR_TRIM failed with HTTP status code %ld\n", status);
+	}
+
+	return EIO;
+}
+
+static enum fio_q_status fio_http_queue(struct thread_data *td,
+					 struct io_u *io_u)
+{
+	struct http_data *http = td->io_ops_data;
+	struct http_curl_stream _curl_stream;
+	struct http_io *io;
+	CURLMcode mres;
+	CURLcode res;
+	int running;
+
+	fio_ro_check(td, io_u);
+
+	if (io_u->ddir != DDIR_READ && io_u->ddir != DDIR_WRITE &&
+	    io_u->ddir != DDIR_TRIM) {
+		log_err("WARNING: Only DDIR_READ/DDIR_WRITE/DDIR_TRIM are supported!\n");
+		io_u->error = EINVAL;
+		td_verror(td, io_u->error, "transfer");
+		return FIO_Q_COMPLETED;
+	}
+
+	if (http->multi) {
+		io = io_u->engine_data;
+		_http_prep(td, io->curl, io_u, &io->headers, &io->stream);
+		mres = curl_multi_add_handle(http->multi, io->curl);
+		if (mres != CURLM_OK) {
+			log_err("http: curl_multi_add_handle: %s\n",
+				curl_multi_strerror(mres));
+			io_u->error = EIO;
+			td_verror(td, io_u->error, "transfer");
+			return FIO_Q_COMPLETED;
 		}
-		goto err;
+
+		/* Get the request on the wire, completions are reaped later */
+		curl_multi_perform(http->multi, &running);
+		return FIO_Q_QUEUED;
 	}
 
-	log_err("WARNING: Only DDIR_READ/DDIR_WRITE/DDIR_TRIM are supported!\n");
+	memset(&_curl_stream, 0, sizeof(_curl_stream));
+	_http_prep(td, http->curl, io_u, &http->headers, &_curl_stream);
+	res = curl_easy_perform(http->curl);
+	io_u->error = _http_check(io_u, http->curl, res);
+	if (io_u->error)
+		td_verror(td, io_u->error, "transfer");
 
-err:
-	io_u->error = r;
-	td_verror(td, io_u->error, "transfer");
-out:
-	curl_slist_free_all(slist);
 	return FIO_Q_COMPLETED;
 }
 
+/*
+ * Move finished requests of the multi handle to the event array.
+ */
+static void _http_reap(struct thread_data *td, unsigned int max)
+{
+	struct http_data *http = td->io_ops_data;
+	struct io_u *io_u;
+	struct http_io *io;
+	CURLcode res;
+	CURLMsg *msg;
+	char *priv;
+	int left;
+
+	while (http->nr_events < max &&
+	       (msg = curl_multi_info_read(http->multi, &left)) != NULL) {
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+
+		curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &priv);
+		io_u = (struct io_u *) priv;
+		io = io_u->engine_data;
+		res = msg->data.result;
+
+		/* msg is gone once the handle is removed */
+		curl_multi_remove_handle(http->multi, io->curl);
+		io_u->error = _http_check(io_u, io->curl, res);
+
+		http->events[http->nr_events++] = io_u;
+	}
+}
+
 static struct io_u *fio_http_event(struct thread_data *td, int event)
 {
+	struct http_data *http = td->io_ops_data;
+
 	/* sync IO engine - never any outstanding events */
-	return NULL;
+	if (!http->multi)
+		return NULL;
+
+	return http->events[event];
 }
 
 int fio_http_getevents(struct thread_data *td, unsigned int min,
 	unsigned int max, const struct timespec *t)
 {
+	struct http_data *http = td->io_ops_data;
+	uint64_t timeout = 0, elapsed;
+	struct timespec start;
+	int running, wait;
+
 	/* sync IO engine - never any outstanding events */
+	if (!http->multi)
+		return 0;
+
+	http->nr_events = 0;
+	if (t) {
+		timeout = t->tv_sec * 1000 + t->tv_nsec / 1000000;
+		fio_gettime(&start, NULL);
+	}
+
+	for (;;) {
+		curl_multi_perform(http->multi, &running);
+		_http_reap(td, max);
+		if (http->nr_events >= min || !running)
+			break;
+
+		wait = 1000;
+		if (t) {
+			elapsed = mtime_since_now(&start);
+			if (elapsed >= timeout)
+				break;
+			if (timeout - elapsed < wait)
+				wait = timeout - elapsed;
+		}
+		curl_multi_wait(http->multi, NULL, 0, wait, NULL);
+	}
+
+	return http->nr_events;
+}
+
+static int fio_http_io_u_init(struct thread_data *td, struct io_u *io_u)
+{
+	struct http_options *o = td->eo;
+	struct http_io *io;
+
+	io_u->engine_data = NULL;
+	if (!o->async)
+		return 0;
+
+	io = calloc(1, sizeof(*io));
+	if (!io)
+		return 1;
+
+	io->curl = _http_easy_init(o);
+	if (!io->curl) {
+		free(io);
+		return 1;
+	}
+	curl_easy_setopt(io->curl, CURLOPT_PRIVATE, io_u);
+#if LIBCURL_VERSION_NUM >= 0x072f00
+	/* HTTP/2 over TLS where the server offers it, HTTP/1.1 otherwise */
+	curl_easy_setopt(io->curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	/* Rather wait for a stream on a pooled connection than open another */
+	curl_easy_setopt(io->curl, CURLOPT_PIPEWAIT, 1L);
+#endif
+
+	io_u->engine_data = io;
 	return 0;
 }
 
+static void fio_http_io_u_free(struct thread_data *td, struct io_u *io_u)
+{
+	struct http_data *http = td->io_ops_data;
+	struct http_io *io = io_u->engine_data;
+
+	if (!io)
+		return;
+
+	if (http && http->multi)
+		curl_multi_remove_handle(http->multi, io->curl);
+	curl_easy_cleanup(io->curl);
+	free(io);
+	io_u->engine_data = NULL;
+}
+
 static int fio_http_setup(struct thread_data *td)
 {
 	struct http_data *http = NULL;
 	struct http_options *o = td->eo;
+	long conns;
 
 	/* allocate engine specific structure to deal with libhttp. */
 	http = calloc(1, sizeof(*http));
@@ -597,29 +903,41 @@ static int fio_http_setup(struct thread_data *td)
 		log_err("calloc failed.\n");
 		goto cleanup;
 	}
+	td->io_ops_data = http;
 
-	http->curl = curl_easy_init();
-	if (o->verbose)
-		curl_easy_setopt(http->curl, CURLOPT_VERBOSE, 1L);
-	if (o->verbose > 1)
-		curl_easy_setopt(http->curl, CURLOPT_DEBUGFUNCTION, &_curl_trace);
-	curl_easy_setopt(http->curl, CURLOPT_NOPROGRESS, 1L);
-	curl_easy_setopt(http->curl, CURLOPT_FOLLOWLOCATION, 1L);
-	curl_easy_setopt(http->curl, CURLOPT_PROTOCOLS, CURLPROTO_HTTP|CURLPROTO_HTTPS);
-	if (o->https == FIO_HTTPS_INSECURE) {
-		curl_easy_setopt(http->curl, CURLOPT_SSL_VERIFYPEER, 0L);
-		curl_easy_setopt(http->curl, CURLOPT_SSL_VERIFYHOST, 0L);
-	}
-	curl_easy_setopt(http->curl, CURLOPT_READFUNCTION, _http_read);
-	curl_easy_setopt(http->curl, CURLOPT_WRITEFUNCTION, _http_write);
-	curl_easy_setopt(http->curl, CURLOPT_SEEKFUNCTION, &_http_seek);
-	if (o->user && o->pass) {
-		curl_easy_setopt(http->curl, CURLOPT_USERNAME, o->user);
-		curl_easy_setopt(http->curl, CURLOPT_PASSWORD, o->pass);
-		curl_easy_setopt(http->curl, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
+	if (_hmac_init(&http->sign)) {
+		log_err("http: failed to allocate HMAC context\n");
+		goto cleanup;
 	}
 
-	td->io_ops_data = http;
+	if (o->async) {
+		/*
+		 * Each io_u has its own easy handle, the multi handle
+		 * keeps the pool of connections they share.
+		 */
+		http->multi = curl_multi_init();
+		http->events = calloc(td->o.iodepth, sizeof(struct io_u *));
+		if (!http->multi || !http->events) {
+			log_err("http: failed to set up async mode\n");
+			goto cleanup;
+		}
+
+		conns = o->max_connections ? o->max_connections : td->o.iodepth;
+#if LIBCURL_VERSION_NUM >= 0x071e00
+		curl_multi_setopt(http->multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, conns);
+		curl_multi_setopt(http->multi, CURLMOPT_MAX_HOST_CONNECTIONS, conns);
+#endif
+		curl_multi_setopt(http->multi, CURLMOPT_MAXCONNECTS, conns);
+#ifdef CURLPIPE_MULTIPLEX
+		curl_multi_setopt(http->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+	} else {
+		http->curl = _http_easy_init(o);
+		if (!http->curl) {
+			log_err("curl_easy_init failed.\n");
+			goto cleanup;
+		}
+	}
 
 	/* Force single process mode. */
 	td->o.use_thread = 1;
@@ -627,6 +945,7 @@ static int fio_http_setup(struct thread_data *td)
 	return 0;
 cleanup:
 	fio_http_cleanup(td);
+	td->io_ops_data = NULL;
 	return 1;
 }
 
@@ -648,6 +967,8 @@ static struct ioengine_ops ioengine = {
 	.getevents		= fio_http_getevents,
 	.event			= fio_http_event,
 	.cleanup		= fio_http_cleanup,
+	.io_u_init		= fio_http_io_u_init,
+	.io_u_free		= fio_http_io_u_free,
 	.open_file		= fio_http_open,
 	.invalidate		= fio_http_invalidate,
 	.options		= options,
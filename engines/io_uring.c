@@ -9,14 +9,17 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <poll.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/eventfd.h>
 
 #include "../fio.h"
 #include "../lib/pow2.h"
 #include "../optgroup.h"
 #include "../lib/memalign.h"
 #include "../lib/fls.h"
+#include "../verify.h"
 
 #ifdef ARCH_HAVE_IOURING
 
@@ -61,9 +64,27 @@ struct ioring_data {
 	unsigned cq_ring_mask;
 
 	int queued;
-	int cq_ring_off;
 	unsigned iodepth;
 
+	/* reaped io_us, handed out by ->event() */
+	struct io_u **events;
+
+	/* fsync_link: fsync every link_blocks writes, chained to the write */
+	unsigned int link_blocks;
+	unsigned int link_datasync;
+	unsigned int link_writes;
+
+	/* buffer_select: pool of buffers provided to the kernel for reads */
+	char *bufs;
+	unsigned int nr_bufs;
+	unsigned int buf_size;
+	unsigned int bufs_avail;
+	unsigned int bufs_peak;
+	uint64_t buf_reads;
+	uint64_t buf_waits;
+
+	int cq_eventfd;
+
 	struct ioring_mmap mmap[3];
 };
 
@@ -78,8 +99,23 @@ struct ioring_options {
 	unsigned int sqpoll_cpu;
 	unsigned int nonvectored;
 	unsigned int uncached;
+	unsigned int reap_eventfd;
+	unsigned int fsync_link;
+	unsigned int buffer_select;
+	unsigned int buffer_pool;
 };
 
+/*
+ * user_data tags of the SQEs of a write+fsync chain. The write only records
+ * its result in the io_u, which completes with the trailing fsync.
+ */
+#define IORING_CHAIN_HEAD	1UL
+#define IORING_CHAIN_TAIL	2UL
+#define IORING_CHAIN_MASK	3UL
+
+/* buffer group of the buffer_select pool */
+#define IORING_BUF_GROUP	1
+
 static const int ddir_to_op[2][2] = {
 	{ IORING_OP_READV, IORING_OP_READ },
 	{ IORING_OP_WRITEV, IORING_OP_WRITE }
@@ -183,6 +219,43 @@ static struct fio_option options[] = {
 		.category = FIO_OPT_C_ENGINE,
 		.group	= FIO_OPT_G_IOURING,
 	},
+	{
+		.name	= "reap_eventfd",
+		.lname	= "Reap completions via eventfd",
+		.type	= FIO_OPT_STR_SET,
+		.off1	= offsetof(struct ioring_options, reap_eventfd),
+		.help	= "Wait for completions on a registered eventfd",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_IOURING,
+	},
+	{
+		.name	= "fsync_link",
+		.lname	= "Link fsync to writes",
+		.type	= FIO_OPT_STR_SET,
+		.off1	= offsetof(struct ioring_options, fsync_link),
+		.help	= "Issue fsync/fdatasync linked to the write that triggers it",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_IOURING,
+	},
+	{
+		.name	= "buffer_select",
+		.lname	= "Kernel buffer selection",
+		.type	= FIO_OPT_STR_SET,
+		.off1	= offsetof(struct ioring_options, buffer_select),
+		.help	= "Read into buffers the kernel picks from a provided pool",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_IOURING,
+	},
+	{
+		.name	= "buffer_pool",
+		.lname	= "Provided buffer pool size",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct ioring_options, buffer_pool),
+		.help	= "Number of buffers in the buffer_select pool (0 = iodepth)",
+		.def	= "0",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_IOURING,
+	},
 	{
 		.name	= NULL,
 	},
@@ -215,7 +288,13 @@ static int fio_ioring_prep(struct thread_data *td, struct io_u *io_u)
 	}
 
 	if (io_u->ddir == DDIR_READ || io_u->ddir == DDIR_WRITE) {
-		if (o->fixedbufs) {
+		if (ld->nr_bufs && io_u->ddir == DDIR_READ) {
+			/* the kernel picks the buffer, see fio_ioring_reap_buf() */
+			sqe->opcode = IORING_OP_READ;
+			sqe->len = io_u->xfer_buflen;
+			sqe->flags |= IOSQE_BUFFER_SELECT;
+			sqe->buf_group = IORING_BUF_GROUP;
+		} else if (o->fixedbufs) {
 			sqe->opcode = fixed_ddir_to_op[io_u->ddir];
 			sqe->addr = (unsigned long) io_u->xfer_buf;
 			sqe->len = io_u->xfer_buflen;
@@ -258,58 +337,175 @@ static int fio_ioring_prep(struct thread_data *td, struct io_u *io_u)
 static struct io_u *fio_ioring_event(struct thread_data *td, int event)
 {
 	struct ioring_data *ld = td->io_ops_data;
-	struct io_uring_cqe *cqe;
-	struct io_u *io_u;
-	unsigned index;
-
-	index = (event + ld->cq_ring_off) & ld->cq_ring_mask;
 
-	cqe = &ld->cq_ring.cqes[index];
-	io_u = (struct io_u *) (uintptr_t) cqe->user_data;
+	return ld->events[event];
+}
 
-	if (cqe->res != io_u->xfer_buflen) {
-		if (cqe->res > io_u->xfer_buflen)
-			io_u->error = -cqe->res;
+static void fio_ioring_cqe_result(struct io_u *io_u, int res)
+{
+	if (res != io_u->xfer_buflen) {
+		if (res > io_u->xfer_buflen)
+			io_u->error = -res;
 		else
-			io_u->resid = io_u->xfer_buflen - cqe->res;
+			io_u->resid = io_u->xfer_buflen - res;
 	} else
 		io_u->error = 0;
+}
+
+static char *fio_ioring_buf(struct ioring_data *ld, unsigned int bid)
+{
+	return ld->bufs + (size_t) bid * ld->buf_size;
+}
+
+/*
+ * Hand buffers [bid, bid + nr) back to the kernel. Every buffer has its own
+ * SQE slot after the io_u slots, and the ring has room for all of them, so
+ * this can queue from anywhere. The SQE goes out with the next submit,
+ * ahead of any read queued after it.
+ */
+static void fio_ioring_provide(struct thread_data *td, unsigned int bid,
+			       unsigned int nr)
+{
+	struct ioring_data *ld = td->io_ops_data;
+	struct io_sq_ring *ring = &ld->sq_ring;
+	unsigned int index = 2 * td->o.iodepth + bid;
+	struct io_uring_sqe *sqe = &ld->sqes[index];
+	unsigned tail;
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+	sqe->fd = nr;
+	sqe->addr = (unsigned long) fio_ioring_buf(ld, bid);
+	sqe->len = ld->buf_size;
+	sqe->off = bid;
+	sqe->buf_group = IORING_BUF_GROUP;
+	/* user_data 0, completions without an io_u are internal */
 
-	return io_u;
+	tail = *ring->tail;
+	ring->array[tail & ld->sq_ring_mask] = index;
+	write_barrier();
+	*ring->tail = tail + 1;
+	write_barrier();
+
+	ld->queued++;
+	ld->bufs_avail += nr;
 }
 
+/*
+ * A buffer_select read completed. Copy the data to the io_u when something
+ * looks at it, and give the buffer straight back to the pool.
+ */
+static void fio_ioring_reap_buf(struct thread_data *td, struct io_u *io_u,
+				struct io_uring_cqe *cqe)
+{
+	struct ioring_data *ld = td->io_ops_data;
+	unsigned int bid;
+
+	if (!(cqe->flags & IORING_CQE_F_BUFFER)) {
+		/* failed before a buffer was picked */
+		ld->bufs_avail++;
+		return;
+	}
+
+	bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	if (cqe->res > 0 && td->o.verify != VERIFY_NONE)
+		memcpy(io_u->xfer_buf, fio_ioring_buf(ld, bid), cqe->res);
+
+	fio_ioring_provide(td, bid, 1);
+}
+
+/*
+ * Consume what is on the CQ ring, until max - events io_us have completed.
+ * One load of the tail covers the whole batch, and the head is published
+ * once.
+ */
 static int fio_ioring_cqring_reap(struct thread_data *td, unsigned int events,
 				   unsigned int max)
 {
 	struct ioring_data *ld = td->io_ops_data;
 	struct io_cq_ring *ring = &ld->cq_ring;
-	unsigned head, reaped = 0;
+	unsigned head, tail, reaped = 0;
 
 	head = *ring->head;
-	do {
-		read_barrier();
-		if (head == *ring->tail)
-			break;
-		reaped++;
+	tail = *ring->tail;
+	read_barrier();
+
+	while (head != tail && events + reaped < max) {
+		struct io_uring_cqe *cqe = &ring->cqes[head & ld->cq_ring_mask];
+		unsigned long data = cqe->user_data;
+		struct io_u *io_u;
+
+		io_u = (struct io_u *) (uintptr_t) (data & ~IORING_CHAIN_MASK);
 		head++;
-	} while (reaped + events < max);
+
+		if (!io_u) {
+			if (cqe->res < 0)
+				log_err("fio: io_uring provide buffers: %s\n",
+					strerror(-cqe->res));
+			continue;
+		}
+		if (ld->bufs && io_u->ddir == DDIR_READ)
+			fio_ioring_reap_buf(td, io_u, cqe);
+
+		if (data & IORING_CHAIN_HEAD) {
+			fio_ioring_cqe_result(io_u, cqe->res);
+			continue;
+		} else if (data & IORING_CHAIN_TAIL) {
+			/* a failed write cancels the fsync, keep its error */
+			if (!io_u->error && cqe->res < 0)
+				io_u->error = -cqe->res;
+		} else
+			fio_ioring_cqe_result(io_u, cqe->res);
+
+		ld->events[events + reaped++] = io_u;
+	}
 
 	*ring->head = head;
 	write_barrier();
 	return reaped;
 }
 
+/*
+ * Sleep until the kernel signals a completion on the registered eventfd,
+ * or the timeout expires. Returns 1 when woken, 0 on timeout.
+ */
+static int fio_ioring_wait_eventfd(struct thread_data *td,
+				   const struct timespec *t)
+{
+	struct ioring_data *ld = td->io_ops_data;
+	struct pollfd pfd = {
+		.fd	= ld->cq_eventfd,
+		.events	= POLLIN,
+	};
+	int timeout = -1, ret;
+	eventfd_t val;
+
+	if (t)
+		timeout = t->tv_sec * 1000 + t->tv_nsec / 1000000;
+
+	ret = poll(&pfd, 1, timeout);
+	if (ret < 0) {
+		if (errno == EINTR)
+			return 1;
+		td_verror(td, errno, "poll");
+		return -1;
+	} else if (!ret)
+		return 0;
+
+	/* Reset the count, the CQ ring is drained right after */
+	eventfd_read(ld->cq_eventfd, &val);
+	return 1;
+}
+
 static int fio_ioring_getevents(struct thread_data *td, unsigned int min,
 				unsigned int max, const struct timespec *t)
 {
 	struct ioring_data *ld = td->io_ops_data;
 	unsigned actual_min = td->o.iodepth_batch_complete_min == 0 ? 0 : min;
 	struct ioring_options *o = td->eo;
-	struct io_cq_ring *ring = &ld->cq_ring;
 	unsigned events = 0;
 	int r;
 
-	ld->cq_ring_off = *ring->head;
 	do {
 		r = fio_ioring_cqring_reap(td, events, max);
 		if (r) {
@@ -319,7 +515,11 @@ static int fio_ioring_getevents(struct thread_data *td, unsigned int min,
 			continue;
 		}
 
-		if (!o->sqpoll_thread) {
+		if (o->reap_eventfd) {
+			r = fio_ioring_wait_eventfd(td, t);
+			if (r <= 0)
+				break;
+		} else if (!o->sqpoll_thread) {
 			r = io_uring_enter(ld, 0, actual_min,
 						IORING_ENTER_GETEVENTS);
 			if (r < 0) {
@@ -345,19 +545,41 @@ static void fio_ioring_prio_prep(struct thread_data *td, struct io_u *io_u)
 	return;
 }
 
+/*
+ * Turn the SQE of a write into the head of a chain ending in an fsync,
+ * which goes into the spare SQE slot of the io_u. Like fio's own syncs,
+ * the fsync must cover every write issued before it, not just the one it
+ * is chained to, so the write drains the ring of earlier requests first.
+ */
+static void fio_ioring_link_fsync(struct thread_data *td, struct io_u *io_u)
+{
+	struct ioring_data *ld = td->io_ops_data;
+	struct io_uring_sqe *sqe = &ld->sqes[io_u->index];
+	struct io_uring_sqe *fsqe = &ld->sqes[td->o.iodepth + io_u->index];
+
+	memset(fsqe, 0, sizeof(*fsqe));
+	fsqe->opcode = IORING_OP_FSYNC;
+	fsqe->fd = sqe->fd;
+	fsqe->flags = sqe->flags & IOSQE_FIXED_FILE;
+	if (ld->link_datasync)
+		fsqe->fsync_flags = IORING_FSYNC_DATASYNC;
+	fsqe->user_data = (unsigned long) io_u | IORING_CHAIN_TAIL;
+
+	sqe->flags |= IOSQE_IO_LINK | IOSQE_IO_DRAIN;
+	sqe->user_data = (unsigned long) io_u | IORING_CHAIN_HEAD;
+}
+
 static enum fio_q_status fio_ioring_queue(struct thread_data *td,
 					  struct io_u *io_u)
 {
 	struct ioring_data *ld = td->io_ops_data;
 	struct io_sq_ring *ring = &ld->sq_ring;
 	struct ioring_options *o = td->eo;
-	unsigned tail, next_tail;
+	unsigned tail, nr = 1;
+	bool link = false;
 
 	fio_ro_check(td, io_u);
 
-	if (ld->queued == ld->iodepth)
-		return FIO_Q_BUSY;
-
 	if (io_u->ddir == DDIR_TRIM) {
 		if (ld->queued)
 			return FIO_Q_BUSY;
@@ -368,49 +590,89 @@ static enum fio_q_status fio_ioring_queue(struct thread_data *td,
 		return FIO_Q_COMPLETED;
 	}
 
+	if (ld->link_blocks && io_u->ddir == DDIR_WRITE &&
+	    !((ld->link_writes + 1) % ld->link_blocks)) {
+		link = true;
+		nr = 2;
+	}
+
 	tail = *ring->tail;
-	next_tail = tail + 1;
 	read_barrier();
-	if (next_tail == *ring->head)
+	if (tail + nr - *ring->head > *ring->ring_entries)
 		return FIO_Q_BUSY;
 
+	if (ld->bufs && io_u->ddir == DDIR_READ) {
+		if (!ld->bufs_avail) {
+			ld->buf_waits++;
+			return FIO_Q_BUSY;
+		}
+		ld->bufs_avail--;
+		if (ld->nr_bufs - ld->bufs_avail > ld->bufs_peak)
+			ld->bufs_peak = ld->nr_bufs - ld->bufs_avail;
+		ld->buf_reads++;
+	}
+
 	if (o->cmdprio_percentage)
 		fio_ioring_prio_prep(td, io_u);
+	if (io_u->ddir == DDIR_WRITE)
+		ld->link_writes++;
+	if (link)
+		fio_ioring_link_fsync(td, io_u);
+
 	ring->array[tail & ld->sq_ring_mask] = io_u->index;
-	*ring->tail = next_tail;
+	if (link)
+		ring->array[(tail + 1) & ld->sq_ring_mask] =
+						td->o.iodepth + io_u->index;
+	write_barrier();
+	*ring->tail = tail + nr;
 	write_barrier();
 
-	ld->queued++;
+	ld->queued += nr;
 	return FIO_Q_QUEUED;
 }
 
-static void fio_ioring_queued(struct thread_data *td, int start, int nr)
+/*
+ * Account the nr entries submitted from start. Returns how many of them were
+ * io_us, the fsync of a chain and buffers given back to the kernel are not.
+ */
+static int fio_ioring_queued(struct thread_data *td, int start, int nr)
 {
 	struct ioring_data *ld = td->io_ops_data;
+	struct io_sq_ring *ring = &ld->sq_ring;
+	bool issue_time = fio_fill_issue_time(td);
 	struct timespec now;
+	int io_us = 0;
 
-	if (!fio_fill_issue_time(td))
-		return;
-
-	fio_gettime(&now, NULL);
+	if (issue_time)
+		fio_gettime(&now, NULL);
 
 	while (nr--) {
-		struct io_sq_ring *ring = &ld->sq_ring;
 		int index = ring->array[start & ld->sq_ring_mask];
-		struct io_u *io_u = ld->io_u_index[index];
+		struct io_u *io_u;
+
+		start++;
 
+		/* the fsync of a chain, its io_u was accounted with the write */
+		if (index >= td->o.iodepth)
+			continue;
+
+		io_us++;
+		if (!issue_time)
+			continue;
+
+		io_u = ld->io_u_index[index];
 		memcpy(&io_u->issue_time, &now, sizeof(now));
 		io_u_queued(td, io_u);
-
-		start++;
 	}
+
+	return io_us;
 }
 
 static int fio_ioring_commit(struct thread_data *td)
 {
 	struct ioring_data *ld = td->io_ops_data;
 	struct ioring_options *o = td->eo;
-	int ret;
+	int ret, nr;
 
 	if (!ld->queued)
 		return 0;
@@ -427,23 +689,28 @@ static int fio_ioring_commit(struct thread_data *td)
 		if (*ring->flags & IORING_SQ_NEED_WAKEUP)
 			io_uring_enter(ld, ld->queued, 0,
 					IORING_ENTER_SQ_WAKEUP);
+		nr = fio_ioring_queued(td, *ring->tail - ld->queued,
+					ld->queued);
+		if (nr)
+			io_u_mark_submit(td, nr);
 		ld->queued = 0;
 		return 0;
 	}
 
 	do {
 		unsigned start = *ld->sq_ring.head;
-		long nr = ld->queued;
 
-		ret = io_uring_enter(ld, nr, 0, IORING_ENTER_GETEVENTS);
+		ret = io_uring_enter(ld, ld->queued, 0,
+					IORING_ENTER_GETEVENTS);
 		if (ret > 0) {
-			fio_ioring_queued(td, start, ret);
-			io_u_mark_submit(td, ret);
+			nr = fio_ioring_queued(td, start, ret);
+			/* a submit of only buffers for the kernel isn't one */
+			if (nr)
+				io_u_mark_submit(td, nr);
 
 			ld->queued -= ret;
 			ret = 0;
 		} else if (!ret) {
-			io_u_mark_submit(td, ret);
 			continue;
 		} else {
 			if (errno == EAGAIN || errno == EINTR) {
@@ -469,6 +736,8 @@ static void fio_ioring_unmap(struct ioring_data *ld)
 	for (i = 0; i < ARRAY_SIZE(ld->mmap); i++)
 		munmap(ld->mmap[i].ptr, ld->mmap[i].len);
 	close(ld->ring_fd);
+	if (ld->cq_eventfd != -1)
+		close(ld->cq_eventfd);
 }
 
 static void fio_ioring_cleanup(struct thread_data *td)
@@ -476,10 +745,21 @@ static void fio_ioring_cleanup(struct thread_data *td)
 	struct ioring_data *ld = td->io_ops_data;
 
 	if (ld) {
+		if (ld->bufs) {
+			dprint(FD_IO, "io_uring: %s: buffer pool: %u x %u "
+				"bytes, peak %u in use, %llu reads, %llu waited "
+				"for a buffer\n", td->o.name, ld->nr_bufs,
+				ld->buf_size, ld->bufs_peak,
+				(unsigned long long) ld->buf_reads,
+				(unsigned long long) ld->buf_waits);
+		}
+
 		if (!(td->flags & TD_F_CHILD))
 			fio_ioring_unmap(ld);
 
 		free(ld->io_u_index);
+		free(ld->events);
+		free(ld->bufs);
 		free(ld->iovecs);
 		free(ld->fds);
 		free(ld);
@@ -532,7 +812,7 @@ static int fio_ioring_queue_init(struct thread_data *td)
 	struct ioring_options *o = td->eo;
 	int depth = td->o.iodepth;
 	struct io_uring_params p;
-	int ret;
+	int entries, ret;
 
 	memset(&p, 0, sizeof(p));
 
@@ -546,7 +826,15 @@ static int fio_ioring_queue_init(struct thread_data *td)
 		}
 	}
 
-	ret = syscall(__NR_io_uring_setup, depth, &p);
+	/*
+	 * fsync_link chains need a second SQE per io_u, buffer_select one
+	 * per pool buffer to hand it back.
+	 */
+	entries = depth;
+	if (ld->link_blocks || ld->nr_bufs)
+		entries = 2 * depth + ld->nr_bufs;
+
+	ret = syscall(__NR_io_uring_setup, entries, &p);
 	if (ret < 0)
 		return ret;
 
@@ -567,6 +855,17 @@ static int fio_ioring_queue_init(struct thread_data *td)
 			return ret;
 	}
 
+	if (o->reap_eventfd) {
+		ld->cq_eventfd = eventfd(0, EFD_CLOEXEC);
+		if (ld->cq_eventfd < 0)
+			return ld->cq_eventfd;
+
+		ret = syscall(__NR_io_uring_register, ld->ring_fd,
+				IORING_REGISTER_EVENTFD, &ld->cq_eventfd, 1);
+		if (ret < 0)
+			return ret;
+	}
+
 	return fio_ioring_mmap(ld, &p);
 }
 
@@ -610,6 +909,50 @@ err:
 	return ret;
 }
 
+/*
+ * Allocate the buffer_select pool and provide all of it to the kernel,
+ * waiting for the result to catch kernels without buffer selection.
+ */
+static int fio_ioring_init_bufs(struct thread_data *td)
+{
+	struct ioring_data *ld = td->io_ops_data;
+	struct ioring_options *o = td->eo;
+	struct io_cq_ring *ring = &ld->cq_ring;
+	struct io_uring_cqe *cqe;
+	unsigned flags = IORING_ENTER_GETEVENTS;
+	void *bufs;
+	int ret;
+
+	ld->buf_size = td_max_bs(td);
+	if (posix_memalign(&bufs, page_size, (size_t) ld->nr_bufs * ld->buf_size))
+		return ENOMEM;
+	ld->bufs = bufs;
+
+	fio_ioring_provide(td, 0, ld->nr_bufs);
+	if (o->sqpoll_thread)
+		flags |= IORING_ENTER_SQ_WAKEUP;
+	do {
+		ret = io_uring_enter(ld, ld->queued, 1, flags);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return errno;
+	ld->queued = 0;
+
+	read_barrier();
+	cqe = &ring->cqes[*ring->head & ld->cq_ring_mask];
+	ret = cqe->res;
+	*ring->head = *ring->head + 1;
+	write_barrier();
+
+	if (ret < 0) {
+		log_err("fio: io_uring buffer_select needs kernel support for "
+			"IORING_OP_PROVIDE_BUFFERS\n");
+		return -ret;
+	}
+
+	return 0;
+}
+
 static int fio_ioring_post_init(struct thread_data *td)
 {
 	struct ioring_data *ld = td->io_ops_data;
@@ -639,6 +982,14 @@ static int fio_ioring_post_init(struct thread_data *td)
 		}
 	}
 
+	if (ld->nr_bufs) {
+		err = fio_ioring_init_bufs(td);
+		if (err) {
+			td_verror(td, err, "ioring_provide_buffers");
+			return 1;
+		}
+	}
+
 	return 0;
 }
 
@@ -663,7 +1014,66 @@ static int fio_ioring_init(struct thread_data *td)
 		return 1;
 	}
 
+	/* polled completions never signal the eventfd */
+	if (o->reap_eventfd && o->hipri) {
+		log_err("fio: io_uring reap_eventfd and hipri are mutually "
+			"exclusive\n");
+		return 1;
+	}
+
+	/* polled rings can't fsync */
+	if (o->fsync_link && o->hipri) {
+		log_err("fio: io_uring fsync_link and hipri are mutually "
+			"exclusive\n");
+		return 1;
+	}
+
+	if (o->fsync_link && !to->fsync_blocks && !to->fdatasync_blocks) {
+		log_err("fio: io_uring fsync_link requires fsync or fdatasync\n");
+		return 1;
+	}
+
+	/* fixed ops don't select buffers */
+	if (o->buffer_select && o->fixedbufs) {
+		log_err("fio: io_uring buffer_select and fixedbufs are mutually "
+			"exclusive\n");
+		return 1;
+	}
+
 	ld = calloc(1, sizeof(*ld));
+	ld->cq_eventfd = -1;
+
+	if (o->buffer_select) {
+		ld->nr_bufs = o->buffer_pool ? o->buffer_pool : td->o.iodepth;
+		if (ld->nr_bufs > 65536) {
+			log_err("fio: io_uring buffer_pool is limited to 65536 "
+				"buffers\n");
+			free(ld);
+			return 1;
+		}
+
+		/*
+		 * Reads land in the pool, so unless there is data to write
+		 * or verify, the io_us don't need buffers of their own.
+		 */
+		if (!td_write(td) && td->o.verify == VERIFY_NONE)
+			td->no_io_u_buffers = true;
+	}
+
+	/*
+	 * The engine issues the syncs itself, linked to the writes, so
+	 * keep the backend from issuing its own.
+	 */
+	if (o->fsync_link) {
+		if (to->fsync_blocks)
+			ld->link_blocks = to->fsync_blocks;
+		else {
+			ld->link_blocks = to->fdatasync_blocks;
+			ld->link_datasync = 1;
+		}
+		to->fsync_blocks = 0;
+		to->fdatasync_blocks = 0;
+	}
 
 	/* ring depth must be a power-of-2 */
 	ld->iodepth = td->o.iodepth;
@@ -671,6 +1081,7 @@ static int fio_ioring_init(struct thread_data *td)
 
 	/* io_u index */
 	ld->io_u_index = calloc(td->o.iodepth, sizeof(struct io_u *));
+	ld->events = calloc(td->o.iodepth, sizeof(struct io_u *));
 	ld->iovecs = calloc(td->o.iodepth, sizeof(struct iovec));
 
 	td->io_ops_data = ld;
@@ -0,0 +1,1270 @@
+/*
+ * net_uring engine
+ *
+ * IO engine that reads/writes to/from sockets through io_uring, using
+ * IORING_OP_SEND/RECV for the data and IORING_OP_ACCEPT/CONNECT to set up
+ * the connections. Unlike the net engine, a job drives many connections
+ * and keeps iodepth requests in flight across them.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "../fio.h"
+#include "../optgroup.h"
+
+#ifdef ARCH_HAVE_IOURING
+
+#include "../lib/types.h"
+#include "../os/linux/io_uring.h"
+
+struct io_sq_ring {
+	unsigned *head;
+	unsigned *tail;
+	unsigned *ring_mask;
+	unsigned *ring_entries;
+	unsigned *flags;
+	unsigned *array;
+};
+
+struct io_cq_ring {
+	unsigned *head;
+	unsigned *tail;
+	unsigned *ring_mask;
+	unsigned *ring_entries;
+	struct io_uring_cqe *cqes;
+};
+
+struct ioring_mmap {
+	void *ptr;
+	size_t len;
+};
+
+struct nuring_conn {
+	int fd;
+	unsigned int busy[DDIR_RWDIR_CNT];
+	unsigned int closed;
+
+	/* completed requests and their latency, in nsec */
+	uint64_t ios;
+	uint64_t bytes;
+	uint64_t lat_sum;
+	uint64_t lat_min;
+	uint64_t lat_max;
+};
+
+struct nuring_io {
+	struct timespec start;
+	unsigned int conn;
+	unsigned int eof;
+};
+
+struct nuring_data {
+	int ring_fd;
+
+	struct io_u **io_u_index;
+	struct io_u **events;
+	struct nuring_io *ios;
+
+	struct io_sq_ring sq_ring;
+	struct io_uring_sqe *sqes;
+	unsigned sq_ring_mask;
+	unsigned sq_entries;
+
+	struct io_cq_ring cq_ring;
+	unsigned cq_ring_mask;
+
+	int queued;
+
+	struct nuring_conn *conns;
+	unsigned int nr_conns;
+	unsigned int open_conns;
+	unsigned int next_conn;
+
+	int listenfd;
+	struct sockaddr_in addr;
+	struct sockaddr_in6 addr6;
+
+	struct ioring_mmap mmap[3];
+};
+
+struct nuring_options {
+	struct thread_data *td;
+	unsigned int port;
+	unsigned int proto;
+	unsigned int listen;
+	unsigned int pingpong;
+	unsigned int nodelay;
+	unsigned int connections;
+	unsigned int conn_stats;
+};
+
+struct udp_close_msg {
+	uint32_t magic;
+	uint32_t cmd;
+};
+
+enum {
+	FIO_LINK_CLOSE = 0x89,
+	FIO_LINK_OPEN_CLOSE_MAGIC = 0x6c696e6b,
+
+	FIO_TYPE_TCP	= 1,
+	FIO_TYPE_UDP	= 2,
+	FIO_TYPE_TCP_V6	= 4,
+	FIO_TYPE_UDP_V6	= 5,
+};
+
+/*
+ * user_data tags of the SQEs of a pingpong exchange. The first op only
+ * records its result in the io_u, which completes with the reply.
+ */
+#define NURING_CHAIN_HEAD	1UL
+#define NURING_CHAIN_TAIL	2UL
+#define NURING_CHAIN_MASK	3UL
+
+/* how long a client keeps retrying refused connects, in msec */
+#define NURING_CONNECT_TIMEOUT	10000
+
+static int str_hostname_cb(void *data, const char *input);
+static struct fio_option options[] = {
+	{
+		.name	= "hostname",
+		.lname	= "net_uring engine hostname",
+		.type	= FIO_OPT_STR_STORE,
+		.cb	= str_hostname_cb,
+		.help	= "Hostname for net_uring IO engine",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NETIO,
+	},
+	{
+		.name	= "port",
+		.lname	= "net_uring engine port",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct nuring_options, port),
+		.minval	= 1,
+		.maxval	= 65535,
+		.help	= "Port to use for TCP or UDP net connections",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NETIO,
+	},
+	{
+		.name	= "protocol",
+		.lname	= "net_uring engine protocol",
+		.alias	= "proto",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct nuring_options, proto),
+		.help	= "Network protocol to use",
+		.def	= "tcp",
+		.posval = {
+			  { .ival = "tcp",
+			    .oval = FIO_TYPE_TCP,
+			    .help = "Transmission Control Protocol",
+			  },
+#ifdef CONFIG_IPV6
+			  { .ival = "tcpv6",
+			    .oval = FIO_TYPE_TCP_V6,
+			    .help = "Transmission Control Protocol V6",
+			  },
+#endif
+			  { .ival = "udp",
+			    .oval = FIO_TYPE_UDP,
+			    .help = "User Datagram Protocol",
+			  },
+#ifdef CONFIG_IPV6
+			  { .ival = "udpv6",
+			    .oval = FIO_TYPE_UDP_V6,
+			    .help = "User Datagram Protocol V6",
+			  },
+#endif
+		},
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NETIO,
+	},
+#ifdef CONFIG_TCP_NODELAY
+	{
+		.name	= "nodelay",
+		.lname	= "No Delay",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct nuring_options, nodelay),
+		.help	= "Use TCP_NODELAY on TCP connections",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NETIO,
+	},
+#endif
+	{
+		.name	= "listen",
+		.lname	= "net_uring engine listen",
+		.type	= FIO_OPT_STR_SET,
+		.off1	= offsetof(struct nuring_options, listen),
+		.help	= "Listen for incoming TCP connections",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NETIO,
+	},
+	{
+		.name	= "pingpong",
+		.lname	= "Ping Pong",
+		.type	= FIO_OPT_STR_SET,
+		.off1	= offsetof(struct nuring_options, pingpong),
+		.help	= "Answer every request on its connection",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NETIO,
+	},
+	{
+		.name	= "connections",
+		.lname	= "net_uring connections",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct nuring_options, connections),
+		.def	= "1",
+		.minval	= 1,
+		.help	= "Number of connections to spread the IO over",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NETIO,
+	},
+	{
+		.name	= "conn_stats",
+		.lname	= "net_uring per connection stats",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct nuring_options, conn_stats),
+		.def	= "0",
+		.help	= "Report the latency of every connection",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NETIO,
+	},
+	{
+		.name	= NULL,
+	},
+};
+
+static inline int is_udp(struct nuring_options *o)
+{
+	return o->proto == FIO_TYPE_UDP || o->proto == FIO_TYPE_UDP_V6;
+}
+
+static inline int is_ipv6(struct nuring_options *o)
+{
+	return o->proto == FIO_TYPE_UDP_V6 || o->proto == FIO_TYPE_TCP_V6;
+}
+
+static int io_uring_enter(struct nuring_data *ld, unsigned int to_submit,
+			  unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, ld->ring_fd, to_submit,
+			min_complete, flags, NULL, 0);
+}
+
+static struct sockaddr *nuring_addr(struct thread_data *td, socklen_t *len)
+{
+	struct nuring_data *ld = td->io_ops_data;
+	struct nuring_options *o = td->eo;
+
+	if (is_ipv6(o)) {
+		*len = sizeof(ld->addr6);
+		return (struct sockaddr *) &ld->addr6;
+	}
+
+	*len = sizeof(ld->addr);
+	return (struct sockaddr *) &ld->addr;
+}
+
+static void nuring_prep_sqe(struct io_uring_sqe *sqe, int op, int fd,
+			    void *buf, unsigned int len)
+{
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = op;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long) buf;
+	sqe->len = len;
+}
+
+/*
+ * Submit the first nr SQEs of the ring, tagged with their slot in
+ * user_data, and wait for all of them. Used to set up the connections,
+ * before any IO is in flight.
+ */
+static int fio_nuring_sync_batch(struct thread_data *td, unsigned int nr,
+				 int *res)
+{
+	struct nuring_data *ld = td->io_ops_data;
+	struct io_sq_ring *sring = &ld->sq_ring;
+	struct io_cq_ring *cring = &ld->cq_ring;
+	unsigned int i, tail, submit = nr, done = 0;
+	int ret;
+
+	tail = *sring->tail;
+	for (i = 0; i < nr; i++) {
+		ld->sqes[i].user_data = i;
+		sring->array[(tail + i) & ld->sq_ring_mask] = i;
+	}
+	write_barrier();
+	*sring->tail = tail + nr;
+	write_barrier();
+
+	while (done < nr) {
+		unsigned head, ctail;
+
+		ret = io_uring_enter(ld, submit, 1, IORING_ENTER_GETEVENTS);
+		if (ret < 0) {
+			if ((errno == EINTR || errno == EAGAIN) &&
+			    !td->terminate)
+				continue;
+			td_verror(td, errno, "io_uring_enter");
+			return 1;
+		}
+		submit -= min(submit, (unsigned int) ret);
+
+		head = *cring->head;
+		ctail = *cring->tail;
+		read_barrier();
+		while (head != ctail) {
+			struct io_uring_cqe *cqe;
+
+			cqe = &cring->cqes[head & ld->cq_ring_mask];
+			res[cqe->user_data] = cqe->res;
+			head++;
+			done++;
+		}
+		*cring->head = head;
+		write_barrier();
+	}
+
+	return 0;
+}
+
+static int fio_nuring_sockopts(struct thread_data *td, int fd)
+{
+#ifdef CONFIG_TCP_NODELAY
+	struct nuring_options *o = td->eo;
+
+	if (o->nodelay && !is_udp(o)) {
+		int optval = 1;
+
+		if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (void *) &optval, sizeof(int)) < 0) {
+			log_err("fio: cannot set TCP_NODELAY option on socket (%s), disable with 'nodelay=0'\n", strerror(errno));
+			return 1;
+		}
+	}
+#endif
+	return 0;
+}
+
+/*
+ * Connect all sockets, a ring worth of them at a time. The server may be
+ * another job of this run that isn't listening yet, so refused connects
+ * are retried for a while.
+ */
+static int fio_nuring_connect(struct thread_data *td, int *res)
+{
+	struct nuring_data *ld = td->io_ops_data;
+	struct nuring_options *o = td->eo;
+	unsigned int i, k, nr, pending, *map;
+	struct timespec start;
+	struct sockaddr *addr;
+	int domain, type, ret = 1;
+	socklen_t len;
+
+	domain = is_ipv6(o) ? AF_INET6 : AF_INET;
+	type = is_udp(o) ? SOCK_DGRAM : SOCK_STREAM;
+	addr = nuring_addr(td, &len);
+
+	/* ring slot to connection */
+	map = calloc(ld->sq_entries, sizeof(*map));
+
+	fio_gettime(&start, NULL);
+	do {
+		pending = 0;
+		i = 0;
+		while (i < ld->nr_conns) {
+			nr = 0;
+			for (; i < ld->nr_conns && nr < ld->sq_entries; i++) {
+				struct nuring_conn *c = &ld->conns[i];
+
+				if (c->fd != -1)
+					continue;
+
+				c->fd = socket(domain, type, 0);
+				if (c->fd < 0) {
+					td_verror(td, errno, "socket");
+					if (errno == EMFILE)
+						log_err("fio: raise the open file "
+							"limit for %u connections\n",
+							ld->nr_conns);
+					goto out;
+				}
+				if (fio_nuring_sockopts(td, c->fd))
+					goto out;
+
+				nuring_prep_sqe(&ld->sqes[nr], IORING_OP_CONNECT,
+						c->fd, addr, 0);
+				ld->sqes[nr].off = len;
+				map[nr++] = i;
+			}
+			if (!nr)
+				break;
+
+			if (fio_nuring_sync_batch(td, nr, res))
+				goto out;
+
+			for (k = 0; k < nr; k++) {
+				struct nuring_conn *c = &ld->conns[map[k]];
+
+				if (!res[k])
+					continue;
+				if (res[k] != -ECONNREFUSED) {
+					td_verror(td, -res[k], "connect");
+					goto out;
+				}
+				close(c->fd);
+				c->fd = -1;
+				pending++;
+			}
+		}
+
+		if (!pending)
+			break;
+		if (td->terminate ||
+		    mtime_since_now(&start) > NURING_CONNECT_TIMEOUT) {
+			td_verror(td, ECONNREFUSED, "connect");
+			goto out;
+		}
+		usleep(10000);
+	} while (1);
+
+	ret = 0;
+out:
+	free(map);
+	return ret;
+}
+
+static int fio_nuring_accept(struct thread_data *td, int *res)
+{
+	struct nuring_data *ld = td->io_ops_data;
+	unsigned int i, j, nr;
+	int state;
+
+	state = td->runstate;
+	td_set_runstate(td, TD_SETTING_UP);
+
+	log_info("fio: waiting for %u connection%s\n", ld->nr_conns,
+			ld->nr_conns > 1 ? "s" : "");
+
+	for (i = 0; i < ld->nr_conns; i += nr) {
+		nr = min(ld->nr_conns - i, ld->sq_entries);
+
+		for (j = 0; j < nr; j++)
+			nuring_prep_sqe(&ld->sqes[j], IORING_OP_ACCEPT,
+					ld->listenfd, NULL, 0);
+
+		if (fio_nuring_sync_batch(td, nr, res))
+			goto err;
+
+		for (j = 0; j < nr; j++) {
+			if (res[j] < 0) {
+				td_verror(td, -res[j], "accept");
+				goto err;
+			}
+			ld->conns[i + j].fd = res[j];
+			if (fio_nuring_sockopts(td, res[j]))
+				goto err;
+		}
+	}
+
+	reset_all_stats(td);
+	td_set_runstate(td, state);
+	return 0;
+err:
+	td_set_runstate(td, state);
+	return 1;
+}
+
+static int fio_nuring_open_file(struct thread_data *td, struct fio_file *f)
+{
+	struct nuring_data *ld = td->io_ops_data;
+	struct nuring_options *o = td->eo;
+	unsigned int i;
+	int *res, ret;
+
+	for (i = 0; i < ld->nr_conns; i++) {
+		memset(&ld->conns[i], 0, sizeof(ld->conns[i]));
+		ld->conns[i].fd = -1;
+		ld->conns[i].lat_min = -1ULL;
+	}
+
+	res = calloc(ld->sq_entries, sizeof(int));
+	if (is_udp(o) && o->listen) {
+		ld->conns[0].fd = ld->listenfd;
+		ret = 0;
+	} else if (o->listen)
+		ret = fio_nuring_accept(td, res);
+	else
+		ret = fio_nuring_connect(td, res);
+	free(res);
+
+	if (ret)
+		return ret;
+
+	ld->open_conns = ld->nr_conns;
+	ld->next_conn = 0;
+	f->fd = ld->conns[0].fd;
+	return 0;
+}
+
+static int fio_nuring_close_file(struct thread_data *td, struct fio_file *f)
+{
+	struct nuring_data *ld = td->io_ops_data;
+	struct nuring_options *o = td->eo;
+	unsigned int i;
+
+	for (i = 0; i < ld->nr_conns; i++) {
+		struct nuring_conn *c = &ld->conns[i];
+
+		if (c->fd == -1)
+			continue;
+
+		/* datagrams have no EOF, tell the receiver we're done */
+		if (is_udp(o) && !o->listen) {
+			struct udp_close_msg msg;
+
+			msg.magic = cpu_to_le32((uint32_t) FIO_LINK_OPEN_CLOSE_MAGIC);
+			msg.cmd = cpu_to_le32((uint32_t) FIO_LINK_CLOSE);
+			if (send(c->fd, &msg, sizeof(msg), 0) < 0)
+				td_verror(td, errno, "send udp link close");
+		}
+
+		/* the UDP receiver shares the listen socket */
+		if (c->fd != ld->listenfd)
+			close(c->fd);
+		c->fd = -1;
+	}
+
+	f->fd = -1;
+	return 0;
+}
+
+static int is_close_msg(struct io_u *io_u, int len)
+{
+	struct udp_close_msg *msg;
+
+	if (len != sizeof(struct udp_close_msg))
+		return 0;
+
+	msg = io_u->xfer_buf;
+	if (le32_to_cpu(msg->magic) != FIO_LINK_OPEN_CLOSE_MAGIC)
+		return 0;
+	if (le32_to_cpu(msg->cmd) != FIO_LINK_CLOSE)
+		return 0;
+
+	return 1;
+}
+
+static struct io_u *fio_nuring_event(struct thread_data *td, int event)
+{
+	struct nuring_data *ld = td->io_ops_data;
+
+	return ld->events[event];
+}
+
+static void fio_nuring_result(struct io_u *io_u, int res)
+{
+	if (res != io_u->xfer_buflen) {
+		if (res > io_u->xfer_buflen)
+			io_u->error = -res;
+		else if (res < 0)
+			io_u->error = -res;
+		else
+			io_u->resid = io_u->xfer_buflen - res;
+	} else
+		io_u->error = 0;
+}
+
+/*
+ * Account a completed request to its connection. A connection the peer
+ * closed completes its request without data; once all are closed the
+ * job is done.
+ */
+static void fio_nuring_complete(struct thread_data *td, struct io_u *io_u,
+				const struct timespec *now)
+{
+	struct nuring_data *ld = td->io_ops_data;
+	struct nuring_options *o = td->eo;
+	struct nuring_io *io = &ld->ios[io_u->index];
+	struct nuring_conn *c = &ld->conns[io->conn];
+	uint64_t lat;
+
+	c->busy[io_u->ddir]--;
+	if (o->pingpong)
+		c->busy[io_u->ddir ^ 1]--;
+
+	if (io->eof) {
+		io_u->error = 0;
+		io_u->resid = io_u->xfer_buflen;
+		if (!c->closed) {
+			c->closed = 1;
+			if (!--ld->open_conns)
+				td->done = 1;
+		}
+		return;
+	}
+	if (io_u->error || io_u->resid == io_u->xfer_buflen)
+		return;
+
+	lat = ntime_since(&io->start, now);
+	c->ios++;
+	c->bytes += io_u->xfer_buflen - io_u->resid;
+	c->lat_sum += lat;
+	if (lat < c->lat_min)
+		c->lat_min = lat;
+	if (lat > c->lat_max)
+		c->lat_max = lat;
+}
+
+static int fio_nuring_cqring_reap(struct thread_data *td, unsigned int events,
+				  unsigned int max)
+{
+	struct nuring_data *ld = td->io_ops_data;
+	struct nuring_options *o = td->eo;
+	struct io_cq_ring *ring = &ld->cq_ring;
+	unsigned head, tail, reaped = 0;
+	struct timespec now;
+
+	head = *ring->head;
+	tail = *ring->tail;
+	read_barrier();
+
+	if (head == tail)
+		return 0;
+
+	fio_gettime(&now, NULL);
+
+	while (head != tail && events + reaped < max) {
+		struct io_uring_cqe *cqe = &ring->cqes[head & ld->cq_ring_mask];
+		unsigned long data = cqe->user_data;
+		struct io_u *io_u;
+		struct nuring_io *io;
+		int res = cqe->res;
+		bool recv;
+
+		io_u = (struct io_u *) (uintptr_t) (data & ~NURING_CHAIN_MASK);
+		io = &ld->ios[io_u->index];
+		head++;
+
+		/* the reply of a pingpong goes the other way */
+		recv = io_u->ddir == DDIR_READ;
+		if (data & NURING_CHAIN_TAIL)
+			recv = !recv;
+
+		if ((recv && !res) || res == -ECONNRESET || res == -EPIPE ||
+		    (recv && is_udp(o) && is_close_msg(io_u, res)))
+			io->eof = 1;
+
+		/*
+		 * Nobody listening on the other end yet, the datagram is lost
+		 * and the io_u goes out again.
+		 */
+		if (!recv && is_udp(o) && res == -ECONNREFUSED)
+			res = 0;
+
+		if (data & NURING_CHAIN_HEAD) {
+			if (!io->eof)
+				fio_nuring_result(io_u, res);
+			continue;
+		} else if (data & NURING_CHAIN_TAIL) {
+			/* a failed request cancels its reply, keep its error */
+			if (!io_u->error && res < 0)
+				io_u->error = -res;
+		} else
+			fio_nuring_result(io_u, res);
+
+		fio_nuring_complete(td, io_u, &now);
+		ld->events[events + reaped++] = io_u;
+	}
+
+	*ring->head = head;
+	write_barrier();
+	return reaped;
+}
+
+static int fio_nuring_getevents(struct thread_data *td, unsigned int min,
+				unsigned int max, const struct timespec *t)
+{
+	struct nuring_data *ld = td->io_ops_data;
+	unsigned actual_min = td->o.iodepth_batch_complete_min == 0 ? 0 : min;
+	unsigned events = 0;
+	int r;
+
+	do {
+		r = fio_nuring_cqring_reap(td, events, max);
+		if (r) {
+			events += r;
+			if (actual_min != 0)
+				actual_min -= r;
+			continue;
+		}
+
+		r = io_uring_enter(ld, 0, actual_min, IORING_ENTER_GETEVENTS);
+		if (r < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			td_verror(td, errno, "io_uring_enter");
+			break;
+		}
+	} while (events < min);
+
+	return r < 0 ? r : events;
+}
+
+/*
+ * Pick the next connection with no request in flight in this direction,
+ * round robin. A TCP stream carries one request per direction at a time,
+ * datagram sockets take any number.
+ */
+static int fio_nuring_pick_conn(struct thread_data *td, enum fio_ddir ddir)
+{
+	struct nuring_data *ld = td->io_ops_data;
+	struct nuring_options *o = td->eo;
+	unsigned int i, n = ld->next_conn;
+
+	for (i = 0; i < ld->nr_conns; i++) {
+		struct nuring_conn *c = &ld->conns[n];
+
+		if (++n == ld->nr_conns)
+			n = 0;
+		if (c->closed)
+			continue;
+		if (!is_udp(o) && (c->busy[ddir] ||
+		    (o->pingpong && c->busy[ddir ^ 1])))
+			continue;
+
+		ld->next_conn = n;
+		return c - ld->conns;
+	}
+
+	return -1;
+}
+
+static void fio_nuring_prep(struct thread_data *td, struct io_u *io_u,
+			    struct io_uring_sqe *sqe, enum fio_ddir ddir,
+			    int fd)
+{
+	if (ddir == DDIR_WRITE) {
+		nuring_prep_sqe(sqe, IORING_OP_SEND, fd, io_u->xfer_buf,
+				io_u->xfer_buflen);
+		sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+	} else {
+		nuring_prep_sqe(sqe, IORING_OP_RECV, fd, io_u->xfer_buf,
+				io_u->xfer_buflen);
+		sqe->msg_flags = MSG_WAITALL;
+	}
+}
+
+static enum fio_q_status fio_nuring_queue(struct thread_data *td,
+					  struct io_u *io_u)
+{
+	struct nuring_data *ld = td->io_ops_data;
+	struct nuring_options *o = td->eo;
+	struct io_sq_ring *ring = &ld->sq_ring;
+	struct nuring_io *io = &ld->ios[io_u->index];
+	struct io_uring_sqe *sqe;
+	unsigned tail, nr = o->pingpong ? 2 : 1;
+	struct nuring_conn *c;
+	int conn;
+
+	fio_ro_check(td, io_u);
+
+	if (!ddir_rw(io_u->ddir)) {
+		io_u_mark_submit(td, 1);
+		io_u_mark_complete(td, 1);
+		return FIO_Q_COMPLETED;
+	}
+
+	tail = *ring->tail;
+	read_barrier();
+	if (tail + nr - *ring->head > *ring->ring_entries)
+		return FIO_Q_BUSY;
+
+	conn = fio_nuring_pick_conn(td, io_u->ddir);
+	if (conn < 0) {
+		if (!ld->open_conns)
+			td->done = 1;
+		return FIO_Q_BUSY;
+	}
+
+	c = &ld->conns[conn];
+	c->busy[io_u->ddir]++;
+	io->conn = conn;
+	io->eof = 0;
+
+	sqe = &ld->sqes[io_u->index];
+	fio_nuring_prep(td, io_u, sqe, io_u->ddir, c->fd);
+	sqe->user_data = (unsigned long) io_u;
+	ring->array[tail & ld->sq_ring_mask] = io_u->index;
+
+	if (o->pingpong) {
+		c->busy[io_u->ddir ^ 1]++;
+		sqe->flags |= IOSQE_IO_LINK;
+		sqe->user_data |= NURING_CHAIN_HEAD;
+
+		sqe = &ld->sqes[td->o.iodepth + io_u->index];
+		fio_nuring_prep(td, io_u, sqe, io_u->ddir ^ 1, c->fd);
+		sqe->user_data = (unsigned long) io_u | NURING_CHAIN_TAIL;
+		ring->array[(tail + 1) & ld->sq_ring_mask] =
+						td->o.iodepth + io_u->index;
+	}
+
+	write_barrier();
+	*ring->tail = tail + nr;
+	write_barrier();
+
+	ld->queued += nr;
+	return FIO_Q_QUEUED;
+}
+
+/*
+ * Account the nr entries submitted from start. Returns how many of them were
+ * io_us, the reply of a pingpong is not.
+ */
+static int fio_nuring_queued(struct thread_data *td, int start, int nr)
+{
+	struct nuring_data *ld = td->io_ops_data;
+	struct io_sq_ring *ring = &ld->sq_ring;
+	bool issue_time = fio_fill_issue_time(td);
+	struct timespec now;
+	int io_us = 0;
+
+	fio_gettime(&now, NULL);
+
+	while (nr--) {
+		int index = ring->array[start & ld->sq_ring_mask];
+		struct io_u *io_u;
+
+		start++;
+
+		/* the reply of a pingpong, accounted with its request */
+		if (index >= td->o.iodepth)
+			continue;
+
+		io_us++;
+		io_u = ld->io_u_index[index];
+		ld->ios[index].start = now;
+		if (issue_time) {
+			memcpy(&io_u->issue_time, &now, sizeof(now));
+			io_u_queued(td, io_u);
+		}
+	}
+
+	return io_us;
+}
+
+static int fio_nuring_commit(struct thread_data *td)
+{
+	struct nuring_data *ld = td->io_ops_data;
+	int ret, nr;
+
+	if (!ld->queued)
+		return 0;
+
+	do {
+		unsigned start = *ld->sq_ring.head;
+
+		ret = io_uring_enter(ld, ld->queued, 0,
+					IORING_ENTER_GETEVENTS);
+		if (ret > 0) {
+			nr = fio_nuring_queued(td, start, ret);
+			if (nr)
+				io_u_mark_submit(td, nr);
+
+			ld->queued -= ret;
+			ret = 0;
+		} else if (!ret) {
+			continue;
+		} else {
+			if (errno == EAGAIN || errno == EINTR) {
+				ret = fio_nuring_cqring_reap(td, 0, ld->queued);
+				if (ret)
+					continue;
+				/* Shouldn't happen */
+				usleep(1);
+				continue;
+			}
+			td_verror(td, errno, "io_uring_enter submit");
+			break;
+		}
+	} while (ld->queued);
+
+	return ret;
+}
+
+static void fio_nuring_show_stats(struct thread_data *td)
+{
+	struct nuring_data *ld = td->io_ops_data;
+	struct nuring_options *o = td->eo;
+	uint64_t ios_min = -1ULL, ios_max = 0, ios = 0, lat_sum = 0;
+	double avg, avg_min = 0, avg_max = 0;
+	unsigned int i, active = 0;
+
+	for (i = 0; i < ld->nr_conns; i++) {
+		struct nuring_conn *c = &ld->conns[i];
+
+		if (c->ios < ios_min)
+			ios_min = c->ios;
+		if (c->ios > ios_max)
+			ios_max = c->ios;
+		if (!c->ios)
+			continue;
+
+		ios += c->ios;
+		lat_sum += c->lat_sum;
+
+		avg = (double) c->lat_sum / c->ios / 1000.0;
+		if (!active++ || avg < avg_min)
+			avg_min = avg;
+		if (avg > avg_max)
+			avg_max = avg;
+
+		if (o->conn_stats)
+			log_info("net_uring: %s: conn %u: ios=%llu, "
+				"bytes=%llu, lat (usec): min=%.1f, avg=%.1f, "
+				"max=%.1f\n", td->o.name, i,
+				(unsigned long long) c->ios,
+				(unsigned long long) c->bytes,
+				c->lat_min / 1000.0, avg, c->lat_max / 1000.0);
+	}
+
+	if (!ios || !o->conn_stats)
+		return;
+
+	log_info("net_uring: %s: %u connections, ios per connection "
+		"min=%llu, max=%llu, mean latency (usec) %.1f, per "
+		"connection min=%.1f, max=%.1f\n", td->o.name, ld->nr_conns,
+		(unsigned long long) ios_min, (unsigned long long) ios_max,
+		(double) lat_sum / ios / 1000.0, avg_min, avg_max);
+}
+
+static void fio_nuring_unmap(struct nuring_data *ld)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(ld->mmap); i++)
+		munmap(ld->mmap[i].ptr, ld->mmap[i].len);
+	close(ld->ring_fd);
+}
+
+static void fio_nuring_cleanup(struct thread_data *td)
+{
+	struct nuring_data *ld = td->io_ops_data;
+
+	if (ld) {
+		fio_nuring_show_stats(td);
+
+		if (!(td->flags & TD_F_CHILD))
+			fio_nuring_unmap(ld);
+		if (ld->listenfd != -1)
+			close(ld->listenfd);
+
+		free(ld->io_u_index);
+		free(ld->events);
+		free(ld->ios);
+		free(ld->conns);
+		free(ld);
+	}
+}
+
+static int fio_nuring_mmap(struct nuring_data *ld, struct io_uring_params *p)
+{
+	struct io_sq_ring *sring = &ld->sq_ring;
+	struct io_cq_ring *cring = &ld->cq_ring;
+	void *ptr;
+
+	ld->mmap[0].len = p->sq_off.array + p->sq_entries * sizeof(__u32);
+	ptr = mmap(0, ld->mmap[0].len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ld->ring_fd,
+			IORING_OFF_SQ_RING);
+	ld->mmap[0].ptr = ptr;
+	sring->head = ptr + p->sq_off.head;
+	sring->tail = ptr + p->sq_off.tail;
+	sring->ring_mask = ptr + p->sq_off.ring_mask;
+	sring->ring_entries = ptr + p->sq_off.ring_entries;
+	sring->flags = ptr + p->sq_off.flags;
+	sring->array = ptr + p->sq_off.array;
+	ld->sq_ring_mask = *sring->ring_mask;
+	ld->sq_entries = p->sq_entries;
+
+	ld->mmap[1].len = p->sq_entries * sizeof(struct io_uring_sqe);
+	ld->sqes = mmap(0, ld->mmap[1].len, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ld->ring_fd,
+				IORING_OFF_SQES);
+	ld->mmap[1].ptr = ld->sqes;
+
+	ld->mmap[2].len = p->cq_off.cqes +
+				p->cq_entries * sizeof(struct io_uring_cqe);
+	ptr = mmap(0, ld->mmap[2].len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ld->ring_fd,
+			IORING_OFF_CQ_RING);
+	ld->mmap[2].ptr = ptr;
+	cring->head = ptr + p->cq_off.head;
+	cring->tail = ptr + p->cq_off.tail;
+	cring->ring_mask = ptr + p->cq_off.ring_mask;
+	cring->ring_entries = ptr + p->cq_off.ring_entries;
+	cring->cqes = ptr + p->cq_off.cqes;
+	ld->cq_ring_mask = *cring->ring_mask;
+	return 0;
+}
+
+static int fio_nuring_queue_init(struct thread_data *td)
+{
+	struct nuring_data *ld = td->io_ops_data;
+	struct nuring_options *o = td->eo;
+	struct io_uring_params p;
+	int ret;
+
+	memset(&p, 0, sizeof(p));
+
+	/* pingpong exchanges take a second SQE per io_u */
+	ret = syscall(__NR_io_uring_setup,
+			o->pingpong ? 2 * td->o.iodepth : td->o.iodepth, &p);
+	if (ret < 0)
+		return ret;
+
+	ld->ring_fd = ret;
+	return fio_nuring_mmap(ld, &p);
+}
+
+static int fio_nuring_post_init(struct thread_data *td)
+{
+	int err;
+
+	err = fio_nuring_queue_init(td);
+	if (err) {
+		td_verror(td, errno, "io_queue_init");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int fio_nuring_setup_connect(struct thread_data *td)
+{
+	struct nuring_data *ld = td->io_ops_data;
+	struct nuring_options *o = td->eo;
+	struct addrinfo hints, *res;
+	const char *host = td->o.filename;
+	int ret;
+
+	if (!host) {
+		log_err("fio: connect with no host to connect to.\n");
+		if (td_read(td))
+			log_err("fio: did you forget to set 'listen'?\n");
+
+		td_verror(td, EINVAL, "no hostname= set");
+		return 1;
+	}
+
+	ld->addr.sin_family = AF_INET;
+	ld->addr.sin_port = htons(o->port);
+	ld->addr6.sin6_family = AF_INET6;
+	ld->addr6.sin6_port = htons(o->port);
+
+	if (!is_ipv6(o) && inet_pton(AF_INET, host, &ld->addr.sin_addr))
+		return 0;
+	if (is_ipv6(o) && inet_pton(AF_INET6, host, &ld->addr6.sin6_addr))
+		return 0;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = is_udp(o) ? SOCK_DGRAM : SOCK_STREAM;
+	hints.ai_family = is_ipv6(o) ? AF_INET6 : AF_INET;
+
+	ret = getaddrinfo(host, NULL, &hints, &res);
+	if (ret) {
+		int e = EINVAL;
+		char str[128];
+
+		if (ret == EAI_SYSTEM)
+			e = errno;
+
+		snprintf(str, sizeof(str), "getaddrinfo: %s", gai_strerror(ret));
+		td_verror(td, e, str);
+		return 1;
+	}
+
+	if (is_ipv6(o))
+		ld->addr6.sin6_addr = ((struct sockaddr_in6 *) res->ai_addr)->sin6_addr;
+	else
+		ld->addr.sin_addr = ((struct sockaddr_in *) res->ai_addr)->sin_addr;
+
+	freeaddrinfo(res);
+	return 0;
+}
+
+static int fio_nuring_setup_listen(struct thread_data *td)
+{
+	struct nuring_data *ld = td->io_ops_data;
+	struct nuring_options *o = td->eo;
+	struct sockaddr *saddr;
+	int fd, opt;
+	socklen_t len;
+
+	fd = socket(is_ipv6(o) ? AF_INET6 : AF_INET,
+			is_udp(o) ? SOCK_DGRAM : SOCK_STREAM, 0);
+	if (fd < 0) {
+		td_verror(td, errno, "socket");
+		return 1;
+	}
+
+	opt = 1;
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (void *) &opt, sizeof(opt)) < 0) {
+		td_verror(td, errno, "setsockopt");
+		close(fd);
+		return 1;
+	}
+
+	ld->addr.sin_family = AF_INET;
+	ld->addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	ld->addr.sin_port = htons(o->port);
+	ld->addr6.sin6_family = AF_INET6;
+	ld->addr6.sin6_addr = in6addr_any;
+	ld->addr6.sin6_port = htons(o->port);
+
+	saddr = nuring_addr(td, &len);
+	if (bind(fd, saddr, len) < 0) {
+		close(fd);
+		td_verror(td, errno, "bind");
+		return 1;
+	}
+
+	if (!is_udp(o) && listen(fd, ld->nr_conns) < 0) {
+		close(fd);
+		td_verror(td, errno, "listen");
+		return 1;
+	}
+
+	ld->listenfd = fd;
+	return 0;
+}
+
+static int fio_nuring_init(struct thread_data *td)
+{
+	struct nuring_options *o = td->eo;
+	struct nuring_data *ld;
+
+	if (td_random(td)) {
+		log_err("fio: network IO can't be random\n");
+		return 1;
+	}
+	if (!o->port) {
+		log_err("fio: network IO requires port for tcp or udp\n");
+		return 1;
+	}
+
+	o->port += td->subjob_number;
+
+	/* with both directions, both ends could end up waiting to receive */
+	if (td_rw(td)) {
+		log_err("fio: network connections must be read OR write\n");
+		return 1;
+	}
+
+	if (is_udp(o)) {
+		if (o->listen) {
+			log_err("fio: listen only valid for TCP proto IO\n");
+			return 1;
+		}
+		if (o->pingpong) {
+			log_err("fio: pingpong only valid for TCP proto IO\n");
+			return 1;
+		}
+		o->listen = td_read(td);
+	}
+
+	ld = calloc(1, sizeof(*ld));
+	ld->listenfd = -1;
+
+	/* received datagrams all arrive on the one bound socket */
+	ld->nr_conns = o->connections;
+	if (is_udp(o) && o->listen)
+		ld->nr_conns = 1;
+
+	ld->io_u_index = calloc(td->o.iodepth, sizeof(struct io_u *));
+	ld->events = calloc(td->o.iodepth, sizeof(struct io_u *));
+	ld->ios = calloc(td->o.iodepth, sizeof(struct nuring_io));
+	ld->conns = calloc(ld->nr_conns, sizeof(struct nuring_conn));
+
+	td->io_ops_data = ld;
+
+	if (o->listen)
+		return fio_nuring_setup_listen(td);
+
+	return fio_nuring_setup_connect(td);
+}
+
+static int fio_nuring_io_u_init(struct thread_data *td, struct io_u *io_u)
+{
+	struct nuring_data *ld = td->io_ops_data;
+
+	ld->io_u_index[io_u->index] = io_u;
+	return 0;
+}
+
+static int fio_nuring_setup(struct thread_data *td)
+{
+	if (!td->files_index) {
+		add_file(td, td->o.filename ?: "net", 0, 0);
+		td->o.nr_files = td->o.nr_files ?: 1;
+		td->o.open_files++;
+	}
+
+	return 0;
+}
+
+static void fio_nuring_terminate(struct thread_data *td)
+{
+	kill(td->pid, SIGTERM);
+}
+
+static struct ioengine_ops ioengine = {
+	.name			= "net_uring",
+	.version		= FIO_IOOPS_VERSION,
+	.setup			= fio_nuring_setup,
+	.init			= fio_nuring_init,
+	.post_init		= fio_nuring_post_init,
+	.io_u_init		= fio_nuring_io_u_init,
+	.queue			= fio_nuring_queue,
+	.commit			= fio_nuring_commit,
+	.getevents		= fio_nuring_getevents,
+	.event			= fio_nuring_event,
+	.cleanup		= fio_nuring_cleanup,
+	.open_file		= fio_nuring_open_file,
+	.close_file		= fio_nuring_close_file,
+	.terminate		= fio_nuring_terminate,
+	.options		= options,
+	.option_struct_size	= sizeof(struct nuring_options),
+	.flags			= FIO_DISKLESSIO | FIO_UNIDIR | FIO_PIPEIO |
+				  FIO_BIT_BASED,
+};
+
+static int str_hostname_cb(void *data, const char *input)
+{
+	struct nuring_options *o = data;
+
+	if (o->td->o.filename)
+		free(o->td->o.filename);
+	o->td->o.filename = strdup(input);
+	return 0;
+}
+
+static void fio_init fio_nuring_register(void)
+{
+	register_ioengine(&ioengine);
+}
+
+static void fio_exit fio_nuring_unregister(void)
+{
+	unregister_ioengine(&ioengine);
+}
+#endif
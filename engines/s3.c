@@ -5,37 +5,200 @@
 
 #include "s3_worker.h"
 
+// Default pool size of the s3_async client
+#define S3_ASYNC_DEF_CONNECTIONS	16U
+
 static int s3_common_init()
 {
 	s3_init();
 	return 0;
 }
 
-static struct s3_config global_s3_config;
+struct s3_options {
+	struct gas_options gas;
+	struct s3_config s3;
+	char *prefix;
+};
+
+/**
+ * The options of the job a request belongs to
+ */
+static struct s3_config *gas_io_config(struct gas_io *gas_io)
+{
+	return &container_of(gas_io->gas_data->o, struct s3_options, gas)->s3;
+}
 
 /**
  * S3 options definitions
  */
 struct fio_option s3_options[] = {
+	GAS_OPTIONS(struct s3_options)
 	{
 		.name	= "s3_region",
 		.lname	= "AWS Region, e.g. 'us-west-2'",
 		.type	= FIO_OPT_STR_STORE,
-		.off1   = offsetof(struct s3_config, region),
+		.off1   = offsetof(struct s3_options, s3.region),
 		.help	= "Which region to use",
 		.category = FIO_OPT_C_ENGINE,
 		.group	= FIO_OPT_G_GAS,
 	},
+	{
+		.name	= "s3_endpoint",
+		.lname	= "S3 endpoint",
+		.type	= FIO_OPT_STR_STORE,
+		.off1	= offsetof(struct s3_options, s3.endpoint),
+		.help	= "Host[:port] of an S3 compatible store, instead of AWS",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_GAS,
+	},
+	{
+		.name	= "s3_use_path_style",
+		.lname	= "S3 path-style addressing",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct s3_options, s3.use_path_style),
+		.def	= "0",
+		.help	= "Put the bucket in the URL path instead of the host name",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_GAS,
+	},
+	{
+		.name	= "s3_scheme",
+		.lname	= "S3 scheme",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct s3_options, s3.use_https),
+		.def	= "https",
+		.help	= "Protocol used to reach the endpoint",
+		.posval = {
+			  { .ival = "https",
+			    .oval = 1,
+			  },
+			  { .ival = "http",
+			    .oval = 0,
+			  },
+		},
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_GAS,
+	},
+	{
+		.name	= "s3_credentials",
+		.lname	= "S3 credentials source",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct s3_options, s3.credentials),
+		.def	= "default",
+		.help	= "Where to get AWS credentials from",
+		.posval = {
+			  { .ival = "default",
+			    .oval = S3_CREDENTIALS_DEFAULT,
+			    .help = "SDK default provider chain",
+			  },
+			  { .ival = "env",
+			    .oval = S3_CREDENTIALS_ENV,
+			    .help = "AWS_ACCESS_KEY_ID and AWS_SECRET_ACCESS_KEY",
+			  },
+			  { .ival = "profile",
+			    .oval = S3_CREDENTIALS_PROFILE,
+			    .help = "Profile of the AWS config files, see s3_profile",
+			  },
+			  { .ival = "anonymous",
+			    .oval = S3_CREDENTIALS_ANONYMOUS,
+			    .help = "Unsigned requests",
+			  },
+		},
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_GAS,
+	},
+	{
+		.name	= "s3_profile",
+		.lname	= "S3 credentials profile",
+		.type	= FIO_OPT_STR_STORE,
+		.off1	= offsetof(struct s3_options, s3.profile),
+		.help	= "Profile name for s3_credentials=profile",
+		.parent	= "s3_credentials",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_GAS,
+	},
+	{
+		.name	= "s3_prefix",
+		.lname	= "S3 object prefix",
+		.type	= FIO_OPT_STR_STORE,
+		.off1	= offsetof(struct s3_options, prefix),
+		.help	= "Use all objects under bucket[/prefix] as the job's files",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_GAS,
+	},
 	{
 		.name	= "s3_verbose",
 		.lname	= "S3 verbose logging",
 		.type	= FIO_OPT_INT,
 		.def    = 0,
-		.off1	= offsetof(struct s3_config, verbose),
+		.off1	= offsetof(struct s3_options, s3.verbose),
 		.help	= "Enables extra logging for S3 access",
 		.category = FIO_OPT_C_ENGINE,
 		.group	= FIO_OPT_G_GAS,
 	},
+	{
+		.name	= "s3_part_size",
+		.lname	= "S3 multipart upload part size",
+		.type	= FIO_OPT_STR_VAL,
+		.off1	= offsetof(struct s3_options, s3.part_size),
+		.def	= "0",
+		.help	= "Upload writes larger than this in parts (0 disables multipart upload)",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_GAS,
+	},
+	{
+		.name	= "s3_part_parallelism",
+		.lname	= "S3 multipart upload parallelism",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct s3_options, s3.part_parallelism),
+		.def	= "4",
+		.minval	= 1,
+		.help	= "Number of parts of one write uploaded concurrently",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_GAS,
+	},
+	{
+		.name	= "s3_async",
+		.lname	= "S3 async client",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct s3_options, s3.async),
+		.def	= "0",
+		.help	= "Use one async client per job instead of blocking GAS workers",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_GAS,
+	},
+	{
+		.name	= "s3_max_connections",
+		.lname	= "S3 max connections",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct s3_options, s3.max_connections),
+		.def	= "0",
+		.help	= "Connection pool size of a client (0 means SDK default, or 16 with s3_async)",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_GAS,
+	},
+	{
+		.name	= "s3_request_timeout",
+		.lname	= "S3 request timeout",
+		.type	= FIO_OPT_STR_VAL_TIME,
+		.off1	= offsetof(struct s3_options, s3.request_timeout),
+		.is_time = 1,
+		.def	= "0",
+		.help	= "SDK request timeout (0 means SDK default)",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_GAS,
+	},
+	{
+		.name	= "s3_connect_timeout",
+		.lname	= "S3 connect timeout",
+		.type	= FIO_OPT_STR_VAL_TIME,
+		.off1	= offsetof(struct s3_options, s3.connect_timeout),
+		.is_time = 1,
+		.def	= "0",
+		.help	= "SDK connect timeout (0 means SDK default)",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_GAS,
+	},
 	{
 		.name	= NULL,
 	},
@@ -44,13 +207,48 @@ struct fio_option s3_options[] = {
 static void perform_work(void *arg)
 {
 	struct gas_io *gas_io = (struct gas_io *) arg;
+	struct s3_config *cfg = gas_io_config(gas_io);
 
 	struct io_u *io_u = gas_io->io_u;
 
-	int res = s3_read(&global_s3_config, &gas_io->backend_data, io_u->file->file_name, io_u->offset,
-			  io_u->xfer_buflen);
+	int res;
 
-	io_u->error = -res;
+	if (io_u->ddir == DDIR_WRITE)
+		res = s3_write(cfg, &gas_io->backend_data, io_u->file->file_name,
+			       io_u->xfer_buf, io_u->xfer_buflen, &gas_io->cancelled);
+	else
+		res = s3_read(cfg, &gas_io->backend_data, io_u->file->file_name,
+			      io_u->xfer_buf, io_u->offset, io_u->xfer_buflen, &gas_io->cancelled);
+
+	io_u->error = res;
+}
+
+static void s3_async_done(void *arg, int err)
+{
+	struct gas_io *gas_io = arg;
+
+	gas_io->io_u->error = err;
+	gas_complete(gas_io);
+}
+
+/**
+ * s3_async: starts the request on the job's shared client, which
+ * completes it from its own threads
+ */
+static int s3_submit(struct gas_io *gas_io)
+{
+	void *client = gas_io->gas_data->backend_data;
+	struct s3_config *cfg = gas_io_config(gas_io);
+	struct io_u *io_u = gas_io->io_u;
+
+	if (io_u->ddir == DDIR_WRITE)
+		return s3_write_async(client, cfg, io_u->file->file_name,
+				      io_u->xfer_buf, io_u->xfer_buflen, &gas_io->cancelled,
+				      s3_async_done, gas_io);
+
+	return s3_read_async(client, cfg, io_u->file->file_name,
+			     io_u->xfer_buf, io_u->offset, io_u->xfer_buflen,
+			     &gas_io->cancelled, s3_async_done, gas_io);
 }
 
 static int s3_open_file(struct thread_data *td, struct fio_file *f)
@@ -65,27 +263,170 @@ static int s3_close_file(struct thread_data *td, struct fio_file *f)
 	return 0;
 }
 
+/**
+ * Sizes come from HeadObject. Objects that don't exist yet (e.g. to be
+ * written) are left with an unknown size, so size= is needed for them.
+ */
+static int s3_get_file_size(struct thread_data *td, struct fio_file *f)
+{
+	struct s3_config *cfg = &((struct s3_options *) td->eo)->s3;
+	unsigned long long size;
+	int err;
+
+	err = s3_get_size(cfg, f->file_name, &size);
+	if (err == ENOENT)
+		return 0;
+	if (err) {
+		td_verror(td, err, "s3_get_size");
+		return 1;
+	}
+
+	f->real_file_size = size;
+	fio_file_set_size_known(f);
+	return 0;
+}
+
+static void s3_add_object(void *arg, const char *fname, unsigned long long size)
+{
+	struct thread_data *td = arg;
+	struct fio_file *f;
+
+	// Nothing to do I/O to in empty objects, e.g. "directory" markers
+	if (!size) {
+		dprint(FD_FILE, "s3: skipping empty object %s\n", fname);
+		return;
+	}
+
+	f = td->files[add_file(td, fname, 0, 1)];
+	f->real_file_size = size;
+	fio_file_set_size_known(f);
+}
+
+/**
+ * Drops the files fio made up from the job name, s3_prefix replaces them
+ */
+static void s3_drop_files(struct thread_data *td)
+{
+	struct fio_file *f;
+	unsigned int i;
+
+	for_each_file(td, f, i) {
+		sfree(f->file_name);
+		sfree(f);
+	}
+
+	free(td->files);
+	free(td->file_locks);
+	td->files = NULL;
+	td->file_locks = NULL;
+	td->files_index = 0;
+	td->files_size = 0;
+	td->o.nr_files = 0;
+}
+
+static int s3_setup(struct thread_data *td)
+{
+	struct s3_options *o = td->eo;
+	struct fio_file *f;
+	unsigned int i;
+	int err;
+
+	// Runs before init with create_serialize, in the main thread
+	s3_common_init();
+
+	if (!o->prefix) {
+		for_each_file(td, f, i) {
+			if (s3_get_file_size(td, f))
+				return 1;
+		}
+		return 0;
+	}
+
+	if (td->o.filename) {
+		log_err("s3: s3_prefix and filename are mutually exclusive\n");
+		return 1;
+	}
+
+	s3_drop_files(td);
+
+	err = s3_list(&o->s3, o->prefix, s3_add_object, td);
+	if (err) {
+		td_verror(td, err, "s3_list");
+		return 1;
+	}
+
+	if (!td->files_index) {
+		log_err("s3: no objects under %s\n", o->prefix);
+		return 1;
+	}
+
+	dprint(FD_FILE, "s3: %u objects under %s\n", td->files_index, o->prefix);
+	td->o.open_files = td->o.nr_files;
+	return 0;
+}
+
+static int s3_init_shared_client(struct thread_data *td, struct s3_config *cfg)
+{
+	struct gas_data *d;
+
+	if (cfg->part_size) {
+		log_err("s3: s3_part_size is not supported with s3_async\n");
+		return 1;
+	}
+
+	// Every pool thread drives one request, the rest wait in its queue
+	if (!cfg->max_connections)
+		cfg->max_connections = min(td->o.iodepth, S3_ASYNC_DEF_CONNECTIONS);
+
+	// The client's threads run the requests, GAS needs none of its own
+	if (gas_init_callback(td, s3_submit, GAS_CAP_READ | GAS_CAP_WRITE))
+		return 1;
+
+	d = td->io_ops_data;
+	d->backend_data = s3_client_create(cfg, cfg->max_connections);
+
+	return 0;
+}
+
 static int s3_init_async(struct thread_data *td)
 {
+	struct s3_config *cfg = &((struct s3_options *) td->eo)->s3;
+
 	s3_common_init();
-	gas_init_async(td, perform_work);
 
-	// Remember our config
-	global_s3_config = *(struct s3_config*) td->eo;
+	if (cfg->async) {
+		if (s3_init_shared_client(td, cfg))
+			return 1;
+	} else if (gas_init_async(td, perform_work, GAS_CAP_READ | GAS_CAP_WRITE))
+		return 1;
 
 	return 0;
 }
 
+static void s3_cleanup(struct thread_data *td)
+{
+	struct gas_data *d = td->io_ops_data;
+
+	// No client callbacks may touch GAS state once it is gone
+	if (d && d->backend_data)
+		s3_client_destroy(d->backend_data);
+
+	gas_cleanup_async(td);
+}
+
 static struct ioengine_ops s3_ioengine_async = {
 	.name               = "s3",
 	.version            = FIO_IOOPS_VERSION,
 	.init               = s3_init_async,
+	.cleanup            = s3_cleanup,
+	.setup              = s3_setup,
+	.get_file_size      = s3_get_file_size,
 
 	.open_file          = s3_open_file,
 	.close_file         = s3_close_file,
-	.option_struct_size = sizeof(struct s3_config),
+	.option_struct_size = sizeof(struct s3_options),
 	.options            = s3_options,
-	.flags              = FIO_DISKLESSIO | FIO_NODISKUTIL | FIO_FAKEIO
+	.flags              = FIO_DISKLESSIO | FIO_NODISKUTIL
 };
 
 static void fio_init fio_gas_register(void)
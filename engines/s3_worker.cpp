@@ -1,37 +1,121 @@
 #include "s3_worker.h"
 
+#include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 
 #include <aws/core/Aws.h>
+#include <aws/core/auth/AWSAuthSigner.h>
+#include <aws/core/auth/AWSCredentialsProvider.h>
+#include <aws/core/auth/AWSCredentialsProviderChain.h>
+#include <aws/core/utils/stream/PreallocatedStreamBuf.h>
 #include <aws/s3/S3Client.h>
 #include <aws/s3/model/GetObjectRequest.h>
+#include <aws/s3/model/HeadObjectRequest.h>
+#include <aws/s3/model/ListObjectsV2Request.h>
+#include <aws/s3/model/Object.h>
+#include <aws/s3/model/PutObjectRequest.h>
+#include <aws/s3/model/CreateMultipartUploadRequest.h>
+#include <aws/s3/model/UploadPartRequest.h>
+#include <aws/s3/model/CompleteMultipartUploadRequest.h>
+#include <aws/s3/model/AbortMultipartUploadRequest.h>
+#include <aws/s3/model/CompletedMultipartUpload.h>
+#include <aws/s3/model/CompletedPart.h>
 #include <aws/core/client/ClientConfiguration.h>
+#include <aws/core/utils/threading/Executor.h>
+#include <algorithm>
+#include <deque>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
 
-thread_local Aws::S3::S3Client *s3_client = nullptr;
+static const char *ALLOCATION_TAG = "fio-s3";
 
-extern "C"
+// Clients of this thread, by the options they were made from. Jobs with
+// different options may run on the same thread, e.g. setup for all jobs
+// in the main thread, so each gets its own.
+thread_local std::unordered_map<std::string, Aws::S3::S3Client *> s3_clients;
+
+// Splits "bucket/key"
+static void split_name(const char *fname, Aws::String &bucket_name, Aws::String &key_name)
 {
+	const char *slash = strchr(fname, '/');
+	assert(slash);
 
-void s3_init()
+	bucket_name = Aws::String(fname, slash - fname);
+	key_name = slash + 1;
+}
+
+// Applies the job options, zero values keep the SDK defaults
+static void configure_client(struct s3_config *s3_config, Aws::Client::ClientConfiguration &clientConfig)
+{
+	if (s3_config->region) {
+		clientConfig.region = s3_config->region;
+	}
+	if (s3_config->endpoint) {
+		clientConfig.endpointOverride = s3_config->endpoint;
+	}
+	clientConfig.scheme = s3_config->use_https ? Aws::Http::Scheme::HTTPS : Aws::Http::Scheme::HTTP;
+	if (s3_config->max_connections) {
+		clientConfig.maxConnections = s3_config->max_connections;
+	}
+	if (s3_config->request_timeout) {
+		clientConfig.requestTimeoutMs = s3_config->request_timeout / 1000;
+	}
+	if (s3_config->connect_timeout) {
+		clientConfig.connectTimeoutMs = s3_config->connect_timeout / 1000;
+	}
+}
+
+static std::shared_ptr<Aws::Auth::AWSCredentialsProvider> credentials_provider(struct s3_config *s3_config)
 {
-	Aws::SDKOptions options;
-	Aws::InitAPI(options);
+	switch (s3_config->credentials) {
+	case S3_CREDENTIALS_ENV:
+		return Aws::MakeShared<Aws::Auth::EnvironmentAWSCredentialsProvider>(ALLOCATION_TAG);
+	case S3_CREDENTIALS_PROFILE:
+		if (s3_config->profile)
+			return Aws::MakeShared<Aws::Auth::ProfileConfigFileAWSCredentialsProvider>(ALLOCATION_TAG,
+												   s3_config->profile);
+		return Aws::MakeShared<Aws::Auth::ProfileConfigFileAWSCredentialsProvider>(ALLOCATION_TAG);
+	case S3_CREDENTIALS_ANONYMOUS:
+		return Aws::MakeShared<Aws::Auth::AnonymousAWSCredentialsProvider>(ALLOCATION_TAG);
+	default:
+		return Aws::MakeShared<Aws::Auth::DefaultAWSCredentialsProviderChain>(ALLOCATION_TAG);
+	}
 }
 
-int s3_read(struct s3_config *s3_config, void **backend_data, const char *fname, size_t offset, size_t size)
+static Aws::S3::S3Client *new_client(struct s3_config *s3_config,
+				     const Aws::Client::ClientConfiguration &clientConfig)
 {
-	size_t len = strlen(fname) + 1;
-	char *str = alloca(len);
-	memcpy(str, fname, len);
+	// On-prem stores (MinIO, Ceph RGW) usually want bucket names in the path
+	return new Aws::S3::S3Client(credentials_provider(s3_config), clientConfig,
+				     Aws::Client::AWSAuthV4Signer::PayloadSigningPolicy::Never,
+				     !s3_config->use_path_style);
+}
 
-	char *slash = strchr(str, '/');
-	assert(slash);
-	*slash = '\0';
+// Everything of the config that goes into a client
+static std::string client_key(struct s3_config *s3_config)
+{
+	std::ostringstream key;
+
+	key << (s3_config->region ? s3_config->region : "") << '\0'
+	    << (s3_config->endpoint ? s3_config->endpoint : "") << '\0'
+	    << s3_config->use_https << ' ' << s3_config->use_path_style << ' '
+	    << s3_config->credentials << '\0'
+	    << (s3_config->profile ? s3_config->profile : "") << '\0'
+	    << s3_config->max_connections << ' ' << s3_config->request_timeout << ' '
+	    << s3_config->connect_timeout;
 
-	const Aws::String bucket_name = str;
-	const Aws::String key_name = slash + 1;
+	return key.str();
+}
+
+static Aws::S3::S3Client *get_client(struct s3_config *s3_config)
+{
+	Aws::S3::S3Client *&s3_client = s3_clients[client_key(s3_config)];
 
 	if (s3_client == nullptr) {
 		if (s3_config->verbose) {
@@ -40,38 +124,427 @@ int s3_read(struct s3_config *s3_config, void **backend_data, const char *fname,
 		fflush(stdout);
 
 		Aws::Client::ClientConfiguration clientConfig;
-		if (s3_config->region) {
-			clientConfig.region = s3_config->region;
-		}
-		s3_client = new Aws::S3::S3Client(clientConfig);
+		configure_client(s3_config, clientConfig);
+		s3_client = new_client(s3_config, clientConfig);
 	}
 
+	return s3_client;
+}
+
+// A client shared by all requests of a job, see s3_client_create()
+struct s3_shared_client {
+	std::shared_ptr<Aws::Utils::Threading::PooledThreadExecutor> executor;
+	Aws::S3::S3Client *client;
+};
+
+template <typename Error>
+static void print_error(const char *what, const Error &error)
+{
+	std::cout << what << " error: " << error.GetExceptionName() << " " <<
+		  error.GetMessage() << std::endl;
+}
+
+// A stream over the io_u buffer, so the SDK reads and writes it without copies
+class BufferStream : public Aws::IOStream {
+public:
+	BufferStream(const void *buf, size_t size)
+		: Aws::IOStream(nullptr), streambuf((unsigned char *) buf, size)
+	{
+		rdbuf(&streambuf);
+	}
+
+private:
+	Aws::Utils::Stream::PreallocatedStreamBuf streambuf;
+};
+
+// A request body reading straight from the io_u buffer
+class BufferBody {
+public:
+	BufferBody(const void *buf, size_t size)
+		: stream(Aws::MakeShared<BufferStream>(ALLOCATION_TAG, buf, size))
+	{
+	}
+
+	template <typename Request>
+	void attach(Request &request, size_t size)
+	{
+		request.SetBody(stream);
+		request.SetContentLength(size);
+		request.SetContentType("application/octet-stream");
+	}
+
+private:
+	std::shared_ptr<Aws::IOStream> stream;
+};
+
+template <typename Request>
+static void set_cancel_handler(Request &request, const volatile int *cancelled)
+{
+	// Checked by the SDK while transferring, so a stuck request can be given up
+	request.SetContinueRequestHandler([cancelled](const Aws::Http::HttpRequest *) {
+		return !*cancelled;
+	});
+}
+
+// A ranged GET of the object, received straight into buf
+static void init_get_request(Aws::S3::Model::GetObjectRequest &object_request, const char *fname,
+			     void *buf, size_t offset, size_t size, const volatile int *cancelled)
+{
+	Aws::String bucket_name, key_name;
+	split_name(fname, bucket_name, key_name);
+
 	char *range = alloca(1000);
 	sprintf(range, "bytes=%zd-%zd", offset, offset + size - 1);
 
-	Aws::S3::Model::GetObjectRequest object_request;
 	object_request.WithBucket(bucket_name).WithKey(key_name);
 	object_request.SetRange(range);
+	set_cancel_handler(object_request, cancelled);
+	// The SDK writes the body straight into the io_u buffer, and frees the stream
+	object_request.SetResponseStreamFactory([buf, size]() {
+		return Aws::New<BufferStream>(ALLOCATION_TAG, buf, size);
+	});
+}
+
+static int get_object_result(const Aws::S3::Model::GetObjectOutcome &outcome, size_t size,
+			     const volatile int *cancelled)
+{
+	if (outcome.IsSuccess()) {
+		long long received = outcome.GetResult().GetContentLength();
+
+		if (received != (long long) size) {
+			std::cout << "GetObject error: received " << received << " of " << size <<
+				  " bytes" << std::endl;
+			return EIO;
+		}
+		return 0;
+	} else if (*cancelled) {
+		return ECANCELED;
+	} else {
+		print_error("GetObject", outcome.GetError());
+		return EIO;
+	}
+}
+
+static int put_object_result(const Aws::S3::Model::PutObjectOutcome &outcome, const volatile int *cancelled)
+{
+	if (outcome.IsSuccess()) {
+		return 0;
+	} else if (*cancelled) {
+		return ECANCELED;
+	} else {
+		print_error("PutObject", outcome.GetError());
+		return EIO;
+	}
+}
+
+static int put_object(struct s3_config *s3_config, Aws::S3::S3Client *client,
+		      const Aws::String &bucket_name, const Aws::String &key_name,
+		      const void *buf, size_t size, const volatile int *cancelled)
+{
+	BufferBody body(buf, size);
+
+	Aws::S3::Model::PutObjectRequest object_request;
+	object_request.WithBucket(bucket_name).WithKey(key_name);
+	body.attach(object_request, size);
+	set_cancel_handler(object_request, cancelled);
+
+	return put_object_result(client->PutObject(object_request), cancelled);
+}
+
+// Uploads the buffer in parts of part_size, with up to part_parallelism parts in flight
+static int multipart_upload(struct s3_config *s3_config, Aws::S3::S3Client *client,
+			    const Aws::String &bucket_name, const Aws::String &key_name,
+			    const void *buf, size_t size, const volatile int *cancelled)
+{
+	const size_t part_size = s3_config->part_size;
+	const size_t nr_parts = (size + part_size - 1) / part_size;
+	const size_t parallelism = s3_config->part_parallelism ? s3_config->part_parallelism : 1;
+	int err = 0;
+
+	Aws::S3::Model::CreateMultipartUploadRequest create_request;
+	create_request.WithBucket(bucket_name).WithKey(key_name).WithContentType("application/octet-stream");
+
+	auto const &create_outcome = client->CreateMultipartUpload(create_request);
+	if (!create_outcome.IsSuccess()) {
+		print_error("CreateMultipartUpload", create_outcome.GetError());
+		return EIO;
+	}
+	const Aws::String upload_id = create_outcome.GetResult().GetUploadId();
+
+	if (s3_config->verbose) {
+		printf("[%p] Multipart upload %s / %s: %zd parts\n", client, bucket_name.c_str(),
+		       key_name.c_str(), nr_parts);
+	}
+
+	// Bodies must stay alive until their part is done
+	std::vector<std::unique_ptr<BufferBody>> bodies(nr_parts);
+	std::deque<std::pair<size_t, Aws::S3::Model::UploadPartOutcomeCallable>> in_flight;
+	Aws::S3::Model::CompletedMultipartUpload completed;
+	Aws::Vector<Aws::S3::Model::CompletedPart> parts(nr_parts);
+
+	auto wait_oldest = [&]() {
+		size_t part = in_flight.front().first;
+		auto outcome = in_flight.front().second.get();
+
+		in_flight.pop_front();
+		if (outcome.IsSuccess()) {
+			parts[part].WithETag(outcome.GetResult().GetETag()).WithPartNumber(part + 1);
+		} else if (!err) {
+			if (!*cancelled)
+				print_error("UploadPart", outcome.GetError());
+			err = *cancelled ? ECANCELED : EIO;
+		}
+	};
+
+	for (size_t part = 0; part < nr_parts && !err; part++) {
+		const size_t offset = part * part_size;
+		const size_t len = std::min(part_size, size - offset);
+
+		if (in_flight.size() >= parallelism)
+			wait_oldest();
+
+		bodies[part].reset(new BufferBody((const char *) buf + offset, len));
+
+		Aws::S3::Model::UploadPartRequest part_request;
+		part_request.WithBucket(bucket_name).WithKey(key_name).WithUploadId(upload_id)
+			.WithPartNumber(part + 1);
+		bodies[part]->attach(part_request, len);
+		set_cancel_handler(part_request, cancelled);
+
+		in_flight.emplace_back(part, client->UploadPartCallable(part_request));
+	}
+
+	while (!in_flight.empty())
+		wait_oldest();
+
+	if (!err) {
+		completed.SetParts(parts);
+
+		Aws::S3::Model::CompleteMultipartUploadRequest complete_request;
+		complete_request.WithBucket(bucket_name).WithKey(key_name).WithUploadId(upload_id)
+			.WithMultipartUpload(completed);
+
+		auto const &complete_outcome = client->CompleteMultipartUpload(complete_request);
+		if (complete_outcome.IsSuccess())
+			return 0;
+
+		print_error("CompleteMultipartUpload", complete_outcome.GetError());
+		err = EIO;
+	}
+
+	// Don't leave the uploaded parts behind, they are billed
+	Aws::S3::Model::AbortMultipartUploadRequest abort_request;
+	abort_request.WithBucket(bucket_name).WithKey(key_name).WithUploadId(upload_id);
+	client->AbortMultipartUpload(abort_request);
+
+	return err;
+}
+
+extern "C"
+{
+
+void s3_init()
+{
+	static std::once_flag once;
+
+	// Called by every job, and by setup in the main thread before that
+	std::call_once(once, []() {
+		Aws::SDKOptions options;
+		Aws::InitAPI(options);
+	});
+}
+
+int s3_read(struct s3_config *s3_config, void **backend_data, const char *fname, void *buf, size_t offset,
+	    size_t size, const volatile int *cancelled)
+{
+	Aws::S3::S3Client *client = get_client(s3_config);
+
+	Aws::S3::Model::GetObjectRequest object_request;
+	init_get_request(object_request, fname, buf, offset, size, cancelled);
 
 	if (s3_config->verbose) {
-		printf("[%p] Issuing request: %s / %s %zd %zd\n", s3_client, bucket_name.c_str(), key_name.c_str(),
-		       offset, size);
+		printf("[%p] Issuing request: %s %zd %zd\n", client, fname, offset, size);
 	}
 
-	auto const &get_object_outcome = s3_client->GetObject(object_request);
+	auto const &get_object_outcome = client->GetObject(object_request);
 
 	if (s3_config->verbose) {
-		printf("[%p] Done request\n", s3_client);
+		printf("[%p] Done request\n", client);
 	}
 
-	if (get_object_outcome.IsSuccess()) {
+	return get_object_result(get_object_outcome, size, cancelled);
+}
+
+int s3_write(struct s3_config *s3_config, void **backend_data, const char *fname, const void *buf, size_t size,
+	     const volatile int *cancelled)
+{
+	Aws::String bucket_name, key_name;
+	split_name(fname, bucket_name, key_name);
+
+	Aws::S3::S3Client *client = get_client(s3_config);
+
+	if (s3_config->verbose) {
+		printf("[%p] Issuing upload: %s / %s %zd\n", client, bucket_name.c_str(), key_name.c_str(), size);
+	}
+
+	int err;
+	if (s3_config->part_size && size > s3_config->part_size)
+		err = multipart_upload(s3_config, client, bucket_name, key_name, buf, size, cancelled);
+	else
+		err = put_object(s3_config, client, bucket_name, key_name, buf, size, cancelled);
+
+	if (s3_config->verbose) {
+		printf("[%p] Done upload\n", client);
+	}
+
+	return err;
+}
+
+int s3_get_size(struct s3_config *s3_config, const char *fname, unsigned long long *size)
+{
+	Aws::String bucket_name, key_name;
+	split_name(fname, bucket_name, key_name);
+
+	Aws::S3::S3Client *client = get_client(s3_config);
+
+	Aws::S3::Model::HeadObjectRequest head_request;
+	head_request.WithBucket(bucket_name).WithKey(key_name);
+
+	auto const &outcome = client->HeadObject(head_request);
+	if (outcome.IsSuccess()) {
+		*size = outcome.GetResult().GetContentLength();
 		return 0;
+	} else if (outcome.GetError().GetResponseCode() == Aws::Http::HttpResponseCode::NOT_FOUND) {
+		return ENOENT;
+	} else {
+		print_error("HeadObject", outcome.GetError());
+		return EIO;
+	}
+}
+
+int s3_list(struct s3_config *s3_config, const char *prefix,
+	    void (*add)(void *arg, const char *fname, unsigned long long size), void *arg)
+{
+	Aws::String bucket_name, key_prefix;
+	const char *slash = strchr(prefix, '/');
+
+	if (slash) {
+		bucket_name = Aws::String(prefix, slash - prefix);
+		key_prefix = slash + 1;
 	} else {
-		std::cout << "GetObject error: " <<
-			  get_object_outcome.GetError().GetExceptionName() << " " <<
-			  get_object_outcome.GetError().GetMessage() << std::endl;
-		return 1;
+		bucket_name = prefix;
+	}
+
+	Aws::S3::S3Client *client = get_client(s3_config);
+
+	Aws::S3::Model::ListObjectsV2Request list_request;
+	list_request.WithBucket(bucket_name).WithPrefix(key_prefix);
+
+	// Results come in pages of up to 1000 objects
+	for (;;) {
+		auto const &outcome = client->ListObjectsV2(list_request);
+		if (!outcome.IsSuccess()) {
+			print_error("ListObjectsV2", outcome.GetError());
+			return EIO;
+		}
+
+		auto const &result = outcome.GetResult();
+		for (auto const &object : result.GetContents()) {
+			Aws::String fname = bucket_name + "/" + object.GetKey();
+
+			add(arg, fname.c_str(), object.GetSize());
+		}
+
+		if (!result.GetIsTruncated())
+			return 0;
+
+		list_request.SetContinuationToken(result.GetNextContinuationToken());
+	}
+}
+
+void *s3_client_create(struct s3_config *s3_config, unsigned int threads)
+{
+	auto *shared = new s3_shared_client;
+
+	// The SDK runs async requests on the client's executor. The default one
+	// starts a thread per request, a pool keeps deep queues cheap.
+	shared->executor = Aws::MakeShared<Aws::Utils::Threading::PooledThreadExecutor>(ALLOCATION_TAG,
+											 threads);
+
+	Aws::Client::ClientConfiguration clientConfig;
+	configure_client(s3_config, clientConfig);
+	clientConfig.executor = shared->executor;
+	shared->client = new_client(s3_config, clientConfig);
+
+	if (s3_config->verbose) {
+		printf("[%p] Created shared S3Client, %u threads\n", shared->client, threads);
 	}
+
+	return shared;
+}
+
+void s3_client_destroy(void *client_data)
+{
+	auto *shared = (s3_shared_client *) client_data;
+
+	// Joins the executor, so no callback runs after this
+	delete shared->client;
+	shared->executor.reset();
+	delete shared;
+}
+
+int s3_read_async(void *client_data, struct s3_config *s3_config, const char *fname, void *buf,
+		  size_t offset, size_t size, const volatile int *cancelled, s3_done_fn done, void *arg)
+{
+	Aws::S3::S3Client *client = ((s3_shared_client *) client_data)->client;
+
+	Aws::S3::Model::GetObjectRequest object_request;
+	init_get_request(object_request, fname, buf, offset, size, cancelled);
+
+	if (s3_config->verbose) {
+		printf("[%p] Issuing async request: %s %zd %zd\n", client, fname, offset, size);
+	}
+
+	client->GetObjectAsync(object_request,
+		[size, cancelled, done, arg](const Aws::S3::S3Client *,
+					     const Aws::S3::Model::GetObjectRequest &,
+					     const Aws::S3::Model::GetObjectOutcome &outcome,
+					     const std::shared_ptr<const Aws::Client::AsyncCallerContext> &) {
+			done(arg, get_object_result(outcome, size, cancelled));
+		});
+
+	return 0;
+}
+
+int s3_write_async(void *client_data, struct s3_config *s3_config, const char *fname, const void *buf,
+		   size_t size, const volatile int *cancelled, s3_done_fn done, void *arg)
+{
+	Aws::S3::S3Client *client = ((s3_shared_client *) client_data)->client;
+
+	Aws::String bucket_name, key_name;
+	split_name(fname, bucket_name, key_name);
+
+	// The request keeps the body stream alive until it is done
+	BufferBody body(buf, size);
+
+	Aws::S3::Model::PutObjectRequest object_request;
+	object_request.WithBucket(bucket_name).WithKey(key_name);
+	body.attach(object_request, size);
+	set_cancel_handler(object_request, cancelled);
+
+	if (s3_config->verbose) {
+		printf("[%p] Issuing async upload: %s %zd\n", client, fname, size);
+	}
+
+	client->PutObjectAsync(object_request,
+		[cancelled, done, arg](const Aws::S3::S3Client *,
+				       const Aws::S3::Model::PutObjectRequest &,
+				       const Aws::S3::Model::PutObjectOutcome &outcome,
+				       const std::shared_ptr<const Aws::Client::AsyncCallerContext> &) {
+			done(arg, put_object_result(outcome, cancelled));
+		});
+
+	return 0;
 }
 
 }  // extern C
@@ -7,16 +7,70 @@
 extern "C" {
 #endif
 
+// Where credentials come from, s3_credentials option
+enum {
+	S3_CREDENTIALS_DEFAULT = 0,	// SDK provider chain
+	S3_CREDENTIALS_ENV,
+	S3_CREDENTIALS_PROFILE,
+	S3_CREDENTIALS_ANONYMOUS,
+};
+
 struct s3_config {
-	int padding;  // so offset is not zero
 	char *region;
+	char *endpoint;
+	int use_path_style;
+	int use_https;
+	unsigned int credentials;
+	char *profile;
 	int verbose;
+	unsigned long long part_size;
+	unsigned int part_parallelism;
+	int async;
+	unsigned int max_connections;
+	unsigned long long request_timeout;	// usec
+	unsigned long long connect_timeout;	// usec
 };
 
+// Called when an async request is done, with 0 or an errno value
+typedef void (*s3_done_fn)(void *arg, int err);
+
 void s3_init();
 
-// Return 0 on success, 1 on error
-int s3_read(struct s3_config *config, void **backend_data, const char *fname, size_t offset, size_t size);
+// Reads size bytes at offset of the object into buf.
+// Return 0 on success, an errno value on error.
+// The request is aborted once *cancelled becomes non-zero.
+int s3_read(struct s3_config *config, void **backend_data, const char *fname, void *buf, size_t offset,
+	    size_t size, const volatile int *cancelled);
+
+// Replaces the whole object with size bytes of buf, using multipart upload
+// for sizes above part_size. Return 0 on success, an errno value on error.
+int s3_write(struct s3_config *config, void **backend_data, const char *fname, const void *buf, size_t size,
+	     const volatile int *cancelled);
+
+// Stores the size of the object in *size.
+// Return 0 on success, ENOENT if there is no such object, EIO on other errors.
+int s3_get_size(struct s3_config *config, const char *fname, unsigned long long *size);
+
+// Calls add(arg, "bucket/key", size) for every object whose name starts with
+// prefix, given as "bucket" or "bucket/key-prefix".
+// Return 0 on success, an errno value on error.
+int s3_list(struct s3_config *config, const char *prefix,
+	    void (*add)(void *arg, const char *fname, unsigned long long size), void *arg);
+
+// Creates a client shared by the async requests of a job, running them on
+// a pool of 'threads' threads. Release with s3_client_destroy().
+void *s3_client_create(struct s3_config *config, unsigned int threads);
+
+// Waits for the running requests to finish their callbacks
+void s3_client_destroy(void *client);
+
+// Like s3_read() and s3_write(), but return right away and call
+// done(arg, err) from a client thread once the request is over.
+// s3_write_async() doesn't do multipart uploads.
+int s3_read_async(void *client, struct s3_config *config, const char *fname, void *buf, size_t offset,
+		  size_t size, const volatile int *cancelled, s3_done_fn done, void *arg);
+int s3_write_async(void *client, struct s3_config *config, const char *fname, const void *buf, size_t size,
+		   const volatile int *cancelled, s3_done_fn done, void *arg);
 
 #ifdef __cplusplus
 }
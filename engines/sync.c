@@ -10,6 +10,8 @@
 #include <unistd.h>
 #include <sys/uio.h>
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 
 #include "../fio.h"
 #include "../optgroup.h"
@@ -32,14 +34,74 @@ struct syncio_data {
 	enum fio_ddir last_ddir;
 
 	struct frand_state rand_state;
+
+	struct psyncv2_data *v2;
 };
 
 #ifdef FIO_HAVE_PWRITEV2
+
+#ifndef IOV_MAX
+#define IOV_MAX	1024
+#endif
+
+/*
+ * A run of io_us to contiguous offsets of a file, issued with one
+ * preadv2/pwritev2. The io_us are chained through psyncv2_data->next,
+ * in offset order.
+ */
+struct psyncv2_batch {
+	struct flist_head list;
+	struct fio_file *file;
+	enum fio_ddir ddir;
+	int flags;
+	unsigned long long offset;
+	unsigned long long bytes;
+	unsigned long long done;
+	unsigned int nr;
+	struct io_u *head;
+	struct io_u *tail;
+	struct timespec start;
+};
+
+struct psyncv2_data {
+	struct psyncv2_batch *batches;
+	struct psyncv2_batch *open;
+	struct flist_head free_list;
+	struct flist_head pending;
+	unsigned int max_segs;
+
+	/* next io_u of a batch, by io_u index */
+	struct io_u **next;
+
+	/* completed io_us, moved to syncio_data->io_us by getevents */
+	struct io_u **done;
+	unsigned int nr_done;
+
+	/* RWF_NOWAIT misses, finished by the helper threads */
+	pthread_t *threads;
+	unsigned int nr_threads;
+	struct flist_head work;
+	unsigned int inflight;
+	int exit;
+	int nowait;
+
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+
+	uint64_t calls;
+	uint64_t ios;
+	uint64_t partial;
+};
+
 struct psyncv2_options {
 	void *pad;
 	unsigned int hipri;
 	unsigned int hipri_percentage;
 	unsigned int uncached;
+	unsigned int coalesce;
+	unsigned int nowait;
+	unsigned int nowait_threads;
 };
 
 static struct fio_option options[] = {
@@ -73,6 +135,37 @@ static struct fio_option options[] = {
 		.category = FIO_OPT_C_ENGINE,
 		.group	= FIO_OPT_G_INVALID,
 	},
+	{
+		.name	= "coalesce",
+		.lname	= "Coalesce contiguous IO",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct psyncv2_options, coalesce),
+		.def	= "0",
+		.help	= "Issue contiguous io_us with a single preadv2/pwritev2",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "nowait",
+		.lname	= "RWF_NOWAIT",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct psyncv2_options, nowait),
+		.def	= "0",
+		.help	= "Try RWF_NOWAIT first, finish blocking IO in a helper thread",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "nowait_threads",
+		.lname	= "RWF_NOWAIT helper threads",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct psyncv2_options, nowait_threads),
+		.def	= "1",
+		.minval	= 1,
+		.help	= "Number of threads finishing IO that would block",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_INVALID,
+	},
 	{
 		.name	= NULL,
 	},
@@ -148,16 +241,11 @@ static enum fio_q_status fio_pvsyncio_queue(struct thread_data *td,
 #endif
 
 #ifdef FIO_HAVE_PWRITEV2
-static enum fio_q_status fio_pvsyncio2_queue(struct thread_data *td,
-					     struct io_u *io_u)
+static int fio_pvsyncio2_flags(struct thread_data *td)
 {
 	struct syncio_data *sd = td->io_ops_data;
 	struct psyncv2_options *o = td->eo;
-	struct iovec *iov = &sd->iovecs[0];
-	struct fio_file *f = io_u->file;
-	int ret, flags = 0;
-
-	fio_ro_check(td, io_u);
+	int flags = 0;
 
 	if (o->hipri &&
 	    (rand_between(&sd->rand_state, 1, 100) <= o->hipri_percentage))
@@ -165,6 +253,231 @@ static enum fio_q_status fio_pvsyncio2_queue(struct thread_data *td,
 	if (!td->o.odirect && o->uncached)
 		flags |= RWF_UNCACHED;
 
+	return flags;
+}
+
+/*
+ * Issue the part of the batch that isn't done yet. The iovecs are built
+ * by the caller's copy, the main thread and every helper own one.
+ */
+static ssize_t fio_pvsyncio2_rw(struct psyncv2_data *v2,
+				struct psyncv2_batch *b, struct iovec *iov,
+				int flags)
+{
+	unsigned long long skip = b->done;
+	struct io_u *io_u;
+	int nr = 0;
+
+	for (io_u = b->head; io_u; io_u = v2->next[io_u->index]) {
+		if (skip >= io_u->xfer_buflen) {
+			skip -= io_u->xfer_buflen;
+			continue;
+		}
+		iov[nr].iov_base = io_u->xfer_buf + skip;
+		iov[nr].iov_len = io_u->xfer_buflen - skip;
+		skip = 0;
+		nr++;
+	}
+
+	if (b->ddir == DDIR_READ)
+		return preadv2(b->file->fd, iov, nr, b->offset + b->done, flags);
+
+	return pwritev2(b->file->fd, iov, nr, b->offset + b->done, flags);
+}
+
+/*
+ * Spread the result of a batch over its io_us and hand them to
+ * ->getevents(). Called by the main thread for RWF_NOWAIT hits and by
+ * the helpers for misses, which go to the cache hit and miss latency
+ * stats of the job.
+ */
+static void fio_pvsyncio2_finish(struct thread_data *td,
+				 struct psyncv2_batch *b,
+				 unsigned long long bytes, int err, bool miss)
+{
+	struct syncio_data *sd = td->io_ops_data;
+	struct psyncv2_data *v2 = sd->v2;
+	struct io_u *io_u, *next;
+	uint64_t nsec;
+
+	nsec = ntime_since_now(&b->start);
+
+	pthread_mutex_lock(&v2->lock);
+	for (io_u = b->head; io_u; io_u = next) {
+		next = v2->next[io_u->index];
+
+		if (err)
+			io_u->error = err;
+		else {
+			unsigned long long this_io;
+
+			this_io = min(bytes, io_u->xfer_buflen);
+			io_u->resid = io_u->xfer_buflen - this_io;
+			io_u->error = 0;
+			bytes -= this_io;
+		}
+		if (miss || v2->nowait)
+			add_cache_lat_sample(&td->ts, b->ddir, nsec, !miss);
+		v2->done[v2->nr_done++] = io_u;
+	}
+
+	flist_add_tail(&b->list, &v2->free_list);
+	if (miss) {
+		v2->inflight--;
+		pthread_cond_signal(&v2->done_cond);
+	}
+	pthread_mutex_unlock(&v2->lock);
+}
+
+static void *fio_pvsyncio2_helper(void *data)
+{
+	struct thread_data *td = data;
+	struct syncio_data *sd = td->io_ops_data;
+	struct psyncv2_data *v2 = sd->v2;
+	struct psyncv2_batch *b;
+	struct iovec *iov;
+	ssize_t ret;
+
+	iov = malloc(v2->max_segs * sizeof(*iov));
+
+	pthread_mutex_lock(&v2->lock);
+	while (1) {
+		while (flist_empty(&v2->work) && !v2->exit)
+			pthread_cond_wait(&v2->work_cond, &v2->lock);
+		if (flist_empty(&v2->work))
+			break;
+
+		b = flist_first_entry(&v2->work, struct psyncv2_batch, list);
+		flist_del(&b->list);
+		pthread_mutex_unlock(&v2->lock);
+
+		ret = fio_pvsyncio2_rw(v2, b, iov, b->flags);
+		if (ret < 0)
+			fio_pvsyncio2_finish(td, b, 0, errno, true);
+		else
+			fio_pvsyncio2_finish(td, b, b->done + ret, 0, true);
+
+		pthread_mutex_lock(&v2->lock);
+	}
+	pthread_mutex_unlock(&v2->lock);
+
+	free(iov);
+	return NULL;
+}
+
+static void fio_pvsyncio2_issue(struct thread_data *td,
+				struct psyncv2_batch *b)
+{
+	struct syncio_data *sd = td->io_ops_data;
+	struct psyncv2_data *v2 = sd->v2;
+	ssize_t ret;
+
+	fio_gettime(&b->start, NULL);
+	v2->calls++;
+	v2->ios += b->nr;
+
+	if (v2->nowait) {
+		ret = fio_pvsyncio2_rw(v2, b, sd->iovecs, b->flags | RWF_NOWAIT);
+		if (ret < 0 && errno == EOPNOTSUPP) {
+			log_info("fio: %s: RWF_NOWAIT not supported, "
+				 "disabled\n", td->o.name);
+			v2->nowait = 0;
+		} else if (ret == (ssize_t) b->bytes ||
+			   (ret < 0 && errno != EAGAIN)) {
+			fio_pvsyncio2_finish(td, b, ret < 0 ? 0 : ret,
+						ret < 0 ? errno : 0, false);
+			return;
+		} else {
+			/* would block, a helper finishes what is left */
+			if (ret > 0) {
+				b->done = ret;
+				v2->partial++;
+			}
+
+			pthread_mutex_lock(&v2->lock);
+			flist_add_tail(&b->list, &v2->work);
+			v2->inflight++;
+			pthread_cond_signal(&v2->work_cond);
+			pthread_mutex_unlock(&v2->lock);
+			return;
+		}
+	}
+
+	ret = fio_pvsyncio2_rw(v2, b, sd->iovecs, b->flags);
+	fio_pvsyncio2_finish(td, b, ret < 0 ? 0 : ret, ret < 0 ? errno : 0,
+				false);
+}
+
+static enum fio_q_status fio_pvsyncio2_batch_queue(struct thread_data *td,
+						   struct io_u *io_u)
+{
+	struct syncio_data *sd = td->io_ops_data;
+	struct psyncv2_data *v2 = sd->v2;
+	struct psyncv2_batch *b = v2->open;
+
+	if (b && (b->nr == v2->max_segs || io_u->file != b->file ||
+		  io_u->ddir != b->ddir ||
+		  io_u->offset != b->offset + b->bytes)) {
+		flist_add_tail(&b->list, &v2->pending);
+		b = v2->open = NULL;
+	}
+
+	/* a batch holds at least one io_u, there's always a free one */
+	if (!b) {
+		pthread_mutex_lock(&v2->lock);
+		b = flist_first_entry(&v2->free_list, struct psyncv2_batch, list);
+		flist_del(&b->list);
+		pthread_mutex_unlock(&v2->lock);
+
+		b->file = io_u->file;
+		b->ddir = io_u->ddir;
+		b->flags = fio_pvsyncio2_flags(td);
+		b->offset = io_u->offset;
+		b->bytes = 0;
+		b->done = 0;
+		b->nr = 0;
+		b->head = NULL;
+		v2->open = b;
+	}
+
+	if (b->head)
+		v2->next[b->tail->index] = io_u;
+	else
+		b->head = io_u;
+	b->tail = io_u;
+	v2->next[io_u->index] = NULL;
+	b->bytes += io_u->xfer_buflen;
+	b->nr++;
+
+	return FIO_Q_QUEUED;
+}
+
+static enum fio_q_status fio_pvsyncio2_queue(struct thread_data *td,
+					     struct io_u *io_u)
+{
+	struct syncio_data *sd = td->io_ops_data;
+	struct psyncv2_data *v2 = sd->v2;
+	struct iovec *iov = &sd->iovecs[0];
+	struct fio_file *f = io_u->file;
+	int ret, flags;
+
+	fio_ro_check(td, io_u);
+
+	if (v2) {
+		if (ddir_rw(io_u->ddir))
+			return fio_pvsyncio2_batch_queue(td, io_u);
+
+		/* syncs and trims wait for the batches before them */
+		if (v2->open || !flist_empty(&v2->pending) || v2->inflight)
+			return FIO_Q_BUSY;
+	}
+
+	/* there's a ->commit(), so the core leaves the accounting to us */
+	io_u_mark_submit(td, 1);
+	io_u_mark_complete(td, 1);
+
+	flags = fio_pvsyncio2_flags(td);
+
 	iov->iov_base = io_u->xfer_buf;
 	iov->iov_len = io_u->xfer_buflen;
 
@@ -412,6 +725,172 @@ static void fio_vsyncio_cleanup(struct thread_data *td)
 	}
 }
 
+#ifdef FIO_HAVE_PWRITEV2
+static int fio_pvsyncio2_commit(struct thread_data *td)
+{
+	struct syncio_data *sd = td->io_ops_data;
+	struct psyncv2_data *v2 = sd->v2;
+	struct psyncv2_batch *b;
+
+	if (!v2)
+		return 0;
+
+	if (v2->open) {
+		flist_add_tail(&v2->open->list, &v2->pending);
+		v2->open = NULL;
+	}
+
+	while (!flist_empty(&v2->pending)) {
+		b = flist_first_entry(&v2->pending, struct psyncv2_batch, list);
+		flist_del(&b->list);
+
+		io_u_mark_submit(td, b->nr);
+		fio_pvsyncio2_issue(td, b);
+	}
+
+	return 0;
+}
+
+static int fio_pvsyncio2_getevents(struct thread_data *td, unsigned int min,
+				   unsigned int max,
+				   const struct timespec fio_unused *t)
+{
+	struct syncio_data *sd = td->io_ops_data;
+	struct psyncv2_data *v2 = sd->v2;
+	unsigned int nr;
+
+	if (!v2)
+		return 0;
+
+	pthread_mutex_lock(&v2->lock);
+	while (v2->nr_done < min && v2->inflight)
+		pthread_cond_wait(&v2->done_cond, &v2->lock);
+
+	nr = min(v2->nr_done, max);
+	memcpy(sd->io_us, v2->done, nr * sizeof(struct io_u *));
+	v2->nr_done -= nr;
+	memmove(v2->done, &v2->done[nr], v2->nr_done * sizeof(struct io_u *));
+	pthread_mutex_unlock(&v2->lock);
+
+	return nr;
+}
+
+static void fio_pvsyncio2_show_stats(struct thread_data *td)
+{
+	struct syncio_data *sd = td->io_ops_data;
+	struct psyncv2_data *v2 = sd->v2;
+	struct psyncv2_options *o = td->eo;
+
+	if (!v2->calls)
+		return;
+
+	if (o->coalesce)
+		log_info("pvsync2: %s: coalesced %llu ios into %llu calls "
+			 "(%.1f per call)\n", td->o.name,
+			 (unsigned long long) v2->ios,
+			 (unsigned long long) v2->calls,
+			 (double) v2->ios / v2->calls);
+	if (o->nowait && v2->partial)
+		log_info("pvsync2: %s: %llu nowait misses were partly served "
+			 "from the cache\n", td->o.name,
+			 (unsigned long long) v2->partial);
+}
+
+static void fio_pvsyncio2_cleanup(struct thread_data *td)
+{
+	struct syncio_data *sd = td->io_ops_data;
+	struct psyncv2_data *v2 = sd ? sd->v2 : NULL;
+	unsigned int i;
+
+	if (v2) {
+		pthread_mutex_lock(&v2->lock);
+		v2->exit = 1;
+		pthread_cond_broadcast(&v2->work_cond);
+		pthread_mutex_unlock(&v2->lock);
+
+		for (i = 0; i < v2->nr_threads; i++)
+			pthread_join(v2->threads[i], NULL);
+
+		fio_pvsyncio2_show_stats(td);
+
+		pthread_cond_destroy(&v2->done_cond);
+		pthread_cond_destroy(&v2->work_cond);
+		pthread_mutex_destroy(&v2->lock);
+		free(v2->threads);
+		free(v2->done);
+		free(v2->next);
+		free(v2->batches);
+		free(v2);
+	}
+
+	fio_vsyncio_cleanup(td);
+}
+
+static int fio_pvsyncio2_init(struct thread_data *td)
+{
+	struct psyncv2_options *o = td->eo;
+	struct syncio_data *sd;
+	struct psyncv2_data *v2;
+	unsigned int i;
+	int ret;
+
+	if (fio_vsyncio_init(td))
+		return 1;
+	if (!o->coalesce && !o->nowait)
+		return 0;
+
+	/*
+	 * Only the io_us queued between two commits get merged, so unless
+	 * asked otherwise, queue a full iodepth and wait for all of it.
+	 */
+	if (o->coalesce) {
+		if (!fio_option_is_set(&td->o, iodepth_batch))
+			td->o.iodepth_batch = td->o.iodepth;
+		if (!fio_option_is_set(&td->o, iodepth_batch_complete_min))
+			td->o.iodepth_batch_complete_min = td->o.iodepth_batch;
+		if (td->o.iodepth_batch_complete_max < td->o.iodepth_batch_complete_min)
+			td->o.iodepth_batch_complete_max = td->o.iodepth_batch_complete_min;
+	}
+
+	sd = td->io_ops_data;
+	v2 = calloc(1, sizeof(*v2));
+	sd->v2 = v2;
+
+	/* batches reuse the iovecs of vsync, sized by iodepth */
+	v2->max_segs = o->coalesce ? min(td->o.iodepth, (unsigned int) IOV_MAX) : 1;
+	v2->batches = calloc(td->o.iodepth, sizeof(struct psyncv2_batch));
+	v2->next = calloc(td->o.iodepth, sizeof(struct io_u *));
+	v2->done = calloc(td->o.iodepth, sizeof(struct io_u *));
+	v2->nowait = o->nowait;
+
+	INIT_FLIST_HEAD(&v2->free_list);
+	INIT_FLIST_HEAD(&v2->pending);
+	INIT_FLIST_HEAD(&v2->work);
+	for (i = 0; i < td->o.iodepth; i++)
+		flist_add_tail(&v2->batches[i].list, &v2->free_list);
+
+	pthread_mutex_init(&v2->lock, NULL);
+	pthread_cond_init(&v2->work_cond, NULL);
+	pthread_cond_init(&v2->done_cond, NULL);
+
+	if (!o->nowait)
+		return 0;
+
+	v2->threads = calloc(o->nowait_threads, sizeof(pthread_t));
+	for (i = 0; i < o->nowait_threads; i++) {
+		ret = pthread_create(&v2->threads[i], NULL,
+					fio_pvsyncio2_helper, td);
+		if (ret) {
+			td_verror(td, ret, "pthread_create");
+			return 1;
+		}
+		v2->nr_threads++;
+	}
+
+	return 0;
+}
+#endif
+
 static struct ioengine_ops ioengine_rw = {
 	.name		= "sync",
 	.version	= FIO_IOOPS_VERSION,
@@ -466,9 +945,12 @@ static struct ioengine_ops ioengine_pvrw = {
 static struct ioengine_ops ioengine_pvrw2 = {
 	.name		= "pvsync2",
 	.version	= FIO_IOOPS_VERSION,
-	.init		= fio_vsyncio_init,
-	.cleanup	= fio_vsyncio_cleanup,
+	.init		= fio_pvsyncio2_init,
+	.cleanup	= fio_pvsyncio2_cleanup,
 	.queue		= fio_pvsyncio2_queue,
+	.commit		= fio_pvsyncio2_commit,
+	.event		= fio_vsyncio_event,
+	.getevents	= fio_pvsyncio2_getevents,
 	.open_file	= generic_open_file,
 	.close_file	= generic_close_file,
 	.get_file_size	= generic_get_file_size,
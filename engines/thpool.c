@@ -32,37 +32,32 @@
 #define print_error(msg)
 #endif
 
-static volatile int threads_keepalive;
-static volatile int threads_on_hold;
+/* Slots of each per-thread queue, jobs beyond go to the overflow list */
+#define QUEUE_SIZE 1024
 
+/* Times an idle thread looks for work before going to sleep */
+#define IDLE_SPINS 64
 
+static volatile int threads_on_hold;
 
-/* ========================== STRUCTURES ============================ */
 
 
-/* Binary semaphore */
-typedef struct bsem {
-	pthread_mutex_t mutex;
-	pthread_cond_t   cond;
-	int v;
-} bsem;
+/* ========================== STRUCTURES ============================ */
 
 
-/* Job */
-typedef struct job{
-	struct job*  prev;                   /* pointer to previous job   */
-	void   (*function)(void* arg);       /* function pointer          */
-	void*  arg;                          /* function's argument       */
-} job;
+/* Slot of a job queue */
+typedef struct slot{
+	volatile unsigned long seq;          /* position the slot is for  */
+	struct thpool_job* job;              /* the job, once seq is set  */
+} slot;
 
 
-/* Job queue */
+/* Bounded lock-free multi-producer multi-consumer job queue, one per
+ * thread. Its thread takes jobs from it first, idle threads steal. */
 typedef struct jobqueue{
-	pthread_mutex_t rwmutex;             /* used for queue r/w access */
-	job  *front;                         /* pointer to front of queue */
-	job  *rear;                          /* pointer to rear  of queue */
-	bsem *has_jobs;                      /* flag as binary semaphore  */
-	int   len;                           /* number of jobs in queue   */
+	volatile unsigned long head __attribute__((aligned(64)));
+	volatile unsigned long tail __attribute__((aligned(64)));
+	slot  slots[QUEUE_SIZE];
 } jobqueue;
 
 
@@ -71,17 +66,32 @@ typedef struct thread{
 	int       id;                        /* friendly id               */
 	pthread_t pthread;                   /* pointer to actual thread  */
 	struct thpool_* thpool_p;            /* access to thpool          */
+	jobqueue  jobqueue;                  /* jobs pushed to the thread */
 } thread;
 
 
 /* Threadpool */
 typedef struct thpool_{
 	thread**   threads;                  /* pointer to threads        */
+	int        num_threads;              /* threads created           */
+	volatile int keepalive;              /* cleared on destroy        */
+	void (*thread_init_p)(int, void*);   /* called in each new thread */
+	void*  thread_init_arg;              /* its argument              */
 	volatile int num_threads_alive;      /* threads currently alive   */
 	volatile int num_threads_working;    /* threads currently working */
+	volatile int num_jobs;               /* jobs queued, not started  */
+	volatile unsigned int next_queue;    /* round robin over threads  */
+
 	pthread_mutex_t  thcount_lock;       /* used for thread count etc */
-	pthread_cond_t  threads_all_idle;    /* signal to thpool_wait     */
-	jobqueue  jobqueue;                  /* job queue                 */
+
+	pthread_mutex_t  sleep_lock;         /* idle threads sleep here   */
+	pthread_cond_t   has_jobs;
+	volatile int num_threads_sleeping;
+
+	pthread_mutex_t  overflow_lock;      /* jobs not fitting a queue  */
+	struct thpool_job* overflow_front;
+	struct thpool_job* overflow_rear;
+	volatile int overflow_len;
 } thpool_;
 
 
@@ -96,17 +106,14 @@ static void* thread_do(struct thread* thread_p);
 static void  thread_hold();
 static void  thread_destroy(struct thread* thread_p);
 
-static int   jobqueue_init(jobqueue* jobqueue_p);
-static void  jobqueue_clear(jobqueue* jobqueue_p);
-static void  jobqueue_push(jobqueue* jobqueue_p, struct job* newjob_p);
-static struct job* jobqueue_pull(jobqueue* jobqueue_p);
-static void  jobqueue_destroy(jobqueue* jobqueue_p);
+static void  jobqueue_init(jobqueue* jobqueue_p);
+static int   jobqueue_push(jobqueue* jobqueue_p, struct thpool_job* job_p);
+static struct thpool_job* jobqueue_pull(jobqueue* jobqueue_p);
 
-static void  bsem_init(struct bsem *bsem_p, int value);
-static void  bsem_reset(struct bsem *bsem_p);
-static void  bsem_post(struct bsem *bsem_p);
-static void  bsem_post_all(struct bsem *bsem_p);
-static void  bsem_wait(struct bsem *bsem_p);
+static void  overflow_push(thpool_* thpool_p, struct thpool_job* job_p);
+static struct thpool_job* overflow_pull(thpool_* thpool_p);
+
+static struct thpool_job* thpool_take(thpool_* thpool_p, int id);
 
 
 
@@ -117,47 +124,52 @@ static void  bsem_wait(struct bsem *bsem_p);
 
 /* Initialise thread pool */
 struct thpool_* thpool_init(int num_threads){
+	return thpool_init_cb(num_threads, NULL, NULL);
+}
+
+
+/* Initialise thread pool, running a callback in each new thread */
+struct thpool_* thpool_init_cb(int num_threads, void (*thread_init_p)(int, void*),
+			       void* arg_p){
 
 	threads_on_hold   = 0;
-	threads_keepalive = 1;
 
-	if (num_threads < 0){
-		num_threads = 0;
+	if (num_threads < 1){
+		num_threads = 1;
 	}
 
 	/* Make new thread pool */
 	thpool_* thpool_p;
-	thpool_p = (struct thpool_*)malloc(sizeof(struct thpool_));
+	thpool_p = (struct thpool_*)calloc(1, sizeof(struct thpool_));
 	if (thpool_p == NULL){
 		print_error("thpool_init(): Could not allocate memory for thread pool\n");
 		return NULL;
 	}
-	thpool_p->num_threads_alive   = 0;
-	thpool_p->num_threads_working = 0;
-
-	/* Initialise the job queue */
-	if (jobqueue_init(&thpool_p->jobqueue) == -1){
-		print_error("thpool_init(): Could not allocate memory for job queue\n");
-		free(thpool_p);
-		return NULL;
-	}
+	thpool_p->keepalive           = 1;
+	thpool_p->thread_init_p       = thread_init_p;
+	thpool_p->thread_init_arg     = arg_p;
 
 	/* Make threads in pool */
-	thpool_p->threads = (struct thread**)malloc(num_threads * sizeof(struct thread *));
+	thpool_p->threads = (struct thread**)calloc(num_threads, sizeof(struct thread *));
 	if (thpool_p->threads == NULL){
 		print_error("thpool_init(): Could not allocate memory for threads\n");
-		jobqueue_destroy(&thpool_p->jobqueue);
 		free(thpool_p);
 		return NULL;
 	}
 
-	pthread_mutex_init(&(thpool_p->thcount_lock), NULL);
-	pthread_cond_init(&thpool_p->threads_all_idle, NULL);
+	pthread_mutex_init(&thpool_p->thcount_lock, NULL);
+	pthread_mutex_init(&thpool_p->sleep_lock, NULL);
+	pthread_cond_init(&thpool_p->has_jobs, NULL);
+	pthread_mutex_init(&thpool_p->overflow_lock, NULL);
 
 	/* Thread init */
 	int n;
 	for (n=0; n<num_threads; n++){
-		thread_init(thpool_p, &thpool_p->threads[n], n);
+		if (thread_init(thpool_p, &thpool_p->threads[n], n)){
+			thpool_destroy(thpool_p);
+			return NULL;
+		}
+		thpool_p->num_threads++;
 #if THPOOL_DEBUG
 			printf("THPOOL_DEBUG: Created thread %d in pool \n", n);
 #endif
@@ -172,9 +184,9 @@ struct thpool_* thpool_init(int num_threads){
 
 /* Add work to the thread pool */
 int thpool_add_work(thpool_* thpool_p, void (*function_p)(void*), void* arg_p){
-	job* newjob;
+	struct thpool_job* newjob;
 
-	newjob=(struct job*)malloc(sizeof(struct job));
+	newjob=(struct thpool_job*)malloc(sizeof(struct thpool_job));
 	if (newjob==NULL){
 		print_error("thpool_add_work(): Could not allocate memory for new job\n");
 		return -1;
@@ -183,21 +195,62 @@ int thpool_add_work(thpool_* thpool_p, void (*function_p)(void*), void* arg_p){
 	/* add function and argument */
 	newjob->function=function_p;
 	newjob->arg=arg_p;
+	newjob->owned=1;
 
 	/* add job to queue */
-	jobqueue_push(&thpool_p->jobqueue, newjob);
+	thpool_add_job(thpool_p, newjob);
+	thpool_wake(thpool_p, 1);
 
 	return 0;
 }
 
 
+/* Add a job to the next thread's queue, or any with room */
+void thpool_add_job(thpool_* thpool_p, struct thpool_job* job_p){
+	unsigned int start = __sync_fetch_and_add(&thpool_p->next_queue, 1);
+	int n;
+
+	__sync_fetch_and_add(&thpool_p->num_jobs, 1);
+
+	for (n=0; n < thpool_p->num_threads; n++){
+		thread* thread_p = thpool_p->threads[(start + n) % thpool_p->num_threads];
+
+		if (!jobqueue_push(&thread_p->jobqueue, job_p))
+			return;
+	}
+
+	overflow_push(thpool_p, job_p);
+}
+
+
+/* Wake up sleeping threads, once per batch of jobs
+ *
+ * Threads bump num_threads_sleeping before checking num_jobs, we bumped
+ * num_jobs before checking num_threads_sleeping, both with full barriers,
+ * so either they see the jobs or we see them sleeping. */
+void thpool_wake(thpool_* thpool_p, int nr_jobs){
+	int n;
+
+	__sync_synchronize();
+	if (!thpool_p->num_threads_sleeping || nr_jobs <= 0)
+		return;
+
+	pthread_mutex_lock(&thpool_p->sleep_lock);
+	if (nr_jobs >= thpool_p->num_threads_sleeping){
+		pthread_cond_broadcast(&thpool_p->has_jobs);
+	} else {
+		for (n=0; n < nr_jobs; n++)
+			pthread_cond_signal(&thpool_p->has_jobs);
+	}
+	pthread_mutex_unlock(&thpool_p->sleep_lock);
+}
+
+
 /* Wait until all jobs have finished */
 void thpool_wait(thpool_* thpool_p){
-	pthread_mutex_lock(&thpool_p->thcount_lock);
-	while (thpool_p->jobqueue.len || thpool_p->num_threads_working) {
-		pthread_cond_wait(&thpool_p->threads_all_idle, &thpool_p->thcount_lock);
+	while (thpool_p->num_jobs || thpool_p->num_threads_working) {
+		usleep(1000);
 	}
-	pthread_mutex_unlock(&thpool_p->thcount_lock);
 }
 
 
@@ -206,35 +259,31 @@ void thpool_destroy(thpool_* thpool_p){
 	/* No need to destory if it's NULL */
 	if (thpool_p == NULL) return ;
 
-	volatile int threads_total = thpool_p->num_threads_alive;
-
 	/* End each thread 's infinite loop */
-	threads_keepalive = 0;
-
-	/* Give one second to kill idle threads */
-	double TIMEOUT = 1.0;
-	time_t start, end;
-	double tpassed = 0.0;
-	time (&start);
-	while (tpassed < TIMEOUT && thpool_p->num_threads_alive){
-		bsem_post_all(thpool_p->jobqueue.has_jobs);
-		time (&end);
-		tpassed = difftime(end,start);
-	}
+	thpool_p->keepalive = 0;
 
-	/* Poll remaining threads */
-	while (thpool_p->num_threads_alive){
-		bsem_post_all(thpool_p->jobqueue.has_jobs);
-		sleep(1);
-	}
+	pthread_mutex_lock(&thpool_p->sleep_lock);
+	pthread_cond_broadcast(&thpool_p->has_jobs);
+	pthread_mutex_unlock(&thpool_p->sleep_lock);
 
-	/* Job queue cleanup */
-	jobqueue_destroy(&thpool_p->jobqueue);
 	/* Deallocs */
 	int n;
-	for (n=0; n < threads_total; n++){
+	for (n=0; n < thpool_p->num_threads; n++){
+		pthread_join(thpool_p->threads[n]->pthread, NULL);
 		thread_destroy(thpool_p->threads[n]);
 	}
+
+	/* Jobs never run are dropped */
+	struct thpool_job* job_p;
+	while ((job_p = overflow_pull(thpool_p)) != NULL){
+		if (job_p->owned)
+			free(job_p);
+	}
+
+	pthread_cond_destroy(&thpool_p->has_jobs);
+	pthread_mutex_destroy(&thpool_p->sleep_lock);
+	pthread_mutex_destroy(&thpool_p->overflow_lock);
+	pthread_mutex_destroy(&thpool_p->thcount_lock);
 	free(thpool_p->threads);
 	free(thpool_p);
 }
@@ -260,6 +309,36 @@ int thpool_num_threads_working(thpool_* thpool_p){
 }
 
 
+/* Take a job: from the thread's own queue, then the overflow list, then
+ * steal from the other threads' queues */
+static struct thpool_job* thpool_take(thpool_* thpool_p, int id){
+	struct thpool_job* job_p;
+	int n;
+
+	if (!thpool_p->num_jobs)
+		return NULL;
+
+	job_p = jobqueue_pull(&thpool_p->threads[id]->jobqueue);
+	if (!job_p && thpool_p->overflow_len)
+		job_p = overflow_pull(thpool_p);
+
+	for (n=1; !job_p && n < thpool_p->num_threads; n++){
+		thread* victim = thpool_p->threads[(id + n) % thpool_p->num_threads];
+
+		job_p = jobqueue_pull(&victim->jobqueue);
+	}
+
+	/* Count it as working before it stops counting as queued, so
+	 * thpool_wait() never sees neither */
+	if (job_p){
+		__sync_fetch_and_add(&thpool_p->num_threads_working, 1);
+		__sync_fetch_and_sub(&thpool_p->num_jobs, 1);
+	}
+
+	return job_p;
+}
+
+
 
 
 
@@ -275,16 +354,21 @@ int thpool_num_threads_working(thpool_* thpool_p){
 static int thread_init (thpool_* thpool_p, struct thread** thread_p, int id){
 
 	*thread_p = (struct thread*)malloc(sizeof(struct thread));
-	if (thread_p == NULL){
+	if (*thread_p == NULL){
 		print_error("thread_init(): Could not allocate memory for thread\n");
 		return -1;
 	}
 
 	(*thread_p)->thpool_p = thpool_p;
 	(*thread_p)->id       = id;
+	jobqueue_init(&(*thread_p)->jobqueue);
 
-	pthread_create(&(*thread_p)->pthread, NULL, (void *)thread_do, (*thread_p));
-	pthread_detach((*thread_p)->pthread);
+	if (pthread_create(&(*thread_p)->pthread, NULL, (void *)thread_do, (*thread_p))){
+		print_error("thread_init(): Could not create thread\n");
+		free(*thread_p);
+		*thread_p = NULL;
+		return -1;
+	}
 	return 0;
 }
 
@@ -324,6 +408,10 @@ static void* thread_do(struct thread* thread_p){
 	/* Assure all threads have been created before starting serving */
 	thpool_* thpool_p = thread_p->thpool_p;
 
+	/* Let the user place the thread, before it serves any jobs */
+	if (thpool_p->thread_init_p)
+		thpool_p->thread_init_p(thread_p->id, thpool_p->thread_init_arg);
+
 	/* Register signal handler */
 	struct sigaction act;
 	sigemptyset(&act.sa_mask);
@@ -338,35 +426,39 @@ static void* thread_do(struct thread* thread_p){
 	thpool_p->num_threads_alive += 1;
 	pthread_mutex_unlock(&thpool_p->thcount_lock);
 
-	while(threads_keepalive){
+	int spins = 0;
 
-		bsem_wait(thpool_p->jobqueue.has_jobs);
+	while(thpool_p->keepalive){
 
-		if (threads_keepalive){
+		struct thpool_job* job_p = thpool_take(thpool_p, thread_p->id);
 
-			pthread_mutex_lock(&thpool_p->thcount_lock);
-			thpool_p->num_threads_working++;
-			pthread_mutex_unlock(&thpool_p->thcount_lock);
+		if (job_p){
+			/* The job may be added again as soon as its function
+			 * starts, so read it all before */
+			void (*func_buff)(void*) = job_p->function;
+			void*  arg_buff          = job_p->arg;
+			int    owned             = job_p->owned;
 
-			/* Read job from queue and execute it */
-			void (*func_buff)(void*);
-			void*  arg_buff;
-			job* job_p = jobqueue_pull(&thpool_p->jobqueue);
-			if (job_p) {
-				func_buff = job_p->function;
-				arg_buff  = job_p->arg;
-				func_buff(arg_buff);
-				free(job_p);
-			}
-
-			pthread_mutex_lock(&thpool_p->thcount_lock);
-			thpool_p->num_threads_working--;
-			if (!thpool_p->num_threads_working) {
-				pthread_cond_signal(&thpool_p->threads_all_idle);
-			}
-			pthread_mutex_unlock(&thpool_p->thcount_lock);
+			func_buff(arg_buff);
+			__sync_fetch_and_sub(&thpool_p->num_threads_working, 1);
 
+			if (owned)
+				free(job_p);
+			spins = 0;
+			continue;
 		}
+
+		/* Look a few more times, jobs of a batch come in quick succession */
+		if (++spins < IDLE_SPINS)
+			continue;
+		spins = 0;
+
+		pthread_mutex_lock(&thpool_p->sleep_lock);
+		__sync_fetch_and_add(&thpool_p->num_threads_sleeping, 1);
+		while (!thpool_p->num_jobs && thpool_p->keepalive)
+			pthread_cond_wait(&thpool_p->has_jobs, &thpool_p->sleep_lock);
+		__sync_fetch_and_sub(&thpool_p->num_threads_sleeping, 1);
+		pthread_mutex_unlock(&thpool_p->sleep_lock);
 	}
 	pthread_mutex_lock(&thpool_p->thcount_lock);
 	thpool_p->num_threads_alive --;
@@ -378,6 +470,14 @@ static void* thread_do(struct thread* thread_p){
 
 /* Frees a thread  */
 static void thread_destroy (thread* thread_p){
+	struct thpool_job* job_p;
+
+	/* Jobs never run are dropped */
+	if (thread_p == NULL) return;
+	while ((job_p = jobqueue_pull(&thread_p->jobqueue)) != NULL){
+		if (job_p->owned)
+			free(job_p);
+	}
 	free(thread_p);
 }
 
@@ -388,156 +488,102 @@ static void thread_destroy (thread* thread_p){
 /* ============================ JOB QUEUE =========================== */
 
 
-/* Initialize queue */
-static int jobqueue_init(jobqueue* jobqueue_p){
-	jobqueue_p->len = 0;
-	jobqueue_p->front = NULL;
-	jobqueue_p->rear  = NULL;
-
-	jobqueue_p->has_jobs = (struct bsem*)malloc(sizeof(struct bsem));
-	if (jobqueue_p->has_jobs == NULL){
-		return -1;
-	}
-
-	pthread_mutex_init(&(jobqueue_p->rwmutex), NULL);
-	bsem_init(jobqueue_p->has_jobs, 0);
-
-	return 0;
-}
+/* Initialize queue, each slot waits for its position */
+static void jobqueue_init(jobqueue* jobqueue_p){
+	unsigned long n;
 
-
-/* Clear the queue */
-static void jobqueue_clear(jobqueue* jobqueue_p){
-
-	while(jobqueue_p->len){
-		free(jobqueue_pull(jobqueue_p));
+	jobqueue_p->head = 0;
+	jobqueue_p->tail = 0;
+	for (n=0; n < QUEUE_SIZE; n++){
+		jobqueue_p->slots[n].seq = n;
+		jobqueue_p->slots[n].job = NULL;
 	}
-
-	jobqueue_p->front = NULL;
-	jobqueue_p->rear  = NULL;
-	bsem_reset(jobqueue_p->has_jobs);
-	jobqueue_p->len = 0;
-
 }
 
 
-/* Add (allocated) job to queue
+/* Add a job to the queue
+ * @return 0 on success, -1 if the queue is full
  */
-static void jobqueue_push(jobqueue* jobqueue_p, struct job* newjob){
-
-	pthread_mutex_lock(&jobqueue_p->rwmutex);
-	newjob->prev = NULL;
-
-	switch(jobqueue_p->len){
-
-		case 0:  /* if no jobs in queue */
-					jobqueue_p->front = newjob;
-					jobqueue_p->rear  = newjob;
-					break;
-
-		default: /* if jobs in queue */
-					jobqueue_p->rear->prev = newjob;
-					jobqueue_p->rear = newjob;
-
+static int jobqueue_push(jobqueue* jobqueue_p, struct thpool_job* job_p){
+	unsigned long pos = jobqueue_p->tail;
+
+	for (;;) {
+		slot* slot_p = &jobqueue_p->slots[pos % QUEUE_SIZE];
+		long dif = (long) (slot_p->seq - pos);
+
+		if (dif == 0){
+			/* The slot is free, claim the position */
+			if (__sync_bool_compare_and_swap(&jobqueue_p->tail, pos, pos + 1)){
+				slot_p->job = job_p;
+				__sync_synchronize();
+				slot_p->seq = pos + 1;
+				return 0;
+			}
+		} else if (dif < 0){
+			/* Still taken from a lap ago: full */
+			return -1;
+		}
+		pos = jobqueue_p->tail;
 	}
-	jobqueue_p->len++;
-
-	bsem_post(jobqueue_p->has_jobs);
-	pthread_mutex_unlock(&jobqueue_p->rwmutex);
 }
 
 
-/* Get first job from queue(removes it from queue)
-<<<<<<< HEAD
- *
- * Notice: Caller MUST hold a mutex
-=======
->>>>>>> da2c0fe45e43ce0937f272c8cd2704bdc0afb490
+/* Get the first job of the queue (removes it from the queue)
+ * @return the job, NULL if the queue is empty
  */
-static struct job* jobqueue_pull(jobqueue* jobqueue_p){
-
-	pthread_mutex_lock(&jobqueue_p->rwmutex);
-	job* job_p = jobqueue_p->front;
-
-	switch(jobqueue_p->len){
-
-		case 0:  /* if no jobs in queue */
-		  			break;
-
-		case 1:  /* if one job in queue */
-					jobqueue_p->front = NULL;
-					jobqueue_p->rear  = NULL;
-					jobqueue_p->len = 0;
-					break;
-
-		default: /* if >1 jobs in queue */
-					jobqueue_p->front = job_p->prev;
-					jobqueue_p->len--;
-					/* more than one job in queue -> post it */
-					bsem_post(jobqueue_p->has_jobs);
-
-	}
-
-	pthread_mutex_unlock(&jobqueue_p->rwmutex);
-	return job_p;
-}
-
-
-/* Free all queue resources back to the system */
-static void jobqueue_destroy(jobqueue* jobqueue_p){
-	jobqueue_clear(jobqueue_p);
-	free(jobqueue_p->has_jobs);
-}
-
-
+static struct thpool_job* jobqueue_pull(jobqueue* jobqueue_p){
+	unsigned long pos = jobqueue_p->head;
 
+	for (;;) {
+		slot* slot_p = &jobqueue_p->slots[pos % QUEUE_SIZE];
+		long dif = (long) (slot_p->seq - (pos + 1));
 
+		if (dif == 0){
+			/* The slot holds a job, claim the position */
+			if (__sync_bool_compare_and_swap(&jobqueue_p->head, pos, pos + 1)){
+				struct thpool_job* job_p = slot_p->job;
 
-/* ======================== SYNCHRONISATION ========================= */
-
-
-/* Init semaphore to 1 or 0 */
-static void bsem_init(bsem *bsem_p, int value) {
-	if (value < 0 || value > 1) {
-		print_error("bsem_init(): Binary semaphore can take only values 1 or 0");
-		exit(1);
+				__sync_synchronize();
+				slot_p->seq = pos + QUEUE_SIZE;
+				return job_p;
+			}
+		} else if (dif < 0){
+			/* Not filled yet: empty */
+			return NULL;
+		}
+		pos = jobqueue_p->head;
 	}
-	pthread_mutex_init(&(bsem_p->mutex), NULL);
-	pthread_cond_init(&(bsem_p->cond), NULL);
-	bsem_p->v = value;
 }
 
 
-/* Reset semaphore to 0 */
-static void bsem_reset(bsem *bsem_p) {
-	bsem_init(bsem_p, 0);
-}
-
+/* Add a job to the overflow list, when all queues are full */
+static void overflow_push(thpool_* thpool_p, struct thpool_job* job_p){
+	job_p->next = NULL;
 
-/* Post to at least one thread */
-static void bsem_post(bsem *bsem_p) {
-	pthread_mutex_lock(&bsem_p->mutex);
-	bsem_p->v = 1;
-	pthread_cond_signal(&bsem_p->cond);
-	pthread_mutex_unlock(&bsem_p->mutex);
+	pthread_mutex_lock(&thpool_p->overflow_lock);
+	if (thpool_p->overflow_rear)
+		thpool_p->overflow_rear->next = job_p;
+	else
+		thpool_p->overflow_front = job_p;
+	thpool_p->overflow_rear = job_p;
+	thpool_p->overflow_len++;
+	pthread_mutex_unlock(&thpool_p->overflow_lock);
 }
 
 
-/* Post to all threads */
-static void bsem_post_all(bsem *bsem_p) {
-	pthread_mutex_lock(&bsem_p->mutex);
-	bsem_p->v = 1;
-	pthread_cond_broadcast(&bsem_p->cond);
-	pthread_mutex_unlock(&bsem_p->mutex);
-}
+/* Get the first job of the overflow list, NULL if empty */
+static struct thpool_job* overflow_pull(thpool_* thpool_p){
+	struct thpool_job* job_p;
 
-
-/* Wait on semaphore until semaphore has value 0 */
-static void bsem_wait(bsem* bsem_p) {
-	pthread_mutex_lock(&bsem_p->mutex);
-	while (bsem_p->v != 1) {
-		pthread_cond_wait(&bsem_p->cond, &bsem_p->mutex);
+	pthread_mutex_lock(&thpool_p->overflow_lock);
+	job_p = thpool_p->overflow_front;
+	if (job_p){
+		thpool_p->overflow_front = job_p->next;
+		if (!thpool_p->overflow_front)
+			thpool_p->overflow_rear = NULL;
+		thpool_p->overflow_len--;
 	}
-	bsem_p->v = 0;
-	pthread_mutex_unlock(&bsem_p->mutex);
+	pthread_mutex_unlock(&thpool_p->overflow_lock);
+
+	return job_p;
 }
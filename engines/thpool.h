@@ -17,6 +17,19 @@ extern "C" {
 typedef struct thpool_* threadpool;
 
 
+/**
+ * A job node. Callers of thpool_add_job() own it, and may embed it in the
+ * object the job works on, so adding work allocates nothing. It must not
+ * be added again before its function has started.
+ */
+struct thpool_job {
+	struct thpool_job* next;             /* internal, overflow list   */
+	void (*function)(void* arg);         /* function pointer          */
+	void*  arg;                          /* function's argument       */
+	int    owned;                        /* internal, freed after run */
+};
+
+
 /**
  * @brief  Initialize threadpool
  *
@@ -37,6 +50,23 @@ typedef struct thpool_* threadpool;
 threadpool thpool_init(int num_threads);
 
 
+/**
+ * @brief  Initialize threadpool, with a per-thread init callback
+ *
+ * Same as thpool_init(), but thread_init_p is called in the context of
+ * every new thread before it starts serving jobs, e.g. to set its CPU
+ * affinity. It receives the thread id (0..num_threads-1) and arg_p.
+ *
+ * @param  num_threads   number of threads to be created in the threadpool
+ * @param  thread_init_p function called in each new thread, can be NULL
+ * @param  arg_p         argument passed to thread_init_p
+ * @return threadpool    created threadpool on success,
+ *                       NULL on error
+ */
+threadpool thpool_init_cb(int num_threads, void (*thread_init_p)(int, void*),
+			  void* arg_p);
+
+
 /**
  * @brief Add work to the job queue
  *
@@ -67,6 +97,39 @@ threadpool thpool_init(int num_threads);
 int thpool_add_work(threadpool, void (*function_p)(void*), void* arg_p);
 
 
+/**
+ * @brief Add a caller owned job, without waking up any thread
+ *
+ * Jobs are spread over per-thread queues, from which idle threads steal.
+ * Call thpool_wake() once after adding a batch of jobs, so a whole batch
+ * costs a single wakeup round. Can be called from any thread.
+ *
+ * @example
+ *
+ *    for (i = 0; i < n; i++){
+ *       jobs[i].function = work;
+ *       jobs[i].arg = &items[i];
+ *       thpool_add_job(thpool, &jobs[i]);
+ *    }
+ *    thpool_wake(thpool, n);
+ *
+ * @param  threadpool    threadpool to which the job will be added
+ * @param  job_p         job with function and arg set
+ * @return nothing
+ */
+void thpool_add_job(threadpool, struct thpool_job* job_p);
+
+
+/**
+ * @brief Wake up to nr_jobs idle threads for jobs added before
+ *
+ * @param  threadpool    the threadpool
+ * @param  nr_jobs       number of jobs added since the last wakeup
+ * @return nothing
+ */
+void thpool_wake(threadpool, int nr_jobs);
+
+
 /**
  * @brief Wait for all queued jobs to finish
  *
@@ -74,11 +137,8 @@ int thpool_add_work(threadpool, void (*function_p)(void*), void* arg_p);
  * Once the queue is empty and all work has completed, the calling thread
  * (probably the main program) will continue.
  *
- * Smart polling is used in wait. The polling is initially 0 - meaning that
- * there is virtually no polling at all. If after 1 seconds the threads
- * haven't finished, the polling interval starts growing exponentially
- * untill it reaches max_secs seconds. Then it jumps down to a maximum polling
- * interval assuming that heavy processing is being used in the threadpool.
+ * Waiting polls with a short sleep, so the threads don't pay for a
+ * notification on every job.
  *
  * @example
  *
@@ -193,6 +193,7 @@ struct thread_data {
 	struct io_log *slat_log;
 	struct io_log *clat_log;
 	struct io_log *clat_hist_log;
+	struct io_log *clat_pct_log;
 	struct io_log *lat_log;
 	struct io_log *bw_log;
 	struct io_log *iops_log;
@@ -200,6 +201,8 @@ struct thread_data {
 	struct workqueue log_compress_wq;
 
 	struct thread_data *parent;
+	bool stat_shard;
+	unsigned int stat_shard_samples;
 
 	uint64_t stat_io_bytes[DDIR_RWDIR_CNT];
 	struct timespec bw_sample_time;
@@ -238,6 +241,8 @@ struct thread_data {
 	pid_t pid;
 	char *orig_buffer;
 	size_t orig_buffer_size;
+	/* set by engines doing all I/O into buffers of their own */
+	bool no_io_u_buffers;
 	volatile int runstate;
 	volatile bool terminate;
 	bool last_was_sync;
@@ -772,6 +777,19 @@ static inline bool td_async_processing(struct thread_data *td)
 	return (td->flags & TD_F_NEED_LOCK) != 0;
 }
 
+/*
+ * Offload workers keep latency stats in their own thread_stat, a shard
+ * that is folded into the parent by stat_shard_flush(). Everything else
+ * is accounted to the parent.
+ */
+static inline struct thread_data *stat_shard_td(struct thread_data *td)
+{
+	if (td->parent && !td->stat_shard)
+		return td->parent;
+
+	return td;
+}
+
 static inline bool td_offload_overlap(struct thread_data *td)
 {
 	return td->o.serialize_overlap && td->o.io_submit_mode == IO_MODE_OFFLOAD;
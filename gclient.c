@@ -711,6 +711,13 @@ static void gfio_add_end_results(struct gfio_client *gc, struct thread_stat *ts,
 	gc->results = realloc(gc->results, (nr + 1) * sizeof(struct end_results));
 	memcpy(&gc->results[nr].ts, ts, sizeof(*ts));
 	memcpy(&gc->results[nr].gs, rs, sizeof(*rs));
+
+	/*
+	 * The histograms live in the TS cmd, which is freed once handled
+	 */
+	if (!alloc_thread_stat_plat(&gc->results[nr].ts))
+		memcpy(gc->results[nr].ts.plat, ts->plat,
+			FIO_PLAT_ROWS * plat_nr(ts) * sizeof(uint64_t));
 	gc->nr_results++;
 }
 
@@ -1108,7 +1115,7 @@ static void gfio_show_clat_percentiles(struct gfio_client *gc,
 	struct gui_entry *ge = gc->ge;
 	char tmp[64];
 
-	len = calc_clat_percentiles(io_u_plat, nr, plist, &ovals, &maxv, &minv);
+	len = calc_clat_percentiles(ts, io_u_plat, nr, plist, &ovals, &maxv, &minv);
 	if (!len)
 		goto out;
 
@@ -1306,40 +1313,40 @@ static void gfio_show_ddir_status(struct gfio_client *gc, GtkWidget *mbox,
 
 	if (ts->slat_percentiles && flags & GFIO_SLAT)
 		gfio_show_clat_percentiles(gc, main_vbox, ts, ddir,
-				ts->io_u_plat[FIO_SLAT][ddir],
+				ts_io_u_plat(ts, FIO_SLAT, ddir),
 				ts->slat_stat[ddir].samples,
 				"Submission");
 	if (ts->clat_percentiles && flags & GFIO_CLAT) {
 		gfio_show_clat_percentiles(gc, main_vbox, ts, ddir,
-				ts->io_u_plat[FIO_CLAT][ddir],
+				ts_io_u_plat(ts, FIO_CLAT, ddir),
 				ts->clat_stat[ddir].samples,
 				"Completion");
 		if (!ts->lat_percentiles) {
 			if (flags & GFIO_HILAT)
 				gfio_show_clat_percentiles(gc, main_vbox, ts, ddir,
-						ts->io_u_plat_high_prio[ddir],
+						ts_plat_high_prio(ts, ddir),
 						ts->clat_high_prio_stat[ddir].samples,
 						"High priority completion");
 			if (flags & GFIO_LOLAT)
 				gfio_show_clat_percentiles(gc, main_vbox, ts, ddir,
-						ts->io_u_plat_low_prio[ddir],
+						ts_plat_low_prio(ts, ddir),
 						ts->clat_low_prio_stat[ddir].samples,
 						"Low priority completion");
 		}
 	}
 	if (ts->lat_percentiles && flags & GFIO_LAT) {
 		gfio_show_clat_percentiles(gc, main_vbox, ts, ddir,
-				ts->io_u_plat[FIO_LAT][ddir],
+				ts_io_u_plat(ts, FIO_LAT, ddir),
 				ts->lat_stat[ddir].samples,
 				"Total");
 		if (flags & GFIO_HILAT)
 			gfio_show_clat_percentiles(gc, main_vbox, ts, ddir,
-					ts->io_u_plat_high_prio[ddir],
+					ts_plat_high_prio(ts, ddir),
 					ts->clat_high_prio_stat[ddir].samples,
 					"High priority total");
 		if (flags & GFIO_LOLAT)
 			gfio_show_clat_percentiles(gc, main_vbox, ts, ddir,
-					ts->io_u_plat_low_prio[ddir],
+					ts_plat_low_prio(ts, ddir),
 					ts->clat_low_prio_stat[ddir].samples,
 					"Low priority total");
 	}
@@ -194,6 +194,11 @@ static struct option l_opts[FIO_NR_OPTIONS] = {
 		.has_arg	= required_argument,
 		.val		= 'X' | FIO_CLIENT_FLAG,
 	},
+	{
+		.name		= (char *) "inflate-range",
+		.has_arg	= required_argument,
+		.val		= 'Y' | FIO_CLIENT_FLAG,
+	},
 #endif
 	{
 		.name		= (char *) "alloc-size",
@@ -487,6 +492,11 @@ static struct thread_data *get_new_job(bool global, struct thread_data *parent,
 	td = &threads[thread_number++];
 	*td = *parent;
 
+	/*
+	 * Each job gets its own latency histograms, in add_job()
+	 */
+	td->ts.plat = NULL;
+
 	INIT_FLIST_HEAD(&td->opt_list);
 	if (parent != &def_thread)
 		copy_opt_list(td, parent);
@@ -534,6 +544,7 @@ static void put_job(struct thread_data *td)
 	if (td->o.name)
 		free(td->o.name);
 
+	free_thread_stat_plat(&td->ts);
 	memset(&threads[td->thread_number - 1], 0, sizeof(*td));
 	thread_number--;
 }
@@ -957,6 +968,26 @@ static int fixup_options(struct thread_data *td)
 	o->max_latency *= 1000ULL;
 	o->latency_target *= 1000ULL;
 	o->latency_window *= 1000ULL;
+	o->lat_hist_max *= 1000ULL;
+
+	if (o->log_format == LOG_FORMAT_BINARY && o->log_gz_store) {
+		log_err("fio: log_format=binary is incompatible with "
+			"log_store_compressed\n");
+		ret |= 1;
+	}
+
+	/*
+	 * Histogram logs and the tools reading them assume the default
+	 * bucket layout
+	 */
+	if (o->write_hist_log &&
+	    (o->lat_hist_precision != FIO_IO_U_PLAT_BITS ||
+	     plat_groups_for(o->lat_hist_precision, o->lat_hist_max) !=
+			FIO_IO_U_PLAT_GROUP_NR)) {
+		log_err("fio: write_hist_log needs the default "
+			"lat_hist_precision and lat_hist_max\n");
+		ret |= 1;
+	}
 
 	return ret;
 }
@@ -1501,6 +1532,11 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num,
 	td->ts.percentile_precision = o->percentile_precision;
 	memcpy(td->ts.percentile_list, o->percentile_list, sizeof(o->percentile_list));
 	td->ts.sig_figs = o->sig_figs;
+	td->ts.plat_bits = o->lat_hist_precision;
+	td->ts.plat_groups = plat_groups_for(o->lat_hist_precision,
+					     o->lat_hist_max);
+	if (alloc_thread_stat_plat(&td->ts))
+		goto err;
 
 	for (i = 0; i < DDIR_RWDIR_CNT; i++) {
 		td->ts.clat_stat[i].min_val = ULONG_MAX;
@@ -1510,6 +1546,8 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num,
 		td->ts.iops_stat[i].min_val = ULONG_MAX;
 		td->ts.clat_high_prio_stat[i].min_val = ULONG_MAX;
 		td->ts.clat_low_prio_stat[i].min_val = ULONG_MAX;
+		td->ts.cachehit_lat_stat[i].min_val = ULONG_MAX;
+		td->ts.cachemiss_lat_stat[i].min_val = ULONG_MAX;
 	}
 	td->ts.sync_stat.min_val = ULONG_MAX;
 	td->ddir_seq_nr = o->ddir_seq_nr;
@@ -1536,9 +1574,11 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num,
 			.hist_msec = o->log_hist_msec,
 			.hist_coarseness = o->log_hist_coarseness,
 			.log_type = IO_LOG_TYPE_LAT,
+			.log_format = o->log_format,
 			.log_offset = o->log_offset,
 			.log_gz = o->log_gz,
 			.log_gz_store = o->log_gz_store,
+			.log_gz_codec = o->log_gz_codec,
 		};
 		const char *pre = make_log_name(o->lat_log_file, o->name);
 		const char *suf;
@@ -1572,6 +1612,7 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num,
 			.log_offset = o->log_offset,
 			.log_gz = o->log_gz,
 			.log_gz_store = o->log_gz_store,
+			.log_gz_codec = o->log_gz_codec,
 		};
 		const char *pre = make_log_name(o->hist_log_file, o->name);
 		const char *suf;
@@ -1593,6 +1634,29 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num,
 		setup_log(&td->clat_hist_log, &p, logname);
 	}
 
+	if (o->write_pct_log) {
+		struct log_params p = {
+			.td = td,
+			.pct_msec = o->log_avg_msec ? o->log_avg_msec : 1000,
+			.log_type = IO_LOG_TYPE_PCT,
+			.log_format = o->log_format,
+			.log_gz = o->log_gz,
+			.log_gz_store = o->log_gz_store,
+			.log_gz_codec = o->log_gz_codec,
+		};
+		const char *pre = make_log_name(o->pct_log_file, o->name);
+		const char *suf;
+
+		if (p.log_gz_store)
+			suf = "log.fz";
+		else
+			suf = "log";
+
+		gen_log_name(logname, sizeof(logname), "clat_pct", pre,
+				td->thread_number, suf, o->per_job_logs);
+		setup_log(&td->clat_pct_log, &p, logname);
+	}
+
 	if (o->write_bw_log) {
 		struct log_params p = {
 			.td = td,
@@ -1600,9 +1664,11 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num,
 			.hist_msec = o->log_hist_msec,
 			.hist_coarseness = o->log_hist_coarseness,
 			.log_type = IO_LOG_TYPE_BW,
+			.log_format = o->log_format,
 			.log_offset = o->log_offset,
 			.log_gz = o->log_gz,
 			.log_gz_store = o->log_gz_store,
+			.log_gz_codec = o->log_gz_codec,
 		};
 		const char *pre = make_log_name(o->bw_log_file, o->name);
 		const char *suf;
@@ -1631,9 +1697,11 @@ static int add_job(struct thread_data *td, const char *jobname, int job_add_num,
 			.hist_msec = o->log_hist_msec,
 			.hist_coarseness = o->log_hist_coarseness,
 			.log_type = IO_LOG_TYPE_IOPS,
+			.log_format = o->log_format,
 			.log_offset = o->log_offset,
 			.log_gz = o->log_gz,
 			.log_gz_store = o->log_gz_store,
+			.log_gz_codec = o->log_gz_codec,
 		};
 		const char *pre = make_log_name(o->iops_log_file, o->name);
 		const char *suf;
@@ -2202,6 +2270,8 @@ static void usage(const char *name)
 		"\t\t\tcalibration only (option=calibrate)\n");
 #ifdef CONFIG_ZLIB
 	printf("  --inflate-log=log\tInflate and output compressed log\n");
+	printf("  --inflate-range=t\tOnly inflate samples in this time range\n"
+		"\t\t\t(start-end, either may be omitted)\n");
 #endif
 	printf("  --trigger-file=file\tExecute trigger cmd when file exists\n");
 	printf("  --trigger-timeout=t\tExecute trigger at this time\n");
@@ -2461,6 +2531,10 @@ int parse_cmd_line(int argc, char *argv[], int client_type)
 	char *pid_file = NULL;
 	void *cur_client = NULL;
 	bool backend = false;
+#ifdef CONFIG_ZLIB
+	uint64_t inflate_start = 0, inflate_end = -1ULL;
+	char *inflate_log = NULL;
+#endif
 
 	/*
 	 * Reset optind handling, since we may call this multiple times
@@ -2627,10 +2701,34 @@ int parse_cmd_line(int argc, char *argv[], int client_type)
 			}
 #ifdef CONFIG_ZLIB
 		case 'X':
-			exit_val = iolog_file_inflate(optarg);
+			inflate_log = optarg;
 			did_arg = true;
-			do_exit++;
 			break;
+		case 'Y': {
+			char *end = strchr(optarg, '-');
+			long long t = 0;
+
+			did_arg = true;
+			if (end)
+				*end++ = '\0';
+			if (*optarg && check_str_time(optarg, &t, 1)) {
+				log_err("fio: failed parsing inflate start %s\n", optarg);
+				exit_val = 1;
+				do_exit++;
+				break;
+			}
+			inflate_start = t / 1000;
+			if (end && *end) {
+				if (check_str_time(end, &t, 1)) {
+					log_err("fio: failed parsing inflate end %s\n", end);
+					exit_val = 1;
+					do_exit++;
+					break;
+				}
+				inflate_end = t / 1000;
+			}
+			break;
+			}
 #endif
 		case 'p':
 			did_arg = true;
@@ -2897,6 +2995,14 @@ int parse_cmd_line(int argc, char *argv[], int client_type)
 			break;
 	}
 
+#ifdef CONFIG_ZLIB
+	if (inflate_log && !do_exit) {
+		exit_val = iolog_file_inflate(inflate_log, inflate_start,
+						inflate_end);
+		do_exit++;
+	}
+#endif
+
 	if (do_exit && !(is_backend || nr_clients))
 		exit(exit_val);
 
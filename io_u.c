@@ -1815,6 +1815,7 @@ static void account_io_completion(struct thread_data *td, struct io_u *io_u,
 				  const enum fio_ddir idx, unsigned int bytes)
 {
 	const int no_reduce = !gtod_reduce(td);
+	struct thread_data *stat_td = stat_shard_td(td);
 	unsigned long long llnsec = 0;
 
 	if (td->parent)
@@ -1830,7 +1831,7 @@ static void account_io_completion(struct thread_data *td, struct io_u *io_u,
 		unsigned long long tnsec;
 
 		tnsec = ntime_since(&io_u->start_time, &icd->time);
-		add_lat_sample(td, idx, tnsec, bytes, io_u->offset, io_u_is_prio(io_u));
+		add_lat_sample(stat_td, idx, tnsec, bytes, io_u->offset, io_u_is_prio(io_u));
 
 		if (td->flags & TD_F_PROFILE_OPS) {
 			struct prof_io_ops *ops = &td->prof_io_ops;
@@ -1849,8 +1850,8 @@ static void account_io_completion(struct thread_data *td, struct io_u *io_u,
 
 	if (ddir_rw(idx)) {
 		if (!td->o.disable_clat) {
-			add_clat_sample(td, idx, llnsec, bytes, io_u->offset, io_u_is_prio(io_u));
-			io_u_mark_latency(td, llnsec);
+			add_clat_sample(stat_td, idx, llnsec, bytes, io_u->offset, io_u_is_prio(io_u));
+			io_u_mark_latency(stat_td, llnsec);
 		}
 
 		if (!td->o.disable_bw && per_unit_log(td->bw_log))
@@ -1859,10 +1860,13 @@ static void account_io_completion(struct thread_data *td, struct io_u *io_u,
 		if (no_reduce && per_unit_log(td->iops_log))
 			add_iops_sample(td, io_u, bytes);
 	} else if (ddir_sync(idx) && !td->o.disable_clat)
-		add_sync_clat_sample(&td->ts, llnsec);
+		add_sync_clat_sample(&stat_td->ts, llnsec);
 
 	if (td->ts.nr_block_infos && io_u->ddir == DDIR_TRIM)
 		trim_block_info(td, io_u);
+
+	if (stat_td != td && ++stat_td->stat_shard_samples >= STAT_SHARD_BATCH)
+		stat_shard_flush(stat_td);
 }
 
 static void file_log_write_comp(const struct thread_data *td, struct fio_file *f,
@@ -2087,10 +2091,7 @@ void io_u_queued(struct thread_data *td, struct io_u *io_u)
 
 		slat_time = ntime_since(&io_u->start_time, &io_u->issue_time);
 
-		if (td->parent)
-			td = td->parent;
-
-		add_slat_sample(td, io_u->ddir, slat_time, io_u->xfer_buflen,
+		add_slat_sample(stat_shard_td(td), io_u->ddir, slat_time, io_u->xfer_buflen,
 				io_u->offset, io_u_is_prio(io_u));
 	}
 }
@@ -11,6 +11,12 @@
 #ifdef CONFIG_ZLIB
 #include <zlib.h>
 #endif
+#ifdef CONFIG_LZ4
+#include <lz4.h>
+#endif
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 
 #include "flist.h"
 #include "fio.h"
@@ -725,12 +731,15 @@ void setup_log(struct io_log **log, struct log_params *p,
 	l = scalloc(1, sizeof(*l));
 	INIT_FLIST_HEAD(&l->io_logs);
 	l->log_type = p->log_type;
+	l->log_format = p->log_format;
 	l->log_offset = p->log_offset;
 	l->log_gz = p->log_gz;
 	l->log_gz_store = p->log_gz_store;
+	l->log_gz_codec = p->log_gz_codec;
 	l->avg_msec = p->avg_msec;
 	l->hist_msec = p->hist_msec;
 	l->hist_coarseness = p->hist_coarseness;
+	l->pct_msec = p->pct_msec;
 	l->filename = strdup(filename);
 	l->td = p->td;
 
@@ -756,6 +765,13 @@ void setup_log(struct io_log **log, struct log_params *p,
 	if (l->log_offset)
 		l->log_ddir_mask = LOG_OFFSET_SAMPLE_BIT;
 
+	if (l->log_type == IO_LOG_TYPE_PCT) {
+		for (i = 0; i < DDIR_RWDIR_CNT; i++)
+			l->pct_window[i].io_u_plat = calloc(plat_nr(&l->td->ts),
+							    sizeof(uint64_t));
+		l->log_ddir_mask |= LOG_PCT_SAMPLE_BIT;
+	}
+
 	INIT_FLIST_HEAD(&l->chunk_list);
 
 	if (l->log_gz && !p->td)
@@ -797,6 +813,8 @@ static void clear_file_buffer(void *buf)
 
 void free_log(struct io_log *log)
 {
+	int i;
+
 	while (!flist_empty(&log->io_logs)) {
 		struct io_logs *cur_log;
 
@@ -812,6 +830,9 @@ void free_log(struct io_log *log)
 		log->pending = NULL;
 	}
 
+	for (i = 0; i < DDIR_RWDIR_CNT; i++)
+		free(log->pct_window[i].io_u_plat);
+
 	free(log->pending);
 	free(log->filename);
 	sfree(log);
@@ -895,7 +916,12 @@ void flush_samples(FILE *f, void *samples, uint64_t sample_size)
 	for (i = 0; i < nr_samples; i++) {
 		s = __get_sample(samples, log_offset, i);
 
-		if (!log_offset) {
+		if (s->__ddir & LOG_PCT_SAMPLE_BIT) {
+			fprintf(f, "%lu, %" PRId64 ", %u, %f\n",
+					(unsigned long) s->time,
+					s->data.val, io_sample_ddir(s),
+					(double) fio_uint64_to_double(s->bs));
+		} else if (!log_offset) {
 			fprintf(f, "%lu, %" PRId64 ", %u, %llu, %u\n",
 					(unsigned long) s->time,
 					s->data.val,
@@ -912,6 +938,273 @@ void flush_samples(FILE *f, void *samples, uint64_t sample_size)
 	}
 }
 
+/*
+ * Compression codecs for log chunks and binary log blocks. Each chunk is
+ * compressed on its own, so chunks of a log can be compressed and
+ * decompressed in parallel. bin_flag marks a binary block compressed with
+ * the codec.
+ */
+struct iolog_codec {
+	const char *name;
+	uint16_t bin_flag;
+	size_t (*bound)(size_t);
+	int (*compress)(void *, size_t *, const void *, size_t);
+	int (*decompress)(void *, size_t, const void *, size_t);
+};
+
+#ifdef CONFIG_ZLIB
+static size_t zlib_bound(size_t len)
+{
+	return compressBound(len);
+}
+
+static int zlib_compress(void *dst, size_t *dst_len, const void *src,
+			 size_t len)
+{
+	uLongf dlen = *dst_len;
+	int ret;
+
+	ret = compress2(dst, &dlen, src, len, Z_DEFAULT_COMPRESSION);
+	if (ret != Z_OK)
+		return ret;
+
+	*dst_len = dlen;
+	return 0;
+}
+
+static int zlib_decompress(void *dst, size_t dst_len, const void *src,
+			   size_t len)
+{
+	uLongf dlen = dst_len;
+	int ret;
+
+	ret = uncompress(dst, &dlen, src, len);
+	if (ret != Z_OK)
+		return ret;
+
+	return dlen != dst_len;
+}
+
+#ifdef CONFIG_LZ4
+static size_t lz4_bound(size_t len)
+{
+	return LZ4_compressBound(len);
+}
+
+static int lz4_compress(void *dst, size_t *dst_len, const void *src,
+			size_t len)
+{
+	int ret;
+
+	ret = LZ4_compress_default(src, dst, len, *dst_len);
+	if (ret <= 0)
+		return 1;
+
+	*dst_len = ret;
+	return 0;
+}
+
+static int lz4_decompress(void *dst, size_t dst_len, const void *src,
+			  size_t len)
+{
+	return LZ4_decompress_safe(src, dst, len, dst_len) != dst_len;
+}
+#endif
+
+#ifdef CONFIG_ZSTD
+static size_t zstd_bound(size_t len)
+{
+	return ZSTD_compressBound(len);
+}
+
+static int zstd_compress(void *dst, size_t *dst_len, const void *src,
+			 size_t len)
+{
+	size_t ret;
+
+	/*
+	 * Favor speed, the point is to keep compression out of the way
+	 * of the IO being measured
+	 */
+	ret = ZSTD_compress(dst, *dst_len, src, len, 1);
+	if (ZSTD_isError(ret))
+		return 1;
+
+	*dst_len = ret;
+	return 0;
+}
+
+static int zstd_decompress(void *dst, size_t dst_len, const void *src,
+			   size_t len)
+{
+	size_t ret;
+
+	ret = ZSTD_decompress(dst, dst_len, src, len);
+	return ZSTD_isError(ret) || ret != dst_len;
+}
+#endif
+
+static const struct iolog_codec iolog_codecs[] = {
+	[LOG_CODEC_ZLIB] = {
+		.name		= "zlib",
+		.bin_flag	= IOLOG_BIN_F_ZLIB,
+		.bound		= zlib_bound,
+		.compress	= zlib_compress,
+		.decompress	= zlib_decompress,
+	},
+#ifdef CONFIG_LZ4
+	[LOG_CODEC_LZ4] = {
+		.name		= "lz4",
+		.bin_flag	= IOLOG_BIN_F_LZ4,
+		.bound		= lz4_bound,
+		.compress	= lz4_compress,
+		.decompress	= lz4_decompress,
+	},
+#endif
+#ifdef CONFIG_ZSTD
+	[LOG_CODEC_ZSTD] = {
+		.name		= "zstd",
+		.bin_flag	= IOLOG_BIN_F_ZSTD,
+		.bound		= zstd_bound,
+		.compress	= zstd_compress,
+		.decompress	= zstd_decompress,
+	},
+#endif
+};
+
+static const struct iolog_codec *get_codec(unsigned int codec)
+{
+	if (codec >= ARRAY_SIZE(iolog_codecs) || !iolog_codecs[codec].name)
+		return NULL;
+
+	return &iolog_codecs[codec];
+}
+#endif
+
+static void flush_bin_block(FILE *f, void *samples, int log_offset,
+			    uint64_t first, uint32_t nr, unsigned int log_type,
+			    const struct iolog_codec *codec)
+{
+	struct iolog_bin_hdr hdr = {
+		.magic		= __cpu_to_le32(IOLOG_BIN_MAGIC),
+		.version	= __cpu_to_le16(IOLOG_BIN_VERSION),
+		.log_type	= cpu_to_le32(log_type),
+		.nr_samples	= cpu_to_le32(nr),
+	};
+	uint64_t *time, *val, *bs, *off = NULL;
+	uint8_t *ddir, *prio;
+	uint16_t flags = 0;
+	size_t raw_len, len;
+	void *buf, *out;
+	struct io_sample *s;
+	uint32_t i;
+
+	raw_len = nr * (3 * sizeof(uint64_t) + 2 * sizeof(uint8_t));
+	if (log_offset) {
+		raw_len += nr * sizeof(uint64_t);
+		flags |= IOLOG_BIN_F_OFFSET;
+	}
+
+	buf = malloc(raw_len);
+	time = buf;
+	val = time + nr;
+	bs = val + nr;
+	if (log_offset) {
+		off = bs + nr;
+		ddir = (uint8_t *) (off + nr);
+	} else
+		ddir = (uint8_t *) (bs + nr);
+	prio = ddir + nr;
+
+	for (i = 0; i < nr; i++) {
+		s = __get_sample(samples, log_offset, first + i);
+
+		if (s->__ddir & LOG_PCT_SAMPLE_BIT)
+			flags |= IOLOG_BIN_F_PCT;
+
+		time[i] = cpu_to_le64(s->time);
+		val[i] = cpu_to_le64(s->data.val);
+		bs[i] = cpu_to_le64(s->bs);
+		if (off)
+			off[i] = cpu_to_le64(((struct io_sample_offset *) s)->offset);
+		ddir[i] = io_sample_ddir(s);
+		prio[i] = s->priority_bit;
+	}
+
+	out = buf;
+	len = raw_len;
+#ifdef CONFIG_ZLIB
+	if (codec) {
+		size_t dlen = codec->bound(raw_len);
+		void *dbuf = malloc(dlen);
+
+		if (!codec->compress(dbuf, &dlen, buf, raw_len) &&
+		    dlen < raw_len) {
+			out = dbuf;
+			len = dlen;
+			flags |= codec->bin_flag;
+		} else
+			free(dbuf);
+	}
+#endif
+
+	hdr.flags = cpu_to_le16(flags);
+	hdr.len = __cpu_to_le32(len);
+	hdr.raw_len = __cpu_to_le32(raw_len);
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    fwrite(out, len, 1, f) != 1)
+		log_err("fio: error writing binary log: %s\n", strerror(errno));
+
+	if (out != buf)
+		free(out);
+	free(buf);
+}
+
+/*
+ * Write samples as binary log blocks of at most IOLOG_BIN_BLOCK_SAMPLES
+ * samples each. If compress is set, every block is compressed with the
+ * LOG_CODEC_* codec, or written raw if fio was built without it.
+ */
+void flush_samples_binary(FILE *f, void *samples, uint64_t sample_size,
+			  unsigned int log_type, bool compress,
+			  unsigned int codec)
+{
+	const struct iolog_codec *c = NULL;
+	struct io_sample *s;
+	int log_offset;
+	uint64_t i, nr_samples;
+
+	if (!sample_size)
+		return;
+
+	s = __get_sample(samples, 0, 0);
+	log_offset = (s->__ddir & LOG_OFFSET_SAMPLE_BIT) != 0;
+
+	nr_samples = sample_size / __log_entry_sz(log_offset);
+
+#ifdef CONFIG_ZLIB
+	if (compress)
+		c = get_codec(codec);
+#endif
+
+	for (i = 0; i < nr_samples; i += IOLOG_BIN_BLOCK_SAMPLES) {
+		uint32_t nr = min(nr_samples - i, (uint64_t) IOLOG_BIN_BLOCK_SAMPLES);
+
+		flush_bin_block(f, samples, log_offset, i, nr, log_type, c);
+	}
+}
+
+static void flush_log_samples(struct io_log *log, FILE *f, void *samples,
+			      uint64_t sample_size)
+{
+	if (log && log->log_format == LOG_FORMAT_BINARY)
+		flush_samples_binary(f, samples, sample_size, log->log_type,
+				     log->log_gz != 0, log->log_gz_codec);
+	else
+		flush_samples(f, samples, sample_size);
+}
+
 #ifdef CONFIG_ZLIB
 
 struct iolog_flush_data {
@@ -919,18 +1212,17 @@ struct iolog_flush_data {
 	struct io_log *log;
 	void *samples;
 	uint32_t nr_samples;
+	unsigned int seq;
 	bool free;
 };
 
-#define GZ_CHUNK	131072
-
-static struct iolog_compress *get_new_chunk(unsigned int seq)
+static struct iolog_compress *get_new_chunk(unsigned int seq, size_t size)
 {
 	struct iolog_compress *c;
 
 	c = malloc(sizeof(*c));
 	INIT_FLIST_HEAD(&c->list);
-	c->buf = malloc(GZ_CHUNK);
+	c->buf = malloc(size);
 	c->len = 0;
 	c->seq = seq;
 	return c;
@@ -972,8 +1264,42 @@ struct inflate_chunk_iter {
 	size_t buf_size;
 	size_t buf_used;
 	size_t chunk_sz;
+	uint64_t start;
+	uint64_t end;
 };
 
+/*
+ * Drop the samples logged outside [start, end] msec, moving the others
+ * to the front of the buffer. Returns the size of the samples kept.
+ */
+static uint64_t filter_samples(void *samples, uint64_t sample_size,
+			       uint64_t start, uint64_t end)
+{
+	uint64_t i, nr_samples, kept = 0;
+	struct io_sample *s;
+	int log_offset;
+	size_t sz;
+
+	if (!sample_size || (!start && end == -1ULL))
+		return sample_size;
+
+	s = __get_sample(samples, 0, 0);
+	log_offset = (s->__ddir & LOG_OFFSET_SAMPLE_BIT) != 0;
+	sz = __log_entry_sz(log_offset);
+	nr_samples = sample_size / sz;
+
+	for (i = 0; i < nr_samples; i++) {
+		s = __get_sample(samples, log_offset, i);
+		if (s->time < start || s->time > end)
+			continue;
+		if (kept != i)
+			memmove(__get_sample(samples, log_offset, kept), s, sz);
+		kept++;
+	}
+
+	return kept * sz;
+}
+
 static void finish_chunk(z_stream *stream, FILE *f,
 			 struct inflate_chunk_iter *iter)
 {
@@ -984,7 +1310,8 @@ static void finish_chunk(z_stream *stream, FILE *f,
 		log_err("fio: failed to end log inflation seq %d (%d)\n",
 				iter->seq, ret);
 
-	flush_samples(f, iter->buf, iter->buf_used);
+	flush_samples(f, iter->buf, filter_samples(iter->buf, iter->buf_used,
+						   iter->start, iter->end));
 	free(iter->buf);
 	iter->buf = NULL;
 	iter->buf_size = iter->buf_used = 0;
@@ -1051,14 +1378,53 @@ static size_t inflate_chunk(struct iolog_compress *ic, int gz_hdr, FILE *f,
 	return ret;
 }
 
+/*
+ * Decompress a chunk framed by an iolog_chunk_hdr. Returns the samples in
+ * a malloc'ed buffer, with their size in raw_len.
+ */
+static void *inflate_chunk_samples(void *buf, size_t len, size_t *raw_len)
+{
+	struct iolog_chunk_hdr *hdr = buf;
+	const struct iolog_codec *codec;
+	void *out;
+
+	if (len < sizeof(*hdr) || le32_to_cpu(hdr->magic) != IOLOG_CHUNK_MAGIC ||
+	    len - sizeof(*hdr) < le32_to_cpu(hdr->len)) {
+		log_err("fio: bad compressed log chunk\n");
+		return NULL;
+	}
+
+	codec = get_codec(le16_to_cpu(hdr->codec));
+	if (!codec) {
+		log_err("fio: log chunk seq %u uses unsupported codec %u\n",
+			le32_to_cpu(hdr->seq), le16_to_cpu(hdr->codec));
+		return NULL;
+	}
+
+	*raw_len = le64_to_cpu(hdr->raw_len);
+	out = malloc(*raw_len + 1);
+	if (!out)
+		return NULL;
+
+	if (codec->decompress(out, *raw_len, hdr + 1, le32_to_cpu(hdr->len))) {
+		log_err("fio: failed %s decompressing log chunk seq %u\n",
+			codec->name, le32_to_cpu(hdr->seq));
+		free(out);
+		return NULL;
+	}
+
+	dprint(FD_COMPRESS, "inflated seq=%u, size=%lu\n",
+			le32_to_cpu(hdr->seq), (unsigned long) *raw_len);
+	return out;
+}
+
 /*
  * Inflate stored compressed chunks, or write them directly to the log
  * file if so instructed.
  */
 static int inflate_gz_chunks(struct io_log *log, FILE *f)
 {
-	struct inflate_chunk_iter iter = { .chunk_sz = log->log_gz, };
-	z_stream stream;
+	int err = 0;
 
 	while (!flist_empty(&log->chunk_list)) {
 		struct iolog_compress *ic;
@@ -1074,31 +1440,128 @@ static int inflate_gz_chunks(struct io_log *log, FILE *f)
 
 			ret = fwrite(ic->buf, ic->len, 1, f);
 			if (ret != 1 || ferror(f)) {
-				iter.err = errno;
+				err = errno;
 				log_err("fio: error writing compressed log\n");
 			}
-		} else
-			inflate_chunk(ic, log->log_gz_store, f, &stream, &iter);
+		} else {
+			size_t raw_len;
+			void *samples;
+
+			samples = inflate_chunk_samples(ic->buf, ic->len, &raw_len);
+			if (samples) {
+				flush_log_samples(log, f, samples, raw_len);
+				free(samples);
+			} else
+				err = EINVAL;
+		}
 
 		free_chunk(ic);
 	}
 
-	if (iter.seq) {
-		finish_chunk(&stream, f, &iter);
-		free(iter.buf);
+	return err;
+}
+
+#define INFLATE_MAX_THREADS	8U
+
+struct inflate_job {
+	void *buf;
+	size_t len;
+	void *samples;
+	size_t raw_len;
+	pthread_t thread;
+	bool started;
+};
+
+static void *inflate_job_fn(void *data)
+{
+	struct inflate_job *job = data;
+
+	job->samples = inflate_chunk_samples(job->buf, job->len, &job->raw_len);
+	return NULL;
+}
+
+/*
+ * Decompress a log stored as iolog_chunk_hdr framed chunks to stdout.
+ * The chunks are independent, so batches of them are decompressed in
+ * parallel, and then written out in order. Chunks whose samples all fall
+ * outside [start, end] msec are skipped without being decompressed.
+ */
+static int inflate_chunk_file(void *buf, size_t len, uint64_t start,
+			      uint64_t end)
+{
+	struct inflate_job jobs[INFLATE_MAX_THREADS];
+	unsigned int nr_threads, nr, i;
+	size_t off = 0;
+	int err = 0;
+
+	nr_threads = max(1U, min((unsigned int) cpus_online(), INFLATE_MAX_THREADS));
+
+	while (off < len && !err) {
+		nr = 0;
+		while (nr < nr_threads && off < len) {
+			struct iolog_chunk_hdr *hdr = buf + off;
+			size_t this_len = len - off;
+
+			if (this_len >= sizeof(*hdr)) {
+				this_len = min(this_len, sizeof(*hdr) +
+						le32_to_cpu(hdr->len));
+				if (le64_to_cpu(hdr->last_time) < start ||
+				    le64_to_cpu(hdr->first_time) > end) {
+					dprint(FD_COMPRESS, "skip seq=%u\n",
+						le32_to_cpu(hdr->seq));
+					off += this_len;
+					continue;
+				}
+			}
+
+			jobs[nr].buf = hdr;
+			jobs[nr].len = this_len;
+			jobs[nr].samples = NULL;
+			off += this_len;
+			nr++;
+		}
+		if (!nr)
+			break;
+
+		for (i = 1; i < nr; i++)
+			jobs[i].started = !pthread_create(&jobs[i].thread, NULL,
+							  inflate_job_fn, &jobs[i]);
+		inflate_job_fn(&jobs[0]);
+
+		for (i = 1; i < nr; i++) {
+			if (jobs[i].started)
+				pthread_join(jobs[i].thread, NULL);
+			else
+				inflate_job_fn(&jobs[i]);
+		}
+
+		for (i = 0; i < nr; i++) {
+			if (jobs[i].samples && !err)
+				flush_samples(stdout, jobs[i].samples,
+					filter_samples(jobs[i].samples,
+						jobs[i].raw_len, start, end));
+			else
+				err = 1;
+			free(jobs[i].samples);
+		}
 	}
 
-	return iter.err;
+	return err;
 }
 
 /*
  * Open compressed log file and decompress the stored chunks and
  * write them to stdout. The chunks are stored sequentially in the
- * file, so we iterate over them and do them one-by-one.
+ * file, so we iterate over them and do them one-by-one. Only samples
+ * logged within [start, end] msec are written.
  */
-int iolog_file_inflate(const char *file)
+int iolog_file_inflate(const char *file, uint64_t start, uint64_t end)
 {
-	struct inflate_chunk_iter iter = { .chunk_sz = 64 * 1024 * 1024, };
+	struct inflate_chunk_iter iter = {
+		.chunk_sz	= 64 * 1024 * 1024,
+		.start		= start,
+		.end		= end,
+	};
 	struct iolog_compress ic;
 	z_stream stream;
 	struct stat sb;
@@ -1138,7 +1601,15 @@ int iolog_file_inflate(const char *file)
 
 	fclose(f);
 
+	if (ic.len >= sizeof(struct iolog_chunk_hdr) &&
+	    le32_to_cpu(((struct iolog_chunk_hdr *) buf)->magic) == IOLOG_CHUNK_MAGIC) {
+		ret = inflate_chunk_file(buf, ic.len, start, end);
+		free(buf);
+		return ret;
+	}
+
 	/*
+	 * Logs stored by older versions are concatenated zlib streams.
 	 * Each chunk will return Z_STREAM_END. We don't know how many
 	 * chunks are in the file, so we just keep looping and incrementing
 	 * the sequence number until we have consumed the whole compressed
@@ -1176,7 +1647,7 @@ static int inflate_gz_chunks(struct io_log *log, FILE *f)
 	return 0;
 }
 
-int iolog_file_inflate(const char *file)
+int iolog_file_inflate(const char *file, uint64_t start, uint64_t end)
 {
 	log_err("fio: log inflation not possible without zlib\n");
 	return 1;
@@ -1212,7 +1683,8 @@ void flush_log(struct io_log *log, bool do_append)
 			flush_hist_samples(f, log->hist_coarseness, cur_log->log,
 			                   log_sample_sz(log, cur_log));
 		else
-			flush_samples(f, cur_log->log, log_sample_sz(log, cur_log));
+			flush_log_samples(log, f, cur_log->log,
+					  log_sample_sz(log, cur_log));
 		
 		sfree(cur_log);
 	}
@@ -1296,119 +1768,83 @@ static void iolog_free_deferred(struct io_log *log)
 	pthread_mutex_unlock(&log->deferred_free_lock);
 }
 
-static int gz_work(struct iolog_flush_data *data)
+/*
+ * Chunks may be completed out of order by the compression workers, keep
+ * the chunk list sorted by sequence.
+ */
+static void iolog_add_chunk(struct io_log *log, struct iolog_compress *c)
 {
-	struct iolog_compress *c = NULL;
-	struct flist_head list;
-	unsigned int seq;
-	z_stream stream;
-	size_t total = 0;
-	int ret;
-
-	INIT_FLIST_HEAD(&list);
+	struct flist_head *entry;
 
-	memset(&stream, 0, sizeof(stream));
-	stream.zalloc = Z_NULL;
-	stream.zfree = Z_NULL;
-	stream.opaque = Z_NULL;
+	pthread_mutex_lock(&log->chunk_lock);
+	for (entry = log->chunk_list.prev; entry != &log->chunk_list;
+	     entry = entry->prev) {
+		struct iolog_compress *prev;
 
-	ret = deflateInit(&stream, Z_DEFAULT_COMPRESSION);
-	if (ret != Z_OK) {
-		log_err("fio: failed to init gz stream\n");
-		goto err;
+		prev = flist_entry(entry, struct iolog_compress, list);
+		if (prev->seq < c->seq)
+			break;
 	}
+	flist_add(&c->list, entry);
+	pthread_mutex_unlock(&log->chunk_lock);
+}
 
-	seq = ++data->log->chunk_seq;
-
-	stream.next_in = (void *) data->samples;
-	stream.avail_in = data->nr_samples * log_entry_sz(data->log);
-
-	dprint(FD_COMPRESS, "deflate input size=%lu, seq=%u, log=%s\n",
-				(unsigned long) stream.avail_in, seq,
-				data->log->filename);
-	do {
-		if (c)
-			dprint(FD_COMPRESS, "seq=%d, chunk=%lu\n", seq,
-				(unsigned long) c->len);
-		c = get_new_chunk(seq);
-		stream.avail_out = GZ_CHUNK;
-		stream.next_out = c->buf;
-		ret = deflate(&stream, Z_NO_FLUSH);
-		if (ret < 0) {
-			log_err("fio: deflate log (%d)\n", ret);
-			free_chunk(c);
-			goto err;
-		}
+static int gz_work(struct iolog_flush_data *data)
+{
+	struct io_log *log = data->log;
+	const struct iolog_codec *codec = get_codec(log->log_gz_codec);
+	size_t raw_len = data->nr_samples * log_entry_sz(log);
+	struct iolog_chunk_hdr *hdr;
+	struct iolog_compress *c;
+	size_t len;
+	int ret;
 
-		c->len = GZ_CHUNK - stream.avail_out;
-		flist_add_tail(&c->list, &list);
-		total += c->len;
-	} while (stream.avail_in);
+	dprint(FD_COMPRESS, "%s input size=%lu, seq=%u, log=%s\n",
+				codec->name, (unsigned long) raw_len, data->seq,
+				log->filename);
 
-	stream.next_out = c->buf + c->len;
-	stream.avail_out = GZ_CHUNK - c->len;
+	len = codec->bound(raw_len);
+	c = get_new_chunk(data->seq, sizeof(*hdr) + len);
 
-	ret = deflate(&stream, Z_FINISH);
-	if (ret < 0) {
-		/*
-		 * Z_BUF_ERROR is special, it just means we need more
-		 * output space. We'll handle that below. Treat any other
-		 * error as fatal.
-		 */
-		if (ret != Z_BUF_ERROR) {
-			log_err("fio: deflate log (%d)\n", ret);
-			flist_del(&c->list);
-			free_chunk(c);
-			goto err;
-		}
+	ret = codec->compress(c->buf + sizeof(*hdr), &len, data->samples,
+				raw_len);
+	if (ret) {
+		log_err("fio: %s compress log (%d)\n", codec->name, ret);
+		free_chunk(c);
+		ret = 1;
+		goto done;
 	}
 
-	total -= c->len;
-	c->len = GZ_CHUNK - stream.avail_out;
-	total += c->len;
-	dprint(FD_COMPRESS, "seq=%d, chunk=%lu\n", seq, (unsigned long) c->len);
-
-	if (ret != Z_STREAM_END) {
-		do {
-			c = get_new_chunk(seq);
-			stream.avail_out = GZ_CHUNK;
-			stream.next_out = c->buf;
-			ret = deflate(&stream, Z_FINISH);
-			c->len = GZ_CHUNK - stream.avail_out;
-			total += c->len;
-			flist_add_tail(&c->list, &list);
-			dprint(FD_COMPRESS, "seq=%d, chunk=%lu\n", seq,
-				(unsigned long) c->len);
-		} while (ret != Z_STREAM_END);
+	hdr = c->buf;
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = __cpu_to_le32(IOLOG_CHUNK_MAGIC);
+	hdr->codec = __cpu_to_le16(log->log_gz_codec);
+	hdr->seq = __cpu_to_le32(data->seq);
+	hdr->len = __cpu_to_le32(len);
+	hdr->raw_len = __cpu_to_le64(raw_len);
+	if (data->nr_samples) {
+		struct io_sample *s;
+
+		s = __get_sample(data->samples, log->log_offset, 0);
+		hdr->first_time = cpu_to_le64(s->time);
+		s = __get_sample(data->samples, log->log_offset,
+					data->nr_samples - 1);
+		hdr->last_time = cpu_to_le64(s->time);
 	}
 
-	dprint(FD_COMPRESS, "deflated to size=%lu\n", (unsigned long) total);
-
-	ret = deflateEnd(&stream);
-	if (ret != Z_OK)
-		log_err("fio: deflateEnd %d\n", ret);
-
-	iolog_put_deferred(data->log, data->samples);
+	c->len = sizeof(*hdr) + len;
+	c->buf = realloc(c->buf, c->len);
 
-	if (!flist_empty(&list)) {
-		pthread_mutex_lock(&data->log->chunk_lock);
-		flist_splice_tail(&list, &data->log->chunk_list);
-		pthread_mutex_unlock(&data->log->chunk_lock);
-	}
+	dprint(FD_COMPRESS, "seq=%u, compressed to size=%lu\n", data->seq,
+				(unsigned long) c->len);
 
+	iolog_put_deferred(log, data->samples);
+	iolog_add_chunk(log, c);
 	ret = 0;
 done:
 	if (data->free)
 		sfree(data);
 	return ret;
-err:
-	while (!flist_empty(&list)) {
-		c = flist_first_entry(list.next, struct iolog_compress, list);
-		flist_del(&c->list);
-		free_chunk(c);
-	}
-	ret = 1;
-	goto done;
 }
 
 /*
@@ -1442,12 +1878,29 @@ static struct workqueue_ops log_compress_wq_ops = {
 	.nice		= 1,
 };
 
+/*
+ * One compression worker, or one per CPU in log_compression_cpus. All the
+ * logs of the job share them.
+ */
+static unsigned int log_compress_workers(struct thread_data *td)
+{
+#ifdef FIO_HAVE_CPU_AFFINITY
+	if (fio_option_is_set(&td->o, log_gz_cpumask)) {
+		unsigned int cpus = fio_cpu_count(&td->o.log_gz_cpumask);
+
+		return max(1U, min(cpus, LOG_COMPRESS_MAX_WORKERS));
+	}
+#endif
+	return 1;
+}
+
 int iolog_compress_init(struct thread_data *td, struct sk_out *sk_out)
 {
 	if (!(td->flags & TD_F_COMPRESS_LOG))
 		return 0;
 
-	workqueue_init(td, &td->log_compress_wq, &log_compress_wq_ops, 1, sk_out);
+	workqueue_init(td, &td->log_compress_wq, &log_compress_wq_ops,
+			log_compress_workers(td), sk_out);
 	return 0;
 }
 
@@ -1475,6 +1928,8 @@ static int iolog_flush(struct io_log *log)
 	if (!data)
 		return 1;
 
+	workqueue_flush(&log->td->log_compress_wq);
+
 	data->log = log;
 	data->free = false;
 
@@ -1486,6 +1941,7 @@ static int iolog_flush(struct io_log *log)
 
 		data->samples = cur_log->log;
 		data->nr_samples = cur_log->nr_samples;
+		data->seq = ++log->chunk_seq;
 
 		sfree(cur_log);
 
@@ -1508,6 +1964,7 @@ int iolog_cur_flush(struct io_log *log, struct io_logs *cur_log)
 
 	data->samples = cur_log->log;
 	data->nr_samples = cur_log->nr_samples;
+	data->seq = ++log->chunk_seq;
 	data->free = true;
 
 	cur_log->nr_samples = cur_log->max_samples = 0;
@@ -1629,6 +2086,20 @@ static int write_clat_hist_log(struct thread_data *td, int try, bool unit_log)
 	return ret;
 }
 
+static int write_clat_pct_log(struct thread_data *td, int try, bool unit_log)
+{
+	int ret;
+
+	if (!unit_log)
+		return 0;
+
+	ret = __write_log(td, td->clat_pct_log, try);
+	if (!ret)
+		td->clat_pct_log = NULL;
+
+	return ret;
+}
+
 static int write_lat_log(struct thread_data *td, int try, bool unit_log)
 {
 	int ret;
@@ -1664,8 +2135,9 @@ enum {
 	CLAT_LOG_MASK	= 8,
 	IOPS_LOG_MASK	= 16,
 	CLAT_HIST_LOG_MASK = 32,
+	CLAT_PCT_LOG_MASK = 64,
 
-	ALL_LOG_NR	= 6,
+	ALL_LOG_NR	= 7,
 };
 
 struct log_type {
@@ -1697,6 +2169,10 @@ static struct log_type log_types[] = {
 	{
 		.mask	= CLAT_HIST_LOG_MASK,
 		.fn	= write_clat_hist_log,
+	},
+	{
+		.mask	= CLAT_PCT_LOG_MASK,
+		.fn	= write_clat_pct_log,
 	}
 };
 
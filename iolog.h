@@ -26,6 +26,12 @@ struct io_hist {
 	struct flist_head list;
 };
 
+struct io_pct {
+	uint64_t samples;
+	unsigned long pct_last;
+	uint64_t *io_u_plat;
+};
+
 
 union io_sample_data {
 	uint64_t val;
@@ -58,8 +64,53 @@ enum {
 	IO_LOG_TYPE_BW,
 	IO_LOG_TYPE_IOPS,
 	IO_LOG_TYPE_HIST,
+	IO_LOG_TYPE_PCT,
+};
+
+enum {
+	LOG_FORMAT_TEXT = 0,
+	LOG_FORMAT_BINARY,
+};
+
+/*
+ * A binary log is a sequence of blocks. Each block is a little endian
+ * iolog_bin_hdr followed by raw_len bytes of samples stored by column:
+ * time, value, bs and (with IOLOG_BIN_F_OFFSET) offset as 64-bit values,
+ * then ddir and priority as bytes. With IOLOG_BIN_F_ZLIB, _LZ4 or _ZSTD,
+ * the columns are compressed into len bytes with that codec. For a
+ * percentile log (IOLOG_BIN_F_PCT), the bs column holds the percentile as
+ * an IEEE 754 double.
+ */
+#define IOLOG_BIN_MAGIC		0x424f4946	/* "FIOB" */
+#define IOLOG_BIN_VERSION	1
+#define IOLOG_BIN_BLOCK_SAMPLES	65536
+
+enum {
+	IOLOG_BIN_F_OFFSET	= 1 << 0,
+	IOLOG_BIN_F_ZLIB	= 1 << 1,
+	IOLOG_BIN_F_PCT		= 1 << 2,
+	IOLOG_BIN_F_LZ4		= 1 << 3,
+	IOLOG_BIN_F_ZSTD	= 1 << 4,
 };
 
+struct iolog_bin_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t flags;
+	uint32_t log_type;
+	uint32_t nr_samples;
+	uint32_t len;
+	uint32_t raw_len;
+};
+
+enum {
+	LOG_CODEC_ZLIB = 0,
+	LOG_CODEC_LZ4,
+	LOG_CODEC_ZSTD,
+};
+
+#define LOG_COMPRESS_MAX_WORKERS	8U
+
 #define DEF_LOG_ENTRIES		1024
 #define MAX_LOG_ENTRIES		(1024 * DEF_LOG_ENTRIES)
 
@@ -94,6 +145,11 @@ struct io_log {
 
 	unsigned int log_type;
 
+	/*
+	 * LOG_FORMAT_TEXT or LOG_FORMAT_BINARY
+	 */
+	unsigned int log_format;
+
 	/*
 	 * If we fail extending the log, stop collecting more entries.
 	 */
@@ -114,6 +170,11 @@ struct io_log {
 	 */
 	unsigned int log_gz_store;
 
+	/*
+	 * LOG_CODEC_* used to compress chunks
+	 */
+	unsigned int log_gz_codec;
+
 	/*
 	 * Windowed average, for logging single entries average over some
 	 * period of time.
@@ -131,6 +192,14 @@ struct io_log {
 	unsigned long hist_msec;
 	unsigned int hist_coarseness;
 
+	/*
+	 * Windowed latency percentiles. Each window holds only the delta
+	 * histogram of the samples since the last entry, the percentiles
+	 * of which are logged every pct_msec milliseconds.
+	 */
+	struct io_pct pct_window[DDIR_RWDIR_CNT];
+	unsigned long pct_msec;
+
 	pthread_mutex_t chunk_lock;
 	unsigned int chunk_seq;
 	struct flist_head chunk_list;
@@ -142,10 +211,14 @@ struct io_log {
 };
 
 /*
- * If the upper bit is set, then we have the offset as well
+ * If the upper bit is set, then we have the offset as well. The next bit
+ * marks a percentile sample, where bs holds the percentile as a packed
+ * double instead of a block size.
  */
 #define LOG_OFFSET_SAMPLE_BIT	0x80000000U
-#define io_sample_ddir(io)	((io)->__ddir & ~LOG_OFFSET_SAMPLE_BIT)
+#define LOG_PCT_SAMPLE_BIT	0x40000000U
+#define io_sample_ddir(io)	((io)->__ddir & \
+				 ~(LOG_OFFSET_SAMPLE_BIT | LOG_PCT_SAMPLE_BIT))
 
 static inline void io_sample_set_ddir(struct io_log *log,
 				      struct io_sample *io,
@@ -248,7 +321,7 @@ extern size_t log_chunk_sizes(struct io_log *);
 extern int init_io_u_buffers(struct thread_data *);
 
 #ifdef CONFIG_ZLIB
-extern int iolog_file_inflate(const char *);
+extern int iolog_file_inflate(const char *, uint64_t, uint64_t);
 #endif
 
 /*
@@ -259,10 +332,13 @@ struct log_params {
 	unsigned long avg_msec;
 	unsigned long hist_msec;
 	int hist_coarseness;
+	unsigned long pct_msec;
 	int log_type;
+	int log_format;
 	int log_offset;
 	int log_gz;
 	int log_gz_store;
+	int log_gz_codec;
 	int log_compress;
 };
 
@@ -290,6 +366,8 @@ extern void finalize_logs(struct thread_data *td, bool);
 extern void setup_log(struct io_log **, struct log_params *, const char *);
 extern void flush_log(struct io_log *, bool);
 extern void flush_samples(FILE *, void *, uint64_t);
+extern void flush_samples_binary(FILE *, void *, uint64_t, unsigned int, bool,
+				 unsigned int);
 extern uint64_t hist_sum(int, int, uint64_t *, uint64_t *);
 extern void free_log(struct io_log *);
 extern void fio_writeout_logs(bool);
@@ -302,6 +380,25 @@ static inline void init_ipo(struct io_piece *ipo)
 	INIT_FLIST_HEAD(&ipo->trim_list);
 }
 
+/*
+ * A compressed chunk of log samples, buf holds an iolog_chunk_hdr followed
+ * by the compressed samples. Logs stored compressed are a sequence of such
+ * chunks. The header notes the time range of the samples, so readers can
+ * walk the headers and only decompress the chunks of a given time range.
+ */
+#define IOLOG_CHUNK_MAGIC	0x5a4f4946	/* "FIOZ" */
+
+struct iolog_chunk_hdr {
+	uint32_t magic;
+	uint16_t codec;
+	uint16_t pad;
+	uint32_t seq;
+	uint32_t len;
+	uint64_t raw_len;
+	uint64_t first_time;
+	uint64_t last_time;
+};
+
 struct iolog_compress {
 	struct flist_head list;
 	void *buf;
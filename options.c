@@ -546,8 +546,8 @@ static int str_cpumask_cb(void *data, unsigned long long *val)
 	return 0;
 }
 
-static int set_cpus_allowed(struct thread_data *td, os_cpu_mask_t *mask,
-			    const char *input)
+int set_cpus_allowed(struct thread_data *td, os_cpu_mask_t *mask,
+		     const char *input)
 {
 	char *cpu, *str, *p;
 	long max_cpu;
@@ -1518,6 +1518,17 @@ static int str_write_hist_log_cb(void *data, const char *str)
 	return 0;
 }
 
+static int str_write_pct_log_cb(void *data, const char *str)
+{
+	struct thread_data *td = cb_data_to_td(data);
+
+	if (str)
+		td->o.pct_log_file = strdup(str);
+
+	td->o.write_pct_log = 1;
+	return 0;
+}
+
 /*
  * str is supposed to be a substring of the strdup'd original string,
  * and is valid only if it's a regular file path.
@@ -4095,6 +4106,16 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_LOG,
 		.group	= FIO_OPT_G_INVALID,
 	},
+	{
+		.name	= "write_pct_log",
+		.lname	= "Write latency percentile logs",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct thread_options, pct_log_file),
+		.cb	= str_write_pct_log_cb,
+		.help	= "Write log of completion latency percentiles during run",
+		.category = FIO_OPT_C_LOG,
+		.group	= FIO_OPT_G_INVALID,
+	},
 	{
 		.name	= "log_max_value",
 		.lname	= "Log maximum instead of average",
@@ -4115,6 +4136,26 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_LOG,
 		.group	= FIO_OPT_G_INVALID,
 	},
+	{
+		.name	= "log_format",
+		.lname	= "Log format",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct thread_options, log_format),
+		.help	= "Format of bw/iops/lat logs",
+		.def	= "text",
+		.category = FIO_OPT_C_LOG,
+		.group	= FIO_OPT_G_INVALID,
+		.posval = {
+			  { .ival = "text",
+			    .oval = LOG_FORMAT_TEXT,
+			    .help = "One line of text per sample",
+			  },
+			  { .ival = "binary",
+			    .oval = LOG_FORMAT_BINARY,
+			    .help = "Blocks of samples stored by column",
+			  },
+		},
+	},
 #ifdef CONFIG_ZLIB
 	{
 		.name	= "log_compression",
@@ -4147,6 +4188,35 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.help	= "Your platform does not support CPU affinities",
 	},
 #endif
+	{
+		.name	= "log_compression_codec",
+		.lname	= "Log compression codec",
+		.type	= FIO_OPT_STR,
+		.off1	= offsetof(struct thread_options, log_gz_codec),
+		.help	= "Codec used to compress log chunks",
+		.def	= "zlib",
+		.parent = "log_compression",
+		.category = FIO_OPT_C_LOG,
+		.group	= FIO_OPT_G_INVALID,
+		.posval = {
+			  { .ival = "zlib",
+			    .oval = LOG_CODEC_ZLIB,
+			    .help = "zlib deflate",
+			  },
+#ifdef CONFIG_LZ4
+			  { .ival = "lz4",
+			    .oval = LOG_CODEC_LZ4,
+			    .help = "LZ4, fastest",
+			  },
+#endif
+#ifdef CONFIG_ZSTD
+			  { .ival = "zstd",
+			    .oval = LOG_CODEC_ZSTD,
+			    .help = "Zstandard, fast with good ratio",
+			  },
+#endif
+		},
+	},
 	{
 		.name	= "log_store_compressed",
 		.lname	= "Log store compressed",
@@ -4163,6 +4233,12 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.type	= FIO_OPT_UNSUPPORTED,
 		.help	= "Install libz-dev(el) to get compression support",
 	},
+	{
+		.name	= "log_compression_codec",
+		.lname	= "Log compression codec",
+		.type	= FIO_OPT_UNSUPPORTED,
+		.help	= "Install libz-dev(el) to get compression support",
+	},
 	{
 		.name	= "log_store_compressed",
 		.lname	= "Log store compressed",
@@ -4357,6 +4433,29 @@ struct fio_option fio_options[FIO_MAX_OPTS] = {
 		.category = FIO_OPT_C_STAT,
 		.group	= FIO_OPT_G_INVALID,
 	},
+	{
+		.name	= "lat_hist_precision",
+		.lname	= "Latency histogram precision",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct thread_options, lat_hist_precision),
+		.help	= "Bits of precision of the latency histograms",
+		.def	= "6",
+		.minval	= 1,
+		.maxval	= FIO_IO_U_PLAT_BITS_MAX,
+		.category = FIO_OPT_C_STAT,
+		.group	= FIO_OPT_G_INVALID,
+	},
+	{
+		.name	= "lat_hist_max",
+		.lname	= "Latency histogram range (usec)",
+		.type	= FIO_OPT_STR_VAL_TIME,
+		.off1	= offsetof(struct thread_options, lat_hist_max),
+		.help	= "Largest latency the histograms track accurately (usec)",
+		.is_time = 1,
+		.def	= "0",
+		.category = FIO_OPT_C_STAT,
+		.group	= FIO_OPT_G_INVALID,
+	},
 	{
 		.name	= "significant_figures",
 		.lname	= "Significant figures",
@@ -7,6 +7,7 @@
 #include <inttypes.h>
 #include "parse.h"
 #include "lib/types.h"
+#include "os/os.h"
 
 int add_option(const struct fio_option *);
 void invalidate_profile_options(const char *);
@@ -21,6 +22,10 @@ int get_max_str_idx(char *input);
 char* get_name_by_idx(char *input, int index);
 int set_name_idx(char *, size_t, char *, int, bool);
 
+#ifdef FIO_HAVE_CPU_AFFINITY
+int set_cpus_allowed(struct thread_data *, os_cpu_mask_t *, const char *);
+#endif
+
 extern char client_sockaddr_str[];  /* used with --client option */
 
 extern struct fio_option fio_options[FIO_MAX_OPTS];
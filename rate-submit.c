@@ -121,6 +121,9 @@ static void io_workqueue_pre_sleep_fn(struct submit_worker *sw)
 	ret = io_u_quiesce(td);
 	if (ret > 0)
 		td->cur_depth -= ret;
+
+	if (td->stat_shard_samples)
+		stat_shard_flush(td);
 }
 
 static int io_workqueue_alloc_fn(struct submit_worker *sw)
@@ -134,6 +137,9 @@ static int io_workqueue_alloc_fn(struct submit_worker *sw)
 
 static void io_workqueue_free_fn(struct submit_worker *sw)
 {
+	struct thread_data *td = sw->priv;
+
+	free_thread_stat_plat(&td->ts);
 	free(sw->priv);
 	sw->priv = NULL;
 }
@@ -145,6 +151,8 @@ static int io_workqueue_init_worker_fn(struct submit_worker *sw)
 
 	memcpy(&td->o, &parent->o, sizeof(td->o));
 	memcpy(&td->ts, &parent->ts, sizeof(td->ts));
+	if (alloc_thread_stat_plat(&td->ts))
+		return 1;
 	td->o.uid = td->o.gid = -1U;
 	dup_files(td, parent);
 	td->eo = parent->eo;
@@ -175,6 +183,14 @@ static int io_workqueue_init_worker_fn(struct submit_worker *sw)
 	td_set_runstate(td, TD_RUNNING);
 	td->flags |= TD_F_CHILD | TD_F_NEED_LOCK;
 	td->parent = parent;
+
+	/*
+	 * Keep latencies in our own stats and fold them into the parent's
+	 * in batches, unless they have to be logged per IO.
+	 */
+	if (!parent->lat_log && !parent->clat_log && !parent->slat_log &&
+	    !parent->clat_hist_log && !parent->clat_pct_log)
+		td->stat_shard = true;
 	return 0;
 
 err_io_init:
@@ -189,6 +205,9 @@ static void io_workqueue_exit_worker_fn(struct submit_worker *sw,
 {
 	struct thread_data *td = sw->priv;
 
+	if (td->stat_shard_samples)
+		stat_shard_flush(td);
+
 	(*sum_cnt)++;
 	sum_thread_stats(&sw->wq->td->ts, &td->ts, *sum_cnt == 1);
 
@@ -1456,6 +1456,113 @@ static void convert_gs(struct group_run_stats *dst, struct group_run_stats *src)
 	dst->sig_figs	= cpu_to_le32(src->sig_figs);
 }
 
+/*
+ * The latency histograms aren't part of the TS pdu, they are sent after
+ * it. Few of their buckets are ever set, so each row is sent as the
+ * number of buckets set, followed by an (index, count) pair for each of
+ * them. Returns the length, which is all that is done if out is NULL.
+ */
+static size_t ts_plat_pack(struct thread_stat *ts, uint64_t *out)
+{
+	const unsigned int nr = plat_nr(ts);
+	unsigned int r, k, set;
+	size_t len = 0;
+	uint64_t *row;
+
+	for (r = 0; r < FIO_PLAT_ROWS; r++) {
+		row = ts->plat ? ts_plat_row(ts, r) : NULL;
+
+		set = 0;
+		for (k = 0; row && k < nr; k++)
+			if (row[k])
+				set++;
+
+		len += (1 + 2 * set) * sizeof(uint64_t);
+		if (!out)
+			continue;
+
+		*out++ = __cpu_to_le64(set);
+		for (k = 0; row && k < nr; k++) {
+			if (!row[k])
+				continue;
+			*out++ = __cpu_to_le64(k);
+			*out++ = cpu_to_le64(row[k]);
+		}
+	}
+
+	return len;
+}
+
+/*
+ * Expand the histograms packed by ts_plat_pack() after a TS pdu. Returns
+ * a new cmd holding the struct cmd_ts_pdu, whatever data trailed the
+ * histograms, and then the histograms themselves, which p->ts.plat points
+ * to. Returns NULL if the pdu is malformed.
+ */
+struct fio_net_cmd *fio_server_unpack_ts(struct fio_net_cmd *cmd)
+{
+	struct cmd_ts_pdu *p = (struct cmd_ts_pdu *) cmd->payload;
+	unsigned int bits, groups, nr, r;
+	size_t len = sizeof(*p), trail;
+	struct fio_net_cmd *ret;
+	uint64_t *in, *plat, set, k, idx;
+
+	if (cmd->pdu_len < len)
+		return NULL;
+
+	bits = le32_to_cpu(p->ts.plat_bits);
+	groups = le32_to_cpu(p->ts.plat_groups);
+	if (!bits || bits > FIO_IO_U_PLAT_BITS_MAX || groups < 2 ||
+	    groups > 65 - bits)
+		return NULL;
+	nr = groups << bits;
+
+	/*
+	 * Walk the histograms once to validate them and find the end
+	 */
+	for (r = 0; r < FIO_PLAT_ROWS; r++) {
+		if (len + sizeof(uint64_t) > cmd->pdu_len)
+			return NULL;
+		in = (uint64_t *) (cmd->payload + len);
+		set = le64_to_cpu(*in);
+		if (set > nr)
+			return NULL;
+		len += (1 + 2 * set) * sizeof(uint64_t);
+	}
+	if (len > cmd->pdu_len)
+		return NULL;
+
+	trail = cmd->pdu_len - len;
+	ret = calloc(1, sizeof(*cmd) + sizeof(*p) + trail +
+			FIO_PLAT_ROWS * nr * sizeof(uint64_t));
+	if (!ret)
+		return NULL;
+
+	memcpy(ret, cmd, sizeof(*cmd));
+	ret->pdu_len = sizeof(*p) + trail + FIO_PLAT_ROWS * nr * sizeof(uint64_t);
+	memcpy(ret->payload, p, sizeof(*p));
+	memcpy(ret->payload + sizeof(*p), cmd->payload + len, trail);
+
+	p = (struct cmd_ts_pdu *) ret->payload;
+	plat = (uint64_t *) (ret->payload + sizeof(*p) + trail);
+
+	in = (uint64_t *) (cmd->payload + sizeof(*p));
+	for (r = 0; r < FIO_PLAT_ROWS; r++) {
+		set = le64_to_cpu(*in++);
+		for (k = 0; k < set; k++) {
+			idx = le64_to_cpu(*in++);
+			if (idx >= nr) {
+				free(ret);
+				return NULL;
+			}
+			plat[r * nr + idx] = *in++;
+		}
+	}
+
+	p->ts.plat = plat;
+	return ret;
+}
+
 /*
  * Send a CMD_TS, which packs struct thread_stat and group_run_stats
  * into a single payload.
@@ -1463,8 +1570,9 @@ static void convert_gs(struct group_run_stats *dst, struct group_run_stats *src)
 void fio_server_send_ts(struct thread_stat *ts, struct group_run_stats *rs)
 {
 	struct cmd_ts_pdu p;
-	int i, j, k;
-	void *ss_buf;
+	size_t len, ss_len;
+	int i;
+	uint8_t *buf;
 	uint64_t *ss_iops, *ss_bw;
 
 	dprint(FD_NET, "server sending end stats\n");
@@ -1500,6 +1608,8 @@ void fio_server_send_ts(struct thread_stat *ts, struct group_run_stats *rs)
 	p.ts.clat_percentiles	= cpu_to_le32(ts->clat_percentiles);
 	p.ts.lat_percentiles	= cpu_to_le32(ts->lat_percentiles);
 	p.ts.slat_percentiles	= cpu_to_le32(ts->slat_percentiles);
+	p.ts.plat_bits		= cpu_to_le32(ts->plat_bits);
+	p.ts.plat_groups	= cpu_to_le32(ts->plat_groups);
 	p.ts.percentile_precision = cpu_to_le64(ts->percentile_precision);
 
 	for (i = 0; i < FIO_IO_U_LIST_MAX_LEN; i++) {
@@ -1522,14 +1632,6 @@ void fio_server_send_ts(struct thread_stat *ts, struct group_run_stats *rs)
 	for (i = 0; i < FIO_IO_U_LAT_M_NR; i++)
 		p.ts.io_u_lat_m[i]	= cpu_to_le64(ts->io_u_lat_m[i]);
 
-	for (i = 0; i < FIO_LAT_CNT; i++)
-		for (j = 0; j < DDIR_RWDIR_CNT; j++)
-			for (k = 0; k < FIO_IO_U_PLAT_NR; k++)
-				p.ts.io_u_plat[i][j][k] = cpu_to_le64(ts->io_u_plat[i][j][k]);
-
-	for (j = 0; j < FIO_IO_U_PLAT_NR; j++)
-		p.ts.io_u_sync_plat[j] = cpu_to_le64(ts->io_u_sync_plat[j]);
-
 	for (i = 0; i < DDIR_RWDIR_SYNC_CNT; i++)
 		p.ts.total_io_u[i]	= cpu_to_le64(ts->total_io_u[i]);
 
@@ -1575,39 +1677,43 @@ void fio_server_send_ts(struct thread_stat *ts, struct group_run_stats *rs)
 
 	p.ts.cachehit		= cpu_to_le64(ts->cachehit);
 	p.ts.cachemiss		= cpu_to_le64(ts->cachemiss);
+	p.ts.nr_timeouts	= cpu_to_le64(ts->nr_timeouts);
 
 	for (i = 0; i < DDIR_RWDIR_CNT; i++) {
-		for (j = 0; j < FIO_IO_U_PLAT_NR; j++) {
-			p.ts.io_u_plat_high_prio[i][j] = cpu_to_le64(ts->io_u_plat_high_prio[i][j]);
-			p.ts.io_u_plat_low_prio[i][j] = cpu_to_le64(ts->io_u_plat_low_prio[i][j]);
-		}
 		convert_io_stat(&p.ts.clat_high_prio_stat[i], &ts->clat_high_prio_stat[i]);
 		convert_io_stat(&p.ts.clat_low_prio_stat[i], &ts->clat_low_prio_stat[i]);
+		convert_io_stat(&p.ts.cachehit_lat_stat[i], &ts->cachehit_lat_stat[i]);
+		convert_io_stat(&p.ts.cachemiss_lat_stat[i], &ts->cachemiss_lat_stat[i]);
 	}
 
 	convert_gs(&p.rs, rs);
 
+	len = sizeof(p) + ts_plat_pack(ts, NULL);
+	ss_len = 0;
+
 	dprint(FD_NET, "ts->ss_state = %d\n", ts->ss_state);
-	if (ts->ss_state & FIO_SS_DATA) {
-		dprint(FD_NET, "server sending steadystate ring buffers\n");
+	if (ts->ss_state & FIO_SS_DATA)
+		ss_len = 2 * ts->ss_dur * sizeof(uint64_t);
 
-		ss_buf = malloc(sizeof(p) + 2*ts->ss_dur*sizeof(uint64_t));
+	buf = malloc(len + ss_len);
+	memcpy(buf, &p, sizeof(p));
+	ts_plat_pack(ts, (uint64_t *) (buf + sizeof(p)));
 
-		memcpy(ss_buf, &p, sizeof(p));
+	if (ss_len) {
+		dprint(FD_NET, "server sending steadystate ring buffers\n");
 
-		ss_iops = (uint64_t *) ((struct cmd_ts_pdu *)ss_buf + 1);
+		ss_iops = (uint64_t *) (buf + len);
 		ss_bw = ss_iops + (int) ts->ss_dur;
 		for (i = 0; i < ts->ss_dur; i++) {
 			ss_iops[i] = cpu_to_le64(ts->ss_iops_data[i]);
 			ss_bw[i] = cpu_to_le64(ts->ss_bw_data[i]);
 		}
-
-		fio_net_queue_cmd(FIO_NET_CMD_TS, ss_buf, sizeof(p) + 2*ts->ss_dur*sizeof(uint64_t), NULL, SK_F_COPY);
-
-		free(ss_buf);
 	}
-	else
-		fio_net_queue_cmd(FIO_NET_CMD_TS, &p, sizeof(p), NULL, SK_F_COPY);
+
+	dprint(FD_NET, "server ts pdu %zu bytes, %zu unpacked\n", len + ss_len,
+		sizeof(p) + ss_len + FIO_PLAT_ROWS * plat_nr(ts) * sizeof(uint64_t));
+	fio_net_queue_cmd(FIO_NET_CMD_TS, buf, len + ss_len, NULL, SK_F_COPY);
+	free(buf);
 }
 
 void fio_server_send_gs(struct group_run_stats *rs)
@@ -1980,6 +2086,9 @@ int fio_send_iolog(struct thread_data *td, struct io_log *log, const char *name)
 		.thread_number		= cpu_to_le32(td->thread_number),
 		.log_type		= cpu_to_le32(log->log_type),
 		.log_hist_coarseness	= cpu_to_le32(log->hist_coarseness),
+		.log_format		= cpu_to_le32(log->log_format),
+		.log_gz			= cpu_to_le32(log->log_gz),
+		.log_gz_codec		= cpu_to_le32(log->log_gz_codec),
 	};
 	struct sk_entry *first;
 	struct flist_head *entry;
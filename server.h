@@ -48,7 +48,7 @@ struct fio_net_cmd_reply {
 };
 
 enum {
-	FIO_SERVER_VER			= 82,
+	FIO_SERVER_VER			= 90,
 
 	FIO_SERVER_MAX_FRAGMENT_PDU	= 1024,
 	FIO_SERVER_MAX_CMD_MB		= 2048,
@@ -194,6 +194,9 @@ struct cmd_iolog_pdu {
 	uint32_t compressed;
 	uint32_t log_offset;
 	uint32_t log_hist_coarseness;
+	uint32_t log_format;
+	uint32_t log_gz;
+	uint32_t log_gz_codec;
 	uint8_t name[FIO_NET_NAME_MAX];
 	struct io_sample samples[0];
 };
@@ -217,6 +220,7 @@ extern const char *fio_server_op(unsigned int);
 extern void fio_server_got_signal(int);
 
 extern void fio_server_send_ts(struct thread_stat *, struct group_run_stats *);
+extern struct fio_net_cmd *fio_server_unpack_ts(struct fio_net_cmd *);
 extern void fio_server_send_gs(struct group_run_stats *);
 extern void fio_server_send_du(void);
 extern void fio_server_send_job_options(struct flist_head *, unsigned int);
@@ -2,6 +2,7 @@
 #include <string.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <math.h>
 
 #include "fio.h"
@@ -57,8 +58,10 @@ void update_rusage_stat(struct thread_data *td)
  * group by looking at the index bits.
  *
  */
-static unsigned int plat_val_to_idx(unsigned long long val)
+static unsigned int plat_val_to_idx(struct thread_stat *ts,
+				    unsigned long long val)
 {
+	const unsigned int bits = ts->plat_bits;
 	unsigned int msb, error_bits, base, offset, idx;
 
 	/* Find MSB starting from bit 0 */
@@ -68,27 +71,27 @@ static unsigned int plat_val_to_idx(unsigned long long val)
 		msb = (sizeof(val)*8) - __builtin_clzll(val) - 1;
 
 	/*
-	 * MSB <= (FIO_IO_U_PLAT_BITS-1), cannot be rounded off. Use
-	 * all bits of the sample as index
+	 * MSB <= (bits-1), cannot be rounded off. Use all bits of the
+	 * sample as index
 	 */
-	if (msb <= FIO_IO_U_PLAT_BITS)
+	if (msb <= bits)
 		return val;
 
 	/* Compute the number of error bits to discard*/
-	error_bits = msb - FIO_IO_U_PLAT_BITS;
+	error_bits = msb - bits;
 
 	/* Compute the number of buckets before the group */
-	base = (error_bits + 1) << FIO_IO_U_PLAT_BITS;
+	base = (error_bits + 1) << bits;
 
 	/*
 	 * Discard the error bits and apply the mask to find the
 	 * index for the buckets in the group
 	 */
-	offset = (FIO_IO_U_PLAT_VAL - 1) & (val >> error_bits);
+	offset = ((1U << bits) - 1) & (val >> error_bits);
 
 	/* Make sure the index does not exceed (array size - 1) */
-	idx = (base + offset) < (FIO_IO_U_PLAT_NR - 1) ?
-		(base + offset) : (FIO_IO_U_PLAT_NR - 1);
+	idx = (base + offset) < (plat_nr(ts) - 1) ?
+		(base + offset) : (plat_nr(ts) - 1);
 
 	return idx;
 }
@@ -97,27 +100,84 @@ static unsigned int plat_val_to_idx(unsigned long long val)
  * Convert the given index of the bucket array to the value
  * represented by the bucket
  */
-static unsigned long long plat_idx_to_val(unsigned int idx)
+static unsigned long long plat_idx_to_val(struct thread_stat *ts,
+					  unsigned int idx)
 {
+	const unsigned int bits = ts->plat_bits;
 	unsigned int error_bits;
 	unsigned long long k, base;
 
-	assert(idx < FIO_IO_U_PLAT_NR);
+	assert(idx < plat_nr(ts));
 
-	/* MSB <= (FIO_IO_U_PLAT_BITS-1), cannot be rounded off. Use
-	 * all bits of the sample as index */
-	if (idx < (FIO_IO_U_PLAT_VAL << 1))
+	/* MSB <= (bits-1), cannot be rounded off. Use all bits of the
+	 * sample as index */
+	if (idx < (2U << bits))
 		return idx;
 
 	/* Find the group and compute the minimum value of that group */
-	error_bits = (idx >> FIO_IO_U_PLAT_BITS) - 1;
-	base = ((unsigned long long) 1) << (error_bits + FIO_IO_U_PLAT_BITS);
+	error_bits = (idx >> bits) - 1;
+	base = ((unsigned long long) 1) << (error_bits + bits);
 
 	/* Find its bucket number of the group */
-	k = idx % FIO_IO_U_PLAT_VAL;
+	k = idx & ((1U << bits) - 1);
 
 	/* Return the mean of the range of the bucket */
-	return base + ((k + 0.5) * (1 << error_bits));
+	return base + ((k + 0.5) * (1ULL << error_bits));
+}
+
+/*
+ * Groups of 2^bits buckets needed to track latencies up to 'max' nsec. A
+ * 'max' of 0 asks for the range of the default geometry.
+ */
+unsigned int plat_groups_for(unsigned int bits, unsigned long long max)
+{
+	unsigned int msb;
+
+	if (!max)
+		return FIO_IO_U_PLAT_GROUP_NR + FIO_IO_U_PLAT_BITS - bits;
+
+	msb = (sizeof(max)*8) - __builtin_clzll(max) - 1;
+	if (msb <= bits)
+		return 2;
+
+	return msb - bits + 2;
+}
+
+static size_t plat_size(struct thread_stat *ts)
+{
+	return FIO_PLAT_ROWS * plat_nr(ts) * sizeof(uint64_t);
+}
+
+/*
+ * Allocate zeroed latency histograms for the geometry in ts->plat_bits
+ * and ts->plat_groups. They are mapped shared, so the parent sees the
+ * samples a job process adds, and only the pages of buckets that get
+ * samples take up memory.
+ */
+int alloc_thread_stat_plat(struct thread_stat *ts)
+{
+	void *p;
+
+	p = mmap(NULL, plat_size(ts), PROT_READ | PROT_WRITE,
+			OS_MAP_ANON | MAP_SHARED, -1, 0);
+	if (p == MAP_FAILED) {
+		log_err("fio: failed allocating latency histograms: %s\n",
+			strerror(errno));
+		ts->plat = NULL;
+		return 1;
+	}
+
+	ts->plat = p;
+	return 0;
+}
+
+void free_thread_stat_plat(struct thread_stat *ts)
+{
+	if (!ts->plat)
+		return;
+
+	munmap(ts->plat, plat_size(ts));
+	ts->plat = NULL;
 }
 
 static int double_cmp(const void *a, const void *b)
@@ -134,7 +194,8 @@ static int double_cmp(const void *a, const void *b)
 	return cmp;
 }
 
-unsigned int calc_clat_percentiles(uint64_t *io_u_plat, unsigned long long nr,
+unsigned int calc_clat_percentiles(struct thread_stat *ts,
+				   uint64_t *io_u_plat, unsigned long long nr,
 				   fio_fp64_t *plist, unsigned long long **output,
 				   unsigned long long *maxv, unsigned long long *minv)
 {
@@ -169,12 +230,12 @@ unsigned int calc_clat_percentiles(uint64_t *io_u_plat, unsigned long long nr,
 	 * Calculate bucket values, note down max and min values
 	 */
 	is_last = false;
-	for (i = 0; i < FIO_IO_U_PLAT_NR && !is_last; i++) {
+	for (i = 0; i < plat_nr(ts) && !is_last; i++) {
 		sum += io_u_plat[i];
 		while (sum >= ((long double) plist[j].u.f / 100.0 * nr)) {
 			assert(plist[j].u.f <= 100.0);
 
-			ovals[j] = plat_idx_to_val(i);
+			ovals[j] = plat_idx_to_val(ts, i);
 			if (ovals[j] < *minv)
 				*minv = ovals[j];
 			if (ovals[j] > *maxv)
@@ -198,7 +259,8 @@ unsigned int calc_clat_percentiles(uint64_t *io_u_plat, unsigned long long nr,
 /*
  * Find and display the p-th percentile of clat
  */
-static void show_clat_percentiles(uint64_t *io_u_plat, unsigned long long nr,
+static void show_clat_percentiles(struct thread_stat *ts,
+				  uint64_t *io_u_plat, unsigned long long nr,
 				  fio_fp64_t *plist, unsigned int precision,
 				  const char *pre, struct buf_output *out)
 {
@@ -209,7 +271,7 @@ static void show_clat_percentiles(uint64_t *io_u_plat, unsigned long long nr,
 	bool is_last;
 	char fmt[32];
 
-	len = calc_clat_percentiles(io_u_plat, nr, plist, &ovals, &maxv, &minv);
+	len = calc_clat_percentiles(ts, io_u_plat, nr, plist, &ovals, &maxv, &minv);
 	if (!len || !ovals)
 		goto out;
 
@@ -427,7 +489,7 @@ static void show_ddir_status(struct group_run_stats *rs, struct thread_stat *ts,
 		if (calc_lat(&ts->sync_stat, &min, &max, &mean, &dev)) {
 			log_buf(out, "  %s:\n", "fsync/fdatasync/sync_file_range");
 			display_lat(io_ddir_name(ddir), min, max, mean, dev, out);
-			show_clat_percentiles(ts->io_u_sync_plat,
+			show_clat_percentiles(ts, ts_sync_plat(ts),
 						ts->sync_stat.samples,
 						ts->percentile_list,
 						ts->percentile_precision,
@@ -489,19 +551,23 @@ static void show_ddir_status(struct group_run_stats *rs, struct thread_stat *ts,
 			display_lat(ts->lat_percentiles ? "low prio_lat" : "low prio_clat",
 					min, max, mean, dev, out);
 	}
+	if (calc_lat(&ts->cachehit_lat_stat[ddir], &min, &max, &mean, &dev))
+		display_lat("cache hit lat", min, max, mean, dev, out);
+	if (calc_lat(&ts->cachemiss_lat_stat[ddir], &min, &max, &mean, &dev))
+		display_lat("cache miss lat", min, max, mean, dev, out);
 
 	if (ts->slat_percentiles && ts->slat_stat[ddir].samples > 0)
-		show_clat_percentiles(ts->io_u_plat[FIO_SLAT][ddir],
+		show_clat_percentiles(ts, ts_io_u_plat(ts, FIO_SLAT, ddir),
 					ts->slat_stat[ddir].samples,
 					ts->percentile_list,
 					ts->percentile_precision, "slat", out);
 	if (ts->clat_percentiles && ts->clat_stat[ddir].samples > 0)
-		show_clat_percentiles(ts->io_u_plat[FIO_CLAT][ddir],
+		show_clat_percentiles(ts, ts_io_u_plat(ts, FIO_CLAT, ddir),
 					ts->clat_stat[ddir].samples,
 					ts->percentile_list,
 					ts->percentile_precision, "clat", out);
 	if (ts->lat_percentiles && ts->lat_stat[ddir].samples > 0)
-		show_clat_percentiles(ts->io_u_plat[FIO_LAT][ddir],
+		show_clat_percentiles(ts, ts_io_u_plat(ts, FIO_LAT, ddir),
 					ts->lat_stat[ddir].samples,
 					ts->percentile_list,
 					ts->percentile_precision, "lat", out);
@@ -523,7 +589,7 @@ static void show_ddir_status(struct group_run_stats *rs, struct thread_stat *ts,
 			sprintf(prio_name, "high prio (%.2f%%) %s",
 					100. * (double) ts->clat_high_prio_stat[ddir].samples / (double) samples,
 					name);
-			show_clat_percentiles(ts->io_u_plat_high_prio[ddir],
+			show_clat_percentiles(ts, ts_plat_high_prio(ts, ddir),
 						ts->clat_high_prio_stat[ddir].samples,
 						ts->percentile_list,
 						ts->percentile_precision, prio_name, out);
@@ -531,7 +597,7 @@ static void show_ddir_status(struct group_run_stats *rs, struct thread_stat *ts,
 			sprintf(prio_name, "low prio (%.2f%%) %s",
 					100. * (double) ts->clat_low_prio_stat[ddir].samples / (double) samples,
 					name);
-			show_clat_percentiles(ts->io_u_plat_low_prio[ddir],
+			show_clat_percentiles(ts, ts_plat_low_prio(ts, ddir),
 						ts->clat_low_prio_stat[ddir].samples,
 						ts->percentile_list,
 						ts->percentile_precision, prio_name, out);
@@ -1137,6 +1203,10 @@ static void show_thread_status_normal(struct thread_stat *ts,
 					ts->first_error,
 					strerror(ts->first_error));
 	}
+	if (ts->nr_timeouts) {
+		log_buf(out, "     timeouts  : total=%llu\n",
+					(unsigned long long)ts->nr_timeouts);
+	}
 	if (ts->latency_depth) {
 		log_buf(out, "     latency   : target=%llu, window=%llu, percentile=%.2f%%, depth=%u\n",
 					(unsigned long long)ts->latency_target,
@@ -1188,12 +1258,12 @@ static void show_ddir_status_terse(struct thread_stat *ts,
 		log_buf(out, ";%llu;%llu;%f;%f", 0ULL, 0ULL, 0.0, 0.0);
 
 	if (ts->lat_percentiles)
-		len = calc_clat_percentiles(ts->io_u_plat[FIO_LAT][ddir],
+		len = calc_clat_percentiles(ts, ts_io_u_plat(ts, FIO_LAT, ddir),
 					ts->lat_stat[ddir].samples,
 					ts->percentile_list, &ovals, &maxv,
 					&minv);
 	else if (ts->clat_percentiles)
-		len = calc_clat_percentiles(ts->io_u_plat[FIO_CLAT][ddir],
+		len = calc_clat_percentiles(ts, ts_io_u_plat(ts, FIO_CLAT, ddir),
 					ts->clat_stat[ddir].samples,
 					ts->percentile_list, &ovals, &maxv,
 					&minv);
@@ -1264,7 +1334,7 @@ static struct json_object *add_ddir_lat_json(struct thread_stat *ts, uint32_t pe
 	json_object_add_value_int(lat_object, "N", lat_stat->samples);
 
 	if (percentiles && lat_stat->samples) {
-		len = calc_clat_percentiles(io_u_plat, lat_stat->samples,
+		len = calc_clat_percentiles(ts, io_u_plat, lat_stat->samples,
 				ts->percentile_list, &ovals, &maxv, &minv);
 
 		if (len > FIO_IO_U_LIST_MAX_LEN)
@@ -1282,9 +1352,9 @@ static struct json_object *add_ddir_lat_json(struct thread_stat *ts, uint32_t pe
 			clat_bins_object = json_create_object();
 			json_object_add_value_object(lat_object, "bins", clat_bins_object);
 
-			for(i = 0; i < FIO_IO_U_PLAT_NR; i++)
+			for(i = 0; i < plat_nr(ts); i++)
 				if (io_u_plat[i]) {
-					snprintf(buf, sizeof(buf), "%llu", plat_idx_to_val(i));
+					snprintf(buf, sizeof(buf), "%llu", plat_idx_to_val(ts, i));
 					json_object_add_value_int(clat_bins_object, buf, io_u_plat[i]);
 				}
 		}
@@ -1334,20 +1404,20 @@ static void add_ddir_status_json(struct thread_stat *ts,
 		json_object_add_value_int(dir_object, "drop_ios", ts->drop_io_u[ddir]);
 
 		tmp_object = add_ddir_lat_json(ts, ts->slat_percentiles,
-				&ts->slat_stat[ddir], ts->io_u_plat[FIO_SLAT][ddir]);
+				&ts->slat_stat[ddir], ts_io_u_plat(ts, FIO_SLAT, ddir));
 		json_object_add_value_object(dir_object, "slat_ns", tmp_object);
 
 		tmp_object = add_ddir_lat_json(ts, ts->clat_percentiles,
-				&ts->clat_stat[ddir], ts->io_u_plat[FIO_CLAT][ddir]);
+				&ts->clat_stat[ddir], ts_io_u_plat(ts, FIO_CLAT, ddir));
 		json_object_add_value_object(dir_object, "clat_ns", tmp_object);
 
 		tmp_object = add_ddir_lat_json(ts, ts->lat_percentiles,
-				&ts->lat_stat[ddir], ts->io_u_plat[FIO_LAT][ddir]);
+				&ts->lat_stat[ddir], ts_io_u_plat(ts, FIO_LAT, ddir));
 		json_object_add_value_object(dir_object, "lat_ns", tmp_object);
 	} else {
 		json_object_add_value_int(dir_object, "total_ios", ts->total_io_u[DDIR_SYNC]);
 		tmp_object = add_ddir_lat_json(ts, ts->lat_percentiles | ts->clat_percentiles,
-				&ts->sync_stat, ts->io_u_sync_plat);
+				&ts->sync_stat, ts_sync_plat(ts));
 		json_object_add_value_object(dir_object, "lat_ns", tmp_object);
 	}
 
@@ -1367,14 +1437,23 @@ static void add_ddir_status_json(struct thread_stat *ts,
 		}
 
 		tmp_object = add_ddir_lat_json(ts, ts->clat_percentiles | ts->lat_percentiles,
-				&ts->clat_high_prio_stat[ddir], ts->io_u_plat_high_prio[ddir]);
+				&ts->clat_high_prio_stat[ddir], ts_plat_high_prio(ts, ddir));
 		json_object_add_value_object(dir_object, high, tmp_object);
 
 		tmp_object = add_ddir_lat_json(ts, ts->clat_percentiles | ts->lat_percentiles,
-				&ts->clat_low_prio_stat[ddir], ts->io_u_plat_low_prio[ddir]);
+				&ts->clat_low_prio_stat[ddir], ts_plat_low_prio(ts, ddir));
 		json_object_add_value_object(dir_object, low, tmp_object);
 	}
 
+	/* Only print cache latencies if the engine told hits from misses */
+	if (ts->cachehit_lat_stat[ddir].samples + ts->cachemiss_lat_stat[ddir].samples) {
+		tmp_object = add_ddir_lat_json(ts, 0, &ts->cachehit_lat_stat[ddir], NULL);
+		json_object_add_value_object(dir_object, "cachehit_lat_ns", tmp_object);
+
+		tmp_object = add_ddir_lat_json(ts, 0, &ts->cachemiss_lat_stat[ddir], NULL);
+		json_object_add_value_object(dir_object, "cachemiss_lat_ns", tmp_object);
+	}
+
 	if (calc_lat(&ts->bw_stat[ddir], &min, &max, &mean, &dev)) {
 		if (rs->agg[ddir]) {
 			p_of_agg = mean * 100 / (double) (rs->agg[ddir] / 1024);
@@ -1650,6 +1729,10 @@ static struct json_object *show_thread_status_json(struct thread_stat *ts,
 		json_object_add_value_int(root, "first_error", ts->first_error);
 	}
 
+	/* Only if the engine timed out I/Os */
+	if (ts->nr_timeouts)
+		json_object_add_value_int(root, "total_timeouts", ts->nr_timeouts);
+
 	if (ts->latency_depth) {
 		json_object_add_value_int(root, "latency_depth", ts->latency_depth);
 		json_object_add_value_int(root, "latency_target", ts->latency_target);
@@ -1871,16 +1954,58 @@ void sum_group_stats(struct group_run_stats *dst, struct group_run_stats *src)
 		dst->sig_figs = src->sig_figs;
 }
 
+/*
+ * Add up latency histograms. With the same geometry on both sides this
+ * is a flat loop the compiler vectorizes, otherwise each bucket of src
+ * goes to the bucket of dst that covers its value.
+ */
+static void sum_plat(struct thread_stat *dst, uint64_t *dst_plat,
+		     struct thread_stat *src, uint64_t *src_plat)
+{
+	const unsigned int nr = plat_nr(src);
+	unsigned int i;
+
+	if (dst->plat_bits == src->plat_bits &&
+	    dst->plat_groups == src->plat_groups) {
+		for (i = 0; i < nr; i++)
+			dst_plat[i] += src_plat[i];
+		return;
+	}
+
+	for (i = 0; i < nr; i++) {
+		if (src_plat[i]) {
+			unsigned long long val = plat_idx_to_val(src, i);
+
+			dst_plat[plat_val_to_idx(dst, val)] += src_plat[i];
+		}
+	}
+}
+
 void sum_thread_stats(struct thread_stat *dst, struct thread_stat *src,
 		      bool first)
 {
 	int k, l, m;
 
+	/*
+	 * The first stats summed decide the histogram geometry, later ones
+	 * with another geometry are re-bucketed into it
+	 */
+	if (first && dst->plat && (dst->plat_bits != src->plat_bits ||
+	    dst->plat_groups != src->plat_groups))
+		free_thread_stat_plat(dst);
+	if (!dst->plat) {
+		dst->plat_bits = src->plat_bits;
+		dst->plat_groups = src->plat_groups;
+		alloc_thread_stat_plat(dst);
+	}
+
 	for (l = 0; l < DDIR_RWDIR_CNT; l++) {
 		if (!dst->unified_rw_rep) {
 			sum_stat(&dst->clat_stat[l], &src->clat_stat[l], first, false);
 			sum_stat(&dst->clat_high_prio_stat[l], &src->clat_high_prio_stat[l], first, false);
 			sum_stat(&dst->clat_low_prio_stat[l], &src->clat_low_prio_stat[l], first, false);
+			sum_stat(&dst->cachehit_lat_stat[l], &src->cachehit_lat_stat[l], first, false);
+			sum_stat(&dst->cachemiss_lat_stat[l], &src->cachemiss_lat_stat[l], first, false);
 			sum_stat(&dst->slat_stat[l], &src->slat_stat[l], first, false);
 			sum_stat(&dst->lat_stat[l], &src->lat_stat[l], first, false);
 			sum_stat(&dst->bw_stat[l], &src->bw_stat[l], first, true);
@@ -1894,6 +2019,8 @@ void sum_thread_stats(struct thread_stat *dst, struct thread_stat *src,
 			sum_stat(&dst->clat_stat[0], &src->clat_stat[l], first, false);
 			sum_stat(&dst->clat_high_prio_stat[0], &src->clat_high_prio_stat[l], first, false);
 			sum_stat(&dst->clat_low_prio_stat[0], &src->clat_low_prio_stat[l], first, false);
+			sum_stat(&dst->cachehit_lat_stat[0], &src->cachehit_lat_stat[l], first, false);
+			sum_stat(&dst->cachemiss_lat_stat[0], &src->cachemiss_lat_stat[l], first, false);
 			sum_stat(&dst->slat_stat[0], &src->slat_stat[l], first, false);
 			sum_stat(&dst->lat_stat[0], &src->lat_stat[l], first, false);
 			sum_stat(&dst->bw_stat[0], &src->bw_stat[l], first, true);
@@ -1946,27 +2073,21 @@ void sum_thread_stats(struct thread_stat *dst, struct thread_stat *src,
 
 	dst->total_io_u[DDIR_SYNC] += src->total_io_u[DDIR_SYNC];
 
-	for (k = 0; k < FIO_LAT_CNT; k++)
-		for (l = 0; l < DDIR_RWDIR_CNT; l++)
-			for (m = 0; m < FIO_IO_U_PLAT_NR; m++)
-				if (!dst->unified_rw_rep)
-					dst->io_u_plat[k][l][m] += src->io_u_plat[k][l][m];
-				else
-					dst->io_u_plat[k][0][m] += src->io_u_plat[k][l][m];
+	if (dst->plat) {
+		for (k = 0; k < FIO_LAT_CNT; k++)
+			for (l = 0; l < DDIR_RWDIR_CNT; l++)
+				sum_plat(dst, ts_io_u_plat(dst, k, dst->unified_rw_rep ? 0 : l),
+					 src, ts_io_u_plat(src, k, l));
 
-	for (k = 0; k < FIO_IO_U_PLAT_NR; k++)
-		dst->io_u_sync_plat[k] += src->io_u_sync_plat[k];
+		sum_plat(dst, ts_sync_plat(dst), src, ts_sync_plat(src));
 
-	for (k = 0; k < DDIR_RWDIR_CNT; k++) {
-		for (m = 0; m < FIO_IO_U_PLAT_NR; m++) {
-			if (!dst->unified_rw_rep) {
-				dst->io_u_plat_high_prio[k][m] += src->io_u_plat_high_prio[k][m];
-				dst->io_u_plat_low_prio[k][m] += src->io_u_plat_low_prio[k][m];
-			} else {
-				dst->io_u_plat_high_prio[0][m] += src->io_u_plat_high_prio[k][m];
-				dst->io_u_plat_low_prio[0][m] += src->io_u_plat_low_prio[k][m];
-			}
+		for (k = 0; k < DDIR_RWDIR_CNT; k++) {
+			m = dst->unified_rw_rep ? 0 : k;
 
+			sum_plat(dst, ts_plat_high_prio(dst, m),
+				 src, ts_plat_high_prio(src, k));
+			sum_plat(dst, ts_plat_low_prio(dst, m),
+				 src, ts_plat_low_prio(src, k));
 		}
 	}
 
@@ -1974,6 +2095,7 @@ void sum_thread_stats(struct thread_stat *dst, struct thread_stat *src,
 	dst->total_submit += src->total_submit;
 	dst->total_complete += src->total_complete;
 	dst->nr_zone_resets += src->nr_zone_resets;
+	dst->nr_timeouts += src->nr_timeouts;
 	dst->cachehit += src->cachehit;
 	dst->cachemiss += src->cachemiss;
 }
@@ -2001,9 +2123,13 @@ void init_thread_stat(struct thread_stat *ts)
 		ts->iops_stat[j].min_val = -1UL;
 		ts->clat_high_prio_stat[j].min_val = -1UL;
 		ts->clat_low_prio_stat[j].min_val = -1UL;
+		ts->cachehit_lat_stat[j].min_val = -1UL;
+		ts->cachemiss_lat_stat[j].min_val = -1UL;
 	}
 	ts->sync_stat.min_val = -1UL;
 	ts->groupid = -1;
+	ts->plat_bits = FIO_IO_U_PLAT_BITS;
+	ts->plat_groups = FIO_IO_U_PLAT_GROUP_NR;
 }
 
 void __show_run_stats(void)
@@ -2297,6 +2423,8 @@ void __show_run_stats(void)
 
 	log_info_flush();
 	free(runstats);
+	for (i = 0; i < nr_ts; i++)
+		free_thread_stat_plat(&threadstats[i]);
 	free(threadstats);
 	free(opt_lists);
 }
@@ -2542,6 +2670,7 @@ void regrow_logs(struct thread_data *td)
 	regrow_log(td->slat_log);
 	regrow_log(td->clat_log);
 	regrow_log(td->clat_hist_log);
+	regrow_log(td->clat_pct_log);
 	regrow_log(td->lat_log);
 	regrow_log(td->bw_log);
 	regrow_log(td->iops_log);
@@ -2626,11 +2755,13 @@ static inline void reset_io_stat(struct io_stat *ios)
 void reset_io_stats(struct thread_data *td)
 {
 	struct thread_stat *ts = &td->ts;
-	int i, j, k;
+	int i;
 
 	for (i = 0; i < DDIR_RWDIR_CNT; i++) {
 		reset_io_stat(&ts->clat_high_prio_stat[i]);
 		reset_io_stat(&ts->clat_low_prio_stat[i]);
+		reset_io_stat(&ts->cachehit_lat_stat[i]);
+		reset_io_stat(&ts->cachemiss_lat_stat[i]);
 		reset_io_stat(&ts->clat_stat[i]);
 		reset_io_stat(&ts->slat_stat[i]);
 		reset_io_stat(&ts->lat_stat[i]);
@@ -2643,18 +2774,9 @@ void reset_io_stats(struct thread_data *td)
 		ts->short_io_u[i] = 0;
 		ts->drop_io_u[i] = 0;
 
-		for (j = 0; j < FIO_IO_U_PLAT_NR; j++) {
-			ts->io_u_plat_high_prio[i][j] = 0;
-			ts->io_u_plat_low_prio[i][j] = 0;
-			if (!i)
-				ts->io_u_sync_plat[j] = 0;
-		}
 	}
 
-	for (i = 0; i < FIO_LAT_CNT; i++)
-		for (j = 0; j < DDIR_RWDIR_CNT; j++)
-			for (k = 0; k < FIO_IO_U_PLAT_NR; k++)
-				ts->io_u_plat[i][j][k] = 0;
+	memset(ts->plat, 0, FIO_PLAT_ROWS * plat_nr(ts) * sizeof(uint64_t));
 
 	ts->total_io_u[DDIR_SYNC] = 0;
 
@@ -2674,9 +2796,90 @@ void reset_io_stats(struct thread_data *td)
 	ts->total_submit = 0;
 	ts->total_complete = 0;
 	ts->nr_zone_resets = 0;
+	ts->nr_timeouts = 0;
 	ts->cachehit = ts->cachemiss = 0;
 }
 
+static void flush_plat(uint64_t *dst, uint64_t *src, unsigned int nr)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr; i++) {
+		if (src[i]) {
+			dst[i] += src[i];
+			src[i] = 0;
+		}
+	}
+}
+
+static void flush_stat(struct io_stat *dst, struct io_stat *src)
+{
+	sum_stat(dst, src, false, false);
+	reset_io_stat(src);
+}
+
+/*
+ * Fold the latency samples an offload worker gathered in its own stats
+ * into the parent, and start over. Done in batches, when the worker goes
+ * idle and when it exits, so completions don't serialize on the parent's
+ * lock. Only the percentile rows that got samples need to be walked.
+ */
+void stat_shard_flush(struct thread_data *td)
+{
+	struct thread_stat *dst = &td->parent->ts;
+	struct thread_stat *src = &td->ts;
+	const unsigned int nr = plat_nr(src);
+	int i;
+
+	__td_io_u_lock(td->parent);
+
+	for (i = 0; i < DDIR_RWDIR_CNT; i++) {
+		if (src->clat_stat[i].samples)
+			flush_plat(ts_io_u_plat(dst, FIO_CLAT, i),
+				   ts_io_u_plat(src, FIO_CLAT, i), nr);
+		if (src->slat_stat[i].samples)
+			flush_plat(ts_io_u_plat(dst, FIO_SLAT, i),
+				   ts_io_u_plat(src, FIO_SLAT, i), nr);
+		if (src->lat_stat[i].samples)
+			flush_plat(ts_io_u_plat(dst, FIO_LAT, i),
+				   ts_io_u_plat(src, FIO_LAT, i), nr);
+		if (src->clat_high_prio_stat[i].samples)
+			flush_plat(ts_plat_high_prio(dst, i),
+				   ts_plat_high_prio(src, i), nr);
+		if (src->clat_low_prio_stat[i].samples)
+			flush_plat(ts_plat_low_prio(dst, i),
+				   ts_plat_low_prio(src, i), nr);
+
+		flush_stat(&dst->clat_stat[i], &src->clat_stat[i]);
+		flush_stat(&dst->clat_high_prio_stat[i], &src->clat_high_prio_stat[i]);
+		flush_stat(&dst->clat_low_prio_stat[i], &src->clat_low_prio_stat[i]);
+		flush_stat(&dst->slat_stat[i], &src->slat_stat[i]);
+		flush_stat(&dst->lat_stat[i], &src->lat_stat[i]);
+	}
+
+	if (src->sync_stat.samples) {
+		flush_plat(ts_sync_plat(dst), ts_sync_plat(src), nr);
+		flush_stat(&dst->sync_stat, &src->sync_stat);
+	}
+
+	for (i = 0; i < FIO_IO_U_LAT_N_NR; i++) {
+		dst->io_u_lat_n[i] += src->io_u_lat_n[i];
+		src->io_u_lat_n[i] = 0;
+	}
+	for (i = 0; i < FIO_IO_U_LAT_U_NR; i++) {
+		dst->io_u_lat_u[i] += src->io_u_lat_u[i];
+		src->io_u_lat_u[i] = 0;
+	}
+	for (i = 0; i < FIO_IO_U_LAT_M_NR; i++) {
+		dst->io_u_lat_m[i] += src->io_u_lat_m[i];
+		src->io_u_lat_m[i] = 0;
+	}
+
+	__td_io_u_unlock(td->parent);
+
+	td->stat_shard_samples = 0;
+}
+
 static void __add_stat_to_log(struct io_log *iolog, enum fio_ddir ddir,
 			      unsigned long elapsed, bool log_max, uint8_t priority_bit)
 {
@@ -2755,6 +2958,64 @@ static unsigned long add_log_sample(struct thread_data *td,
 	return iolog->avg_msec;
 }
 
+/*
+ * Log the percentile_list values of the latencies seen in the current
+ * window of a percentile log, and start a new window.
+ */
+static void __add_pct_to_log(struct thread_data *td, struct io_log *iolog,
+			     enum fio_ddir ddir, unsigned long elapsed)
+{
+	struct io_pct *pw = &iolog->pct_window[ddir];
+	struct thread_stat *ts = &td->ts;
+	unsigned long long *ovals = NULL;
+	unsigned long long minv, maxv;
+	unsigned int i, len;
+
+	if (!pw->samples)
+		return;
+
+	len = calc_clat_percentiles(ts, pw->io_u_plat, pw->samples,
+				    ts->percentile_list, &ovals, &maxv, &minv);
+	for (i = 0; i < len; i++) {
+		uint64_t pct = fio_double_to_uint64(ts->percentile_list[i].u.f);
+
+		__add_log_sample(iolog, sample_val(ovals[i]), ddir, pct,
+				 elapsed, 0, 0);
+	}
+	free(ovals);
+
+	memset(pw->io_u_plat, 0, plat_nr(ts) * sizeof(uint64_t));
+	pw->samples = 0;
+}
+
+static void add_pct_sample(struct thread_data *td, struct io_log *iolog,
+			   enum fio_ddir ddir, unsigned long long nsec)
+{
+	struct io_pct *pw = &iolog->pct_window[ddir];
+	unsigned long elapsed, this_window;
+
+	if (!ddir_rw(ddir))
+		return;
+
+	pw->io_u_plat[plat_val_to_idx(&td->ts, nsec)]++;
+	pw->samples++;
+
+	elapsed = mtime_since_now(&td->epoch);
+	if (elapsed < pw->pct_last)
+		return;
+	this_window = elapsed - pw->pct_last;
+	if (this_window < iolog->pct_msec)
+		return;
+
+	__add_pct_to_log(td, iolog, ddir, elapsed);
+
+	/*
+	 * Keep the windows aligned to the epoch, even if no IO completed
+	 * for a while.
+	 */
+	pw->pct_last = elapsed - (this_window % iolog->pct_msec);
+}
+
 void finalize_logs(struct thread_data *td, bool unit_logs)
 {
 	unsigned long elapsed;
@@ -2771,6 +3032,12 @@ void finalize_logs(struct thread_data *td, bool unit_logs)
 		_add_stat_to_log(td->bw_log, elapsed, td->o.log_max != 0, 0);
 	if (td->iops_log && (unit_logs == per_unit_log(td->iops_log)))
 		_add_stat_to_log(td->iops_log, elapsed, td->o.log_max != 0, 0);
+	if (td->clat_pct_log && unit_logs) {
+		int ddir;
+
+		for (ddir = 0; ddir < DDIR_RWDIR_CNT; ddir++)
+			__add_pct_to_log(td, td->clat_pct_log, ddir, elapsed);
+	}
 }
 
 void add_agg_sample(union io_sample_data data, enum fio_ddir ddir, unsigned long long bs,
@@ -2787,41 +3054,62 @@ void add_agg_sample(union io_sample_data data, enum fio_ddir ddir, unsigned long
 
 void add_sync_clat_sample(struct thread_stat *ts, unsigned long long nsec)
 {
-	unsigned int idx = plat_val_to_idx(nsec);
-	assert(idx < FIO_IO_U_PLAT_NR);
+	unsigned int idx = plat_val_to_idx(ts, nsec);
 
-	ts->io_u_sync_plat[idx]++;
+	ts_sync_plat(ts)[idx]++;
 	add_stat_sample(&ts->sync_stat, nsec);
 }
 
+/*
+ * For engines that know whether an I/O was served from the page cache
+ */
+void add_cache_lat_sample(struct thread_stat *ts, enum fio_ddir ddir,
+			  unsigned long long nsec, bool hit)
+{
+	if (hit) {
+		ts->cachehit++;
+		add_stat_sample(&ts->cachehit_lat_stat[ddir], nsec);
+	} else {
+		ts->cachemiss++;
+		add_stat_sample(&ts->cachemiss_lat_stat[ddir], nsec);
+	}
+}
+
 static void add_lat_percentile_sample_noprio(struct thread_stat *ts,
 				unsigned long long nsec, enum fio_ddir ddir, enum fio_lat lat)
 {
-	unsigned int idx = plat_val_to_idx(nsec);
-	assert(idx < FIO_IO_U_PLAT_NR);
+	unsigned int idx = plat_val_to_idx(ts, nsec);
 
-	ts->io_u_plat[lat][ddir][idx]++;
+	ts_io_u_plat(ts, lat, ddir)[idx]++;
 }
 
 static void add_lat_percentile_sample(struct thread_stat *ts,
 				unsigned long long nsec, enum fio_ddir ddir, uint8_t priority_bit,
 				enum fio_lat lat)
 {
-	unsigned int idx = plat_val_to_idx(nsec);
+	unsigned int idx = plat_val_to_idx(ts, nsec);
 
 	add_lat_percentile_sample_noprio(ts, nsec, ddir, lat);
 
 	if (!priority_bit)
-		ts->io_u_plat_low_prio[ddir][idx]++;
+		ts_plat_low_prio(ts, ddir)[idx]++;
 	else
-		ts->io_u_plat_high_prio[ddir][idx]++;
+		ts_plat_high_prio(ts, ddir)[idx]++;
+}
+
+/*
+ * A stat shard is only ever written by the worker that owns it
+ */
+static inline bool stat_needs_lock(struct thread_data *td)
+{
+	return td_async_processing(td) && !td->stat_shard;
 }
 
 void add_clat_sample(struct thread_data *td, enum fio_ddir ddir,
 		     unsigned long long nsec, unsigned long long bs,
 		     uint64_t offset, uint8_t priority_bit)
 {
-	const bool needs_lock = td_async_processing(td);
+	const bool needs_lock = stat_needs_lock(td);
 	unsigned long elapsed, this_window;
 	struct thread_stat *ts = &td->ts;
 	struct io_log *iolog = td->clat_hist_log;
@@ -2849,6 +3137,9 @@ void add_clat_sample(struct thread_data *td, enum fio_ddir ddir,
 			add_lat_percentile_sample(ts, nsec, ddir, priority_bit, FIO_CLAT);
 	}
 
+	if (td->clat_pct_log)
+		add_pct_sample(td, td->clat_pct_log, ddir, nsec);
+
 	if (iolog && iolog->hist_msec) {
 		struct io_hist *hw = &iolog->hist_window[ddir];
 
@@ -2864,12 +3155,12 @@ void add_clat_sample(struct thread_data *td, enum fio_ddir ddir,
 
 			/*
 			 * Make a byte-for-byte copy of the latency histogram
-			 * stored in td->ts.io_u_plat[ddir], recording it in a
+			 * of the clat row of td->ts, recording it in a
 			 * log sample. Note that the matching call to free() is
 			 * located in iolog.c after printing this sample to the
 			 * log file.
 			 */
-			io_u_plat = (uint64_t *) td->ts.io_u_plat[FIO_CLAT][ddir];
+			io_u_plat = ts_io_u_plat(&td->ts, FIO_CLAT, ddir);
 			dst = malloc(sizeof(struct io_u_plat_entry));
 			memcpy(&(dst->io_u_plat), io_u_plat,
 				FIO_IO_U_PLAT_NR * sizeof(uint64_t));
@@ -2895,7 +3186,7 @@ void add_slat_sample(struct thread_data *td, enum fio_ddir ddir,
 			unsigned long long nsec, unsigned long long bs, uint64_t offset,
 			uint8_t priority_bit)
 {
-	const bool needs_lock = td_async_processing(td);
+	const bool needs_lock = stat_needs_lock(td);
 	struct thread_stat *ts = &td->ts;
 
 	if (!ddir_rw(ddir))
@@ -2921,7 +3212,7 @@ void add_lat_sample(struct thread_data *td, enum fio_ddir ddir,
 		    unsigned long long nsec, unsigned long long bs,
 		    uint64_t offset, uint8_t priority_bit)
 {
-	const bool needs_lock = td_async_processing(td);
+	const bool needs_lock = stat_needs_lock(td);
 	struct thread_stat *ts = &td->ts;
 
 	if (!ddir_rw(ddir))
@@ -26,6 +26,12 @@ struct group_run_stats {
 #define FIO_IO_U_LAT_U_NR 10
 #define FIO_IO_U_LAT_M_NR 12
 
+/*
+ * Samples an offload worker collects before folding them into the
+ * parent's stats, see stat_shard_flush()
+ */
+#define STAT_SHARD_BATCH	1024
+
 /*
  * Constants for clat percentiles
  */
@@ -33,6 +39,7 @@ struct group_run_stats {
 #define FIO_IO_U_PLAT_VAL (1 << FIO_IO_U_PLAT_BITS)
 #define FIO_IO_U_PLAT_GROUP_NR 29
 #define FIO_IO_U_PLAT_NR (FIO_IO_U_PLAT_GROUP_NR * FIO_IO_U_PLAT_VAL)
+#define FIO_IO_U_PLAT_BITS_MAX 9
 #define FIO_IO_U_LIST_MAX_LEN 20 /* The size of the default and user-specified
 					list of percentiles */
 
@@ -56,6 +63,12 @@ struct group_run_stats {
  *
  * FIO_IO_U_PLAT_NR is the total number of buckets.
  *
+ * The above are the defaults. A job picks its own with
+ * lat_hist_precision= (the bits) and lat_hist_max= (the groups needed to
+ * reach it). The geometry in use is kept in ts->plat_bits and
+ * ts->plat_groups, and the histograms are sized to match: FIO_PLAT_ROWS
+ * rows of plat_nr(ts) buckets, see alloc_thread_stat_plat().
+ *
  * DETAILS
  *
  * Suppose the lat varies from 0 to 999 (usec), the straightforward
@@ -155,6 +168,20 @@ enum fio_lat {
 	FIO_LAT_CNT = 3,
 };
 
+/*
+ * Rows of the latency histograms of a thread_stat: slat, clat and lat
+ * per data direction, sync, then clat of high and low priority IO per
+ * data direction
+ */
+enum {
+	FIO_PLAT_ROW_LAT	= 0,
+	FIO_PLAT_ROW_SYNC	= FIO_LAT_CNT * DDIR_RWDIR_CNT,
+	FIO_PLAT_ROW_HIGH_PRIO,
+	FIO_PLAT_ROW_LOW_PRIO	= FIO_PLAT_ROW_HIGH_PRIO + DDIR_RWDIR_CNT,
+
+	FIO_PLAT_ROWS		= FIO_PLAT_ROW_LOW_PRIO + DDIR_RWDIR_CNT,
+};
+
 struct thread_stat {
 	char name[FIO_JOBNAME_SIZE];
 	char verror[FIO_VERROR_SIZE];
@@ -190,6 +217,8 @@ struct thread_stat {
 	uint32_t clat_percentiles;
 	uint32_t lat_percentiles;
 	uint32_t slat_percentiles;
+	uint32_t plat_bits;
+	uint32_t plat_groups;
 	uint32_t pad;
 	uint64_t percentile_precision;
 	fio_fp64_t percentile_list[FIO_IO_U_LIST_MAX_LEN];
@@ -200,8 +229,15 @@ struct thread_stat {
 	uint64_t io_u_lat_n[FIO_IO_U_LAT_N_NR];
 	uint64_t io_u_lat_u[FIO_IO_U_LAT_U_NR];
 	uint64_t io_u_lat_m[FIO_IO_U_LAT_M_NR];
-	uint64_t io_u_plat[FIO_LAT_CNT][DDIR_RWDIR_CNT][FIO_IO_U_PLAT_NR];
-	uint64_t io_u_sync_plat[FIO_IO_U_PLAT_NR];
+
+	/*
+	 * Latency histograms, FIO_PLAT_ROWS rows of plat_nr() buckets. Not
+	 * part of the TS pdu, they are sent after it.
+	 */
+	union {
+		uint64_t *plat;
+		uint64_t pad_plat;
+	};
 
 	uint64_t total_io_u[DDIR_RWDIR_SYNC_CNT];
 	uint64_t short_io_u[DDIR_RWDIR_CNT];
@@ -249,8 +285,6 @@ struct thread_stat {
 	fio_fp64_t ss_deviation;
 	fio_fp64_t ss_criterion;
 
-	uint64_t io_u_plat_high_prio[DDIR_RWDIR_CNT][FIO_IO_U_PLAT_NR] __attribute__((aligned(8)));;
-	uint64_t io_u_plat_low_prio[DDIR_RWDIR_CNT][FIO_IO_U_PLAT_NR];
 	struct io_stat clat_high_prio_stat[DDIR_RWDIR_CNT] __attribute__((aligned(8)));
 	struct io_stat clat_low_prio_stat[DDIR_RWDIR_CNT];
 
@@ -266,6 +300,13 @@ struct thread_stat {
 
 	uint64_t cachehit;
 	uint64_t cachemiss;
+
+	/* latency of cache hits and misses, for engines telling them apart */
+	struct io_stat cachehit_lat_stat[DDIR_RWDIR_CNT] __attribute__((aligned(8)));
+	struct io_stat cachemiss_lat_stat[DDIR_RWDIR_CNT];
+
+	/* I/Os the engine gave up on after a timeout, e.g. gas_timeout */
+	uint64_t nr_timeouts;
 } __attribute__((packed));
 
 #define JOBS_ETA {							\
@@ -328,12 +369,16 @@ extern void init_thread_stat(struct thread_stat *ts);
 extern void init_group_run_stat(struct group_run_stats *gs);
 extern void eta_to_str(char *str, unsigned long eta_sec);
 extern bool calc_lat(struct io_stat *is, unsigned long long *min, unsigned long long *max, double *mean, double *dev);
-extern unsigned int calc_clat_percentiles(uint64_t *io_u_plat, unsigned long long nr, fio_fp64_t *plist, unsigned long long **output, unsigned long long *maxv, unsigned long long *minv);
+extern unsigned int calc_clat_percentiles(struct thread_stat *ts, uint64_t *io_u_plat, unsigned long long nr, fio_fp64_t *plist, unsigned long long **output, unsigned long long *maxv, unsigned long long *minv);
+extern unsigned int plat_groups_for(unsigned int bits, unsigned long long max);
+extern int alloc_thread_stat_plat(struct thread_stat *ts);
+extern void free_thread_stat_plat(struct thread_stat *ts);
 extern void stat_calc_lat_n(struct thread_stat *ts, double *io_u_lat);
 extern void stat_calc_lat_m(struct thread_stat *ts, double *io_u_lat);
 extern void stat_calc_lat_u(struct thread_stat *ts, double *io_u_lat);
 extern void stat_calc_dist(uint64_t *map, unsigned long total, double *io_u_dist);
 extern void reset_io_stats(struct thread_data *);
+extern void stat_shard_flush(struct thread_data *);
 extern void update_rusage_stat(struct thread_data *);
 extern void clear_rusage_stat(struct thread_data *);
 
@@ -351,6 +396,8 @@ extern void add_bw_sample(struct thread_data *, struct io_u *,
 				unsigned int, unsigned long long);
 extern void add_sync_clat_sample(struct thread_stat *ts,
 				unsigned long long nsec);
+extern void add_cache_lat_sample(struct thread_stat *ts, enum fio_ddir ddir,
+				unsigned long long nsec, bool hit);
 extern int calc_log_samples(void);
 
 extern void print_disk_util(struct disk_util_stat *, struct disk_util_agg *, int terse, struct buf_output *);
@@ -360,6 +407,39 @@ extern void json_array_add_disk_util(struct disk_util_stat *dus,
 extern struct io_log *agg_io_log[DDIR_RWDIR_CNT];
 extern bool write_bw_log;
 
+/*
+ * Number of latency buckets in use, see lat_hist_precision=
+ */
+static inline unsigned int plat_nr(struct thread_stat *ts)
+{
+	return ts->plat_groups << ts->plat_bits;
+}
+
+static inline uint64_t *ts_plat_row(struct thread_stat *ts, unsigned int row)
+{
+	return ts->plat + (size_t) row * plat_nr(ts);
+}
+
+static inline uint64_t *ts_io_u_plat(struct thread_stat *ts, int lat, int ddir)
+{
+	return ts_plat_row(ts, FIO_PLAT_ROW_LAT + lat * DDIR_RWDIR_CNT + ddir);
+}
+
+static inline uint64_t *ts_sync_plat(struct thread_stat *ts)
+{
+	return ts_plat_row(ts, FIO_PLAT_ROW_SYNC);
+}
+
+static inline uint64_t *ts_plat_high_prio(struct thread_stat *ts, int ddir)
+{
+	return ts_plat_row(ts, FIO_PLAT_ROW_HIGH_PRIO + ddir);
+}
+
+static inline uint64_t *ts_plat_low_prio(struct thread_stat *ts, int ddir)
+{
+	return ts_plat_row(ts, FIO_PLAT_ROW_LOW_PRIO + ddir);
+}
+
 static inline bool nsec_to_usec(unsigned long long *min,
 				unsigned long long *max, double *mean,
 				double *dev)
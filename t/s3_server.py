@@ -0,0 +1,267 @@
+#!/usr/bin/env python3
+#
+# s3_server.py
+#
+# A minimal S3 stand-in, serving objects from files of a local directory.
+# Meant for offline runs of the s3 ioengine (and the http ioengine in s3
+# mode), e.g. to benchmark GAS and S3 changes without AWS. Requests are
+# not authenticated, so use s3_credentials=anonymous or any credentials.
+#
+# Objects are files under ROOT/bucket/key, addressed path-style:
+#   GET    /bucket/key      (with or without Range: bytes=start-end)
+#   HEAD   /bucket/key
+#   PUT    /bucket/key
+#   DELETE /bucket/key
+#   GET    /bucket?list-type=2&prefix=...   (ListObjectsV2)
+#
+# USAGE
+# python3 t/s3_server.py [-p port] [-r root] [-l latency_ms]
+#
+# EXAMPLES
+# mkdir -p /tmp/s3/bucket && dd if=/dev/urandom of=/tmp/s3/bucket/obj bs=1M count=64
+# python3 t/s3_server.py -p 9000 -r /tmp/s3 &
+# ./fio --name=t --ioengine=s3 --s3_endpoint=127.0.0.1:9000 --s3_scheme=http \
+#       --s3_use_path_style=1 --s3_credentials=anonymous \
+#       --filename=bucket/obj --rw=randread --bs=64k --size=64m --iodepth=16
+#
+# REQUIREMENTS
+# Python 3.7+
+#
+
+import os
+import re
+import sys
+import argparse
+import threading
+import time
+from urllib.parse import urlsplit, parse_qs, unquote
+from xml.sax.saxutils import escape
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+class S3Handler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+    # Headers and body go out in separate writes, don't let Nagle hold
+    # back the body of small objects until the client's delayed ACK
+    disable_nagle_algorithm = True
+    root = '.'
+    verbose = False
+    latency = 0.0
+
+    def log_message(self, fmt, *args):
+        if self.verbose:
+            BaseHTTPRequestHandler.log_message(self, fmt, *args)
+
+    def delay(self):
+        """Simulated service time of the gateway, see --latency."""
+        if self.latency:
+            time.sleep(self.latency)
+
+    def path_parts(self):
+        path = unquote(urlsplit(self.path).path)
+        parts = [p for p in path.split('/') if p]
+        if '..' in parts:
+            return []
+        return parts
+
+    def object_path(self):
+        """Maps /bucket/key to a file under root, None if invalid."""
+        parts = self.path_parts()
+        if len(parts) < 2:
+            return None
+        return os.path.join(self.root, *parts)
+
+    def list_objects(self, bucket):
+        """ListObjectsV2 of a bucket, keys in lexicographic order."""
+        query = parse_qs(urlsplit(self.path).query)
+        prefix = query.get('prefix', [''])[0]
+        max_keys = int(query.get('max-keys', ['1000'])[0])
+        after = query.get('continuation-token', query.get('start-after', ['']))[0]
+
+        top = os.path.join(self.root, bucket)
+        if not os.path.isdir(top):
+            self.error(404, 'NoSuchBucket')
+            return
+
+        keys = []
+        for dirpath, _, files in os.walk(top):
+            for name in files:
+                key = os.path.relpath(os.path.join(dirpath, name), top)
+                key = key.replace(os.sep, '/')
+                if key.startswith(prefix) and key > after:
+                    keys.append(key)
+        keys.sort()
+
+        truncated = len(keys) > max_keys
+        keys = keys[:max_keys]
+
+        out = ['<?xml version="1.0" encoding="UTF-8"?>',
+               '<ListBucketResult xmlns="http://s3.amazonaws.com/doc/2006-03-01/">',
+               '<Name>{0}</Name>'.format(escape(bucket)),
+               '<Prefix>{0}</Prefix>'.format(escape(prefix)),
+               '<KeyCount>{0}</KeyCount>'.format(len(keys)),
+               '<MaxKeys>{0}</MaxKeys>'.format(max_keys),
+               '<IsTruncated>{0}</IsTruncated>'.format(str(truncated).lower())]
+        if truncated:
+            out.append('<NextContinuationToken>{0}</NextContinuationToken>'
+                       .format(escape(keys[-1])))
+        for key in keys:
+            size = os.path.getsize(os.path.join(top, key))
+            out.append('<Contents><Key>{0}</Key><Size>{1}</Size>'
+                       '<StorageClass>STANDARD</StorageClass></Contents>'
+                       .format(escape(key), size))
+        out.append('</ListBucketResult>')
+
+        self.reply(200, '\n'.join(out).encode(),
+                   {'Content-Type': 'application/xml'})
+
+    def reply(self, code, body=b'', headers=None):
+        self.send_response(code)
+        for name, value in (headers or {}).items():
+            self.send_header(name, value)
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        if body and self.command != 'HEAD':
+            self.wfile.write(body)
+
+    def error(self, code, s3_code):
+        body = ('<?xml version="1.0" encoding="UTF-8"?>\n'
+                '<Error><Code>{0}</Code><Message>{0}</Message></Error>'
+                .format(s3_code)).encode()
+        self.reply(code, body, {'Content-Type': 'application/xml'})
+
+    def do_HEAD(self):
+        self.do_GET()
+
+    def do_GET(self):
+        self.delay()
+        parts = self.path_parts()
+        if len(parts) == 1 and self.command == 'GET':
+            self.list_objects(parts[0])
+            return
+
+        path = self.object_path()
+        if not path or not os.path.isfile(path):
+            self.error(404, 'NoSuchKey')
+            return
+
+        size = os.path.getsize(path)
+        start, end = 0, size - 1
+        code = 200
+
+        rng = self.headers.get('Range')
+        if rng:
+            m = re.match(r'bytes=(\d*)-(\d*)$', rng.strip())
+            if not m or (not m.group(1) and not m.group(2)):
+                self.error(416, 'InvalidRange')
+                return
+            if not m.group(1):
+                start = max(size - int(m.group(2)), 0)
+            else:
+                start = int(m.group(1))
+                if m.group(2):
+                    end = min(int(m.group(2)), size - 1)
+            if start >= size or start > end:
+                self.error(416, 'InvalidRange')
+                return
+            code = 206
+
+        length = end - start + 1
+        self.send_response(code)
+        self.send_header('Content-Type', 'application/octet-stream')
+        self.send_header('Content-Length', str(length))
+        self.send_header('Accept-Ranges', 'bytes')
+        self.send_header('ETag', '"{0:x}"'.format(int(os.path.getmtime(path) * 1e6)))
+        if code == 206:
+            self.send_header('Content-Range',
+                             'bytes {0}-{1}/{2}'.format(start, end, size))
+        self.end_headers()
+        if self.command == 'HEAD':
+            return
+
+        with open(path, 'rb') as f:
+            f.seek(start)
+            while length:
+                chunk = f.read(min(length, 1 << 20))
+                if not chunk:
+                    break
+                self.wfile.write(chunk)
+                length -= len(chunk)
+
+    def read_body(self, out):
+        if self.headers.get('Transfer-Encoding', '').lower() == 'chunked':
+            while True:
+                size = int(self.rfile.readline().split(b';')[0], 16)
+                if not size:
+                    self.rfile.readline()
+                    return
+                out.write(self.rfile.read(size))
+                self.rfile.readline()
+
+        length = int(self.headers.get('Content-Length', 0))
+        while length:
+            chunk = self.rfile.read(min(length, 1 << 20))
+            if not chunk:
+                break
+            out.write(chunk)
+            length -= len(chunk)
+
+    def do_PUT(self):
+        self.delay()
+        path = self.object_path()
+        if not path:
+            self.error(400, 'InvalidRequest')
+            return
+
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        tmp = '{0}.tmp-{1}'.format(path, threading.get_ident())
+        with open(tmp, 'wb') as f:
+            self.read_body(f)
+        os.replace(tmp, path)
+        self.reply(200, headers={'ETag': '"{0:x}"'.format(int(os.path.getmtime(path) * 1e6))})
+
+    def do_DELETE(self):
+        self.delay()
+        path = self.object_path()
+        if path and os.path.isfile(path):
+            os.unlink(path)
+        self.reply(204)
+
+
+def parse_args():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('-a', '--address', default='127.0.0.1',
+                        help='address to listen on (default: 127.0.0.1)')
+    parser.add_argument('-p', '--port', type=int, default=9000,
+                        help='port to listen on (default: 9000)')
+    parser.add_argument('-r', '--root', default='.',
+                        help='directory holding the buckets (default: .)')
+    parser.add_argument('-l', '--latency', type=float, default=0,
+                        help='milliseconds to delay each request (default: 0)')
+    parser.add_argument('-v', '--verbose', action='store_true',
+                        help='log every request')
+    return parser.parse_args()
+
+
+def main():
+    args = parse_args()
+
+    S3Handler.root = os.path.abspath(args.root)
+    S3Handler.verbose = args.verbose
+    S3Handler.latency = args.latency / 1000.0
+
+    # Clients like fio's http_async open many connections at once
+    ThreadingHTTPServer.request_queue_size = 128
+    server = ThreadingHTTPServer((args.address, args.port), S3Handler)
+    server.daemon_threads = True
+    print("Serving {0} on {1}:{2}".format(S3Handler.root, args.address,
+                                          server.server_address[1]))
+    sys.stdout.flush()
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == '__main__':
+    main()
@@ -147,6 +147,7 @@ struct thread_options {
 	unsigned int log_offset;
 	unsigned int log_gz;
 	unsigned int log_gz_store;
+	unsigned int log_gz_codec;
 	unsigned int log_unix_epoch;
 	unsigned int norandommap;
 	unsigned int softrandommap;
@@ -253,6 +254,8 @@ struct thread_options {
 	unsigned int slat_percentiles;
 	unsigned int lat_percentiles;
 	unsigned int percentile_precision;	/* digits after decimal for percentiles */
+	unsigned int lat_hist_precision;
+	unsigned long long lat_hist_max;
 	fio_fp64_t percentile_list[FIO_IO_U_LIST_MAX_LEN];
 
 	char *read_iolog_file;
@@ -266,11 +269,14 @@ struct thread_options {
 	unsigned int write_lat_log;
 	unsigned int write_iops_log;
 	unsigned int write_hist_log;
+	unsigned int write_pct_log;
+	unsigned int log_format;
 
 	char *bw_log_file;
 	char *lat_log_file;
 	char *iops_log_file;
 	char *hist_log_file;
+	char *pct_log_file;
 	char *replay_redirect;
 
 	/*
@@ -440,6 +446,7 @@ struct thread_options_pack {
 	uint32_t log_offset;
 	uint32_t log_gz;
 	uint32_t log_gz_store;
+	uint32_t log_gz_codec;
 	uint32_t log_unix_epoch;
 	uint32_t norandommap;
 	uint32_t softrandommap;
@@ -451,6 +458,7 @@ struct thread_options_pack {
 	uint32_t exitall_error;
 
 	uint32_t sync_file_range;
+	uint32_t pad4;
 
 	struct zone_split zone_split[DDIR_RWDIR_CNT][ZONESPLIT_MAX];
 	uint32_t zone_split_nr[DDIR_RWDIR_CNT];
@@ -542,7 +550,8 @@ struct thread_options_pack {
 	uint32_t lat_percentiles;
 	uint32_t slat_percentiles;
 	uint32_t percentile_precision;
-	uint32_t pad3;
+	uint32_t lat_hist_precision;
+	uint64_t lat_hist_max;
 	fio_fp64_t percentile_list[FIO_IO_U_LIST_MAX_LEN];
 
 	uint8_t read_iolog_file[FIO_TOP_STR_MAX];
@@ -555,11 +564,14 @@ struct thread_options_pack {
 	uint32_t write_lat_log;
 	uint32_t write_iops_log;
 	uint32_t write_hist_log;
+	uint32_t write_pct_log;
+	uint32_t log_format;
 
 	uint8_t bw_log_file[FIO_TOP_STR_MAX];
 	uint8_t lat_log_file[FIO_TOP_STR_MAX];
 	uint8_t iops_log_file[FIO_TOP_STR_MAX];
 	uint8_t hist_log_file[FIO_TOP_STR_MAX];
+	uint8_t pct_log_file[FIO_TOP_STR_MAX];
 	uint8_t replay_redirect[FIO_TOP_STR_MAX];
 
 	/*
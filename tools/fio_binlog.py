@@ -0,0 +1,279 @@
+#!/usr/bin/env python3
+#
+# fio_binlog.py
+#
+# Read fio logs written with log_format=binary, or stored compressed with
+# log_store_compressed. Converts them to the same comma separated lines fio
+# writes with log_format=text, or aggregates the samples per data direction
+# without converting them to text first.
+#
+# USAGE
+# fio_binlog.py [-s] [-t start-end] FILE...
+#
+# EXAMPLES
+# Convert a binary completion latency log to CSV:
+#   fio_binlog.py job_clat.1.log > job_clat.1.csv
+#
+# Samples, min, mean and max per data direction in the first minute:
+#   fio_binlog.py -s -t 0-60000 job_clat.1.log
+#
+# FILE FORMAT
+# A binary log is a sequence of blocks, each a little endian header
+#
+#   uint32 magic ("FIOB"), uint16 version, uint16 flags, uint32 log_type,
+#   uint32 nr_samples, uint32 len, uint32 raw_len
+#
+# followed by len bytes of samples stored by column: time, value, bs and
+# (if flags has OFFSET) offset as uint64, then ddir and priority as uint8.
+# If flags has ZLIB, LZ4 or ZSTD, the raw_len bytes of columns are
+# compressed with that codec (an LZ4 block, or a zstd frame). In a
+# percentile log (flags has PCT) the bs column holds the percentile as
+# an IEEE 754 double.
+#
+# A stored compressed log (.fz) is a sequence of chunks, each a little
+# endian header
+#
+#   uint32 magic ("FIOZ"), uint16 codec, uint16 pad, uint32 seq, uint32 len,
+#   uint64 raw_len, uint64 first_time, uint64 last_time
+#
+# followed by len bytes of struct io_sample compressed with the codec (0 is
+# zlib, 1 lz4, 2 zstd). The samples are in the byte order of the machine
+# that ran the job. Chunks outside the -t range are skipped without being
+# decompressed. See iolog.h in the fio sources.
+#
+# REQUIREMENTS
+# Python 3.5+
+# The lz4 and zstandard modules, for logs compressed with those codecs
+#
+
+import sys
+import mmap
+import zlib
+import array
+import struct
+import argparse
+
+HDR = struct.Struct('<IHHIIII')
+MAGIC = 0x424f4946
+VERSION = 1
+
+CHUNK_HDR = struct.Struct('<IHHIIQQQ')
+CHUNK_MAGIC = 0x5a4f4946
+
+# struct io_sample: time, value, ddir, priority, bs, and optionally offset
+SAMPLE = struct.Struct('=QQIB3xQ')
+SAMPLE_OFFSET = struct.Struct('=QQIB3xQQ')
+S_OFFSET = 0x80000000
+S_PCT = 0x40000000
+
+F_OFFSET = 1 << 0
+F_ZLIB = 1 << 1
+F_PCT = 1 << 2
+F_LZ4 = 1 << 3
+F_ZSTD = 1 << 4
+
+
+def lz4_decompress(raw, raw_len):
+    import lz4.block
+    return lz4.block.decompress(raw, uncompressed_size=raw_len)
+
+
+def zstd_decompress(raw, raw_len):
+    import zstandard
+    return zstandard.ZstdDecompressor().decompress(raw, max_output_size=raw_len)
+
+
+CODECS = (
+    (F_ZLIB, 'zlib', lambda raw, raw_len: zlib.decompress(raw)),
+    (F_LZ4, 'lz4', lz4_decompress),
+    (F_ZSTD, 'zstandard', zstd_decompress),
+)
+
+# chunk header codec number to block flag
+CHUNK_CODECS = (F_ZLIB, F_LZ4, F_ZSTD)
+
+
+def decompress(path, flags, raw, raw_len):
+    for flag, module, fn in CODECS:
+        if flags & flag:
+            try:
+                return fn(raw, raw_len)
+            except ImportError:
+                raise ValueError('%s: the %s module is needed to read this log'
+                                 % (path, module))
+    return raw
+
+
+class Block(object):
+    def __init__(self, flags, nr, raw):
+        self.flags = flags
+        self.nr = nr
+
+        if raw is None:
+            return
+
+        cols = ['time', 'value', 'bs']
+        if flags & F_OFFSET:
+            cols.append('offset')
+
+        pos = 0
+        for name in cols:
+            col = array.array('d' if name == 'bs' and flags & F_PCT else 'Q')
+            col.frombytes(raw[pos:pos + 8 * nr])
+            if sys.byteorder != 'little':
+                col.byteswap()
+            setattr(self, name, col)
+            pos += 8 * nr
+        if not flags & F_OFFSET:
+            self.offset = None
+
+        self.ddir = raw[pos:pos + nr]
+        self.prio = raw[pos + nr:pos + 2 * nr]
+
+    def rows(self, tmin, tmax):
+        for i in range(self.nr):
+            if tmin <= self.time[i] <= tmax:
+                yield i
+
+
+def chunk_block(raw):
+    """Turn the io_sample array of a stored chunk into a Block."""
+    if not raw:
+        return Block(0, 0, b'')
+
+    ddir = struct.unpack_from('=I', raw, 16)[0]
+    fmt = SAMPLE_OFFSET if ddir & S_OFFSET else SAMPLE
+    nr = len(raw) // fmt.size
+    samples = list(fmt.iter_unpack(raw[:nr * fmt.size]))
+
+    flags = F_OFFSET if ddir & S_OFFSET else 0
+    if ddir & S_PCT:
+        flags |= F_PCT
+
+    b = Block(flags, nr, None)
+    b.time = [s[0] for s in samples]
+    b.value = [s[1] for s in samples]
+    b.ddir = [s[2] & ~(S_OFFSET | S_PCT) for s in samples]
+    b.prio = [s[3] for s in samples]
+    if flags & F_PCT:
+        b.bs = [struct.unpack('=d', struct.pack('=Q', s[4]))[0]
+                for s in samples]
+    else:
+        b.bs = [s[4] for s in samples]
+    b.offset = [s[5] for s in samples] if flags & F_OFFSET else None
+    return b
+
+
+def blocks(path, tmin, tmax):
+    with open(path, 'rb') as f:
+        try:
+            m = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        except ValueError:
+            return
+
+        pos = 0
+        while pos + HDR.size <= len(m):
+            if struct.unpack_from('<I', m, pos)[0] == CHUNK_MAGIC:
+                magic, codec, _, seq, length, raw_len, first, last = \
+                    CHUNK_HDR.unpack_from(m, pos)
+                pos += CHUNK_HDR.size
+                if last < tmin or first > tmax:
+                    pos += length
+                    continue
+                if codec >= len(CHUNK_CODECS):
+                    raise ValueError('%s: chunk %d has unknown codec %d' %
+                                     (path, seq, codec))
+                raw = decompress(path, CHUNK_CODECS[codec],
+                                 m[pos:pos + length], raw_len)
+                if len(raw) != raw_len:
+                    raise ValueError('%s: truncated chunk %d' % (path, seq))
+                pos += length
+
+                yield chunk_block(raw)
+                continue
+
+            magic, version, flags, log_type, nr, length, raw_len = \
+                HDR.unpack_from(m, pos)
+            if magic != MAGIC:
+                raise ValueError('%s: bad block magic at offset %d' % (path, pos))
+            if version != VERSION:
+                raise ValueError('%s: unsupported version %d' % (path, version))
+            pos += HDR.size
+
+            raw = decompress(path, flags, m[pos:pos + length], raw_len)
+            if len(raw) != raw_len:
+                raise ValueError('%s: truncated block at offset %d' % (path, pos))
+            pos += length
+
+            yield Block(flags, nr, raw)
+        m.close()
+
+
+def to_csv(path, tmin, tmax, out):
+    for b in blocks(path, tmin, tmax):
+        for i in b.rows(tmin, tmax):
+            if b.flags & F_PCT:
+                out.write('%d, %d, %d, %f\n' %
+                          (b.time[i], b.value[i], b.ddir[i], b.bs[i]))
+            elif b.offset is None:
+                out.write('%d, %d, %d, %d, %d\n' %
+                          (b.time[i], b.value[i], b.ddir[i], b.bs[i],
+                           b.prio[i]))
+            else:
+                out.write('%d, %d, %d, %d, %d, %d\n' %
+                          (b.time[i], b.value[i], b.ddir[i], b.bs[i],
+                           b.offset[i], b.prio[i]))
+
+
+def stats(path, tmin, tmax, out):
+    acc = {}
+    for b in blocks(path, tmin, tmax):
+        for i in b.rows(tmin, tmax):
+            key = (b.ddir[i], b.bs[i]) if b.flags & F_PCT else (b.ddir[i],)
+            v = b.value[i]
+            s = acc.get(key)
+            if s is None:
+                acc[key] = [1, v, v, v]
+            else:
+                s[0] += 1
+                s[1] = min(s[1], v)
+                s[2] = max(s[2], v)
+                s[3] += v
+
+    for key in sorted(acc):
+        n, vmin, vmax, vsum = acc[key]
+        name = '%s: ddir=%d' % (path, key[0])
+        if len(key) > 1:
+            name += ' pct=%f' % key[1]
+        out.write('%s samples=%d min=%d mean=%.3f max=%d\n' %
+                  (name, n, vmin, float(vsum) / n, vmax))
+
+
+def parse_range(s):
+    start, _, end = s.partition('-')
+    return int(start or 0), int(end) if end else float('inf')
+
+
+def parse_args():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('-s', '--stats', action='store_true',
+                        help='print samples, min, mean and max per data direction')
+    parser.add_argument('-t', '--time', type=parse_range, default=(0, float('inf')),
+                        help='only use samples in this msec range, e.g. 1000-5000')
+    parser.add_argument('FILE', nargs='+', help='binary or stored compressed fio logs')
+    return parser.parse_args()
+
+
+def main():
+    args = parse_args()
+    tmin, tmax = args.time
+
+    for path in args.FILE:
+        if args.stats:
+            stats(path, tmin, tmax, sys.stdout)
+        else:
+            to_csv(path, tmin, tmax, sys.stdout)
+
+
+if __name__ == '__main__':
+    main()